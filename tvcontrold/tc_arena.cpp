@@ -0,0 +1,59 @@
+#include <tc_arena.h>
+#include <string.h>
+
+/** Alignment of every allocation */
+#define TC_ARENA_ALIGN (sizeof(void *))
+
+/**
+ *  Block allocated when the arena buffer is full.
+ */
+struct tc_arena_block_t {
+	tc_arena_block_t *next; /**< Previous block allocated */
+};
+
+void *tc_arena_alloc(tc_arena_t *arena, uint32_t len)
+{
+	/* Allocate from the buffer if it fits */
+	uint32_t start = (arena->used + TC_ARENA_ALIGN - 1) &
+	                 ~(uint32_t)(TC_ARENA_ALIGN - 1);
+	if (start <= arena->size && len <= arena->size - start) {
+		arena->used = start + len;
+		return arena->buf + start;
+	}
+
+	/* Allocate a new block otherwise */
+	tc_arena_block_t *b = (tc_arena_block_t *)
+		malloc(sizeof(tc_arena_block_t) + len);
+	b->next = arena->overflow;
+	arena->overflow = b;
+	return b + 1;
+}
+
+char *tc_arena_strndup(tc_arena_t *arena, const char *str, uint32_t len)
+{
+	char *r = (char *)tc_arena_alloc(arena, len + 1);
+	memcpy(r, str, len);
+	r[len] = 0;
+	return r;
+}
+
+uint32_t tc_arena_mark(const tc_arena_t *arena)
+{
+	return arena->used;
+}
+
+void tc_arena_rewind(tc_arena_t *arena, uint32_t mark)
+{
+	if (mark < arena->used)
+		arena->used = mark;
+}
+
+void tc_arena_reset(tc_arena_t *arena)
+{
+	arena->used = 0;
+	while (arena->overflow) {
+		tc_arena_block_t *b = arena->overflow;
+		arena->overflow = b->next;
+		free(b);
+	}
+}
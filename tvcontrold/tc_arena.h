@@ -0,0 +1,65 @@
+#ifndef TC_ARENA_H_INCLUDED
+#define TC_ARENA_H_INCLUDED
+
+#include <tc_types.h>
+
+/** Block allocated when the arena buffer is full */
+typedef struct tc_arena_block_t tc_arena_block_t;
+
+/**
+ *  Scratch arena, allocating from a buffer by moving a pointer.
+ */
+typedef struct tc_arena_t {
+	char *buf;                  /**< Buffer to allocate from          */
+	uint32_t size;              /**< Size of the buffer               */
+	uint32_t used;              /**< Bytes already used of the buffer */
+	tc_arena_block_t *overflow; /**< Blocks allocated when full       */
+} tc_arena_t;
+
+/** Constant to initialize an arena with a static buffer */
+#define TC_ARENA_INIT(_buf) { (_buf), sizeof(_buf), 0, NULL }
+
+/**
+ *  Allocate memory from the arena.
+ *
+ *  \param arena  Arena to allocate from.
+ *  \param len    Number of bytes to allocate.
+ *  \return The allocated memory, valid until the arena is reset.
+ */
+void *tc_arena_alloc(tc_arena_t *arena, uint32_t len);
+
+/**
+ *  Duplicate a string in the arena.
+ *
+ *  \param arena  Arena to allocate from.
+ *  \param str    String to duplicate.
+ *  \param len    Length of the string.
+ *  \return The zero terminated copy, valid until the arena is reset.
+ */
+char *tc_arena_strndup(tc_arena_t *arena, const char *str, uint32_t len);
+
+/**
+ *  Get the current position of the arena to rewind to it.
+ *
+ *  \param arena  Arena to get the position of.
+ *  \return The position of the arena.
+ */
+uint32_t tc_arena_mark(const tc_arena_t *arena);
+
+/**
+ *  Free the buffer allocated after a position of the arena.
+ *
+ *  \param arena  Arena to rewind.
+ *  \param mark   Position returned by tc_arena_mark.
+ *  \remarks The overflow blocks are kept until the arena is reset.
+ */
+void tc_arena_rewind(tc_arena_t *arena, uint32_t mark);
+
+/**
+ *  Free everything allocated from the arena.
+ *
+ *  \param arena  Arena to reset.
+ */
+void tc_arena_reset(tc_arena_t *arena);
+
+#endif /* TC_ARENA_H_INCLUDED */
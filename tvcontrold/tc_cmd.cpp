@@ -4,9 +4,21 @@
 #include <tc_pioneer.h>
 #include <tc_osd.h>
 #include <tc_mouse.h>
+#include <tc_tools.h>
+#include <tc_arena.h>
+#include <tc_exec.h>
+#include <tc_timer.h>
+#include <tc_server.h>
+#include <tc_work.h>
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <config.h>
 
 /* Define the following macro to debug */
@@ -20,15 +32,75 @@
  */
 typedef struct tc_cmd_t {
 	const char *name;
+	uint32_t namelen;
 	int (*exec)(tc_cmd_t *cmd, const char *buf, uint32_t len);
+	int (*parse)(tc_cmd_t *cmd, const char *buf, uint32_t len);
+	int (*run)(tc_cmd_t *cmd, int code);
 	int (*extend)(tc_cmd_t *cmd, const char *buf, uint32_t len);
 	void (*free)(tc_cmd_t *cmd);
+	struct tc_cmd_ring_t *ring;
+	bool reused;
 	tc_cmd_t *next;
 } tc_cmd_t;
 
 /** Command to be extended if any */
 static tc_cmd_t *tc_cmd_extend = NULL;
 
+/** Size of the scratch buffer for the execution of a command */
+#define TC_CMD_SCRATCH_SIZE 8192
+
+/** Scratch arena for the transient data of the command in execution */
+static char tc_cmd_scratch_buf[TC_CMD_SCRATCH_SIZE];
+static tc_arena_t tc_cmd_scratch = TC_ARENA_INIT(tc_cmd_scratch_buf);
+
+/** Number of nested calls to tc_cmd, the scratch is reset when 0 */
+static uint32_t tc_cmd_depth = 0;
+
+/** Maximum length of a subcommand in a script or of a device command */
+#define TC_CMD_LINE_MAX 512
+
+/** Number of device commands of a device waiting to run at once */
+#define TC_CMD_RING_JOBS 16
+
+/**
+ *  Device command posted to the lane of its device.
+ */
+typedef struct tc_cmd_job_t {
+	tc_work_job_t job;          /**< Job of the pool                    */
+	tc_cmd_t *cmd;              /**< Device command                     */
+	int code;                   /**< Code parsed for the command or -1  */
+	uint32_t len;               /**< Length of the arguments            */
+	char arg[TC_CMD_LINE_MAX];  /**< Arguments, for exec and the log    */
+} tc_cmd_job_t;
+
+/**
+ *  Lane of a device with the slots of its commands, reused in turn.
+ */
+typedef struct tc_cmd_ring_t {
+	tc_work_lane_t lane;                 /**< Lane of the device       */
+	uint32_t posted;                     /**< Commands posted          */
+	tc_cmd_job_t job[TC_CMD_RING_JOBS];  /**< Slots of the commands    */
+} tc_cmd_ring_t;
+
+/** Sequences of the scripts, reused in turn once their device commands
+    have finished. They grow while the devices are busy, bounded by the
+    commands waiting for them. */
+static tc_work_seq_t **tc_cmd_seqs = NULL;
+static uint32_t tc_cmd_seqs_count = 0;
+static uint32_t tc_cmd_seqs_next = 0;
+
+/** Sequence of the device commands of the script in execution, or NULL */
+static tc_work_seq_t *tc_cmd_seq = NULL;
+
+/** True if the command in execution has queued device commands */
+static bool tc_cmd_posted = false;
+
+/** True while the configuration is compiled without executing it */
+static bool tc_cmd_dryrun = false;
+
+/** True while the lines come from the mapped configuration cache */
+static bool tc_cmd_mapped = false;
+
 /**
  *  Get the length of the next word.
  *
@@ -110,34 +182,243 @@ static bool tc_cmd_is(const char *buf, uint32_t len, const char *str)
 
 /* --- Environment management functions ---------------------------------- */
 
-/** Environment entry */
+/*
+ *  The environment is written from the device threads while the server
+ *  reads it, so readers never lock: values are immutable and replaced
+ *  atomically, and the replaced objects are retired until no reader that
+ *  could see them remains. The readers announce themselves in one of two
+ *  counters by the parity of the epoch, and the writers advance the epoch
+ *  freeing the objects retired two epochs ago when its counter is zero.
+ */
+
+/** Text of a value with its CSV line */
+typedef struct tc_cmd_env_text_t {
+	uint32_t len;      /**< Length of the value                */
+	uint32_t csvlen;   /**< Length of the CSV line             */
+	char *value;       /**< Value (zero terminated)            */
+	char *csv;         /**< Scaped CSV line of the variable    */
+} tc_cmd_env_text_t;
+
+/**
+ *  Value of an environment variable, immutable once published. The text
+ *  of a native value is only formatted the first time it is read.
+ */
+typedef struct tc_cmd_env_value_t {
+	tc_cmd_env_num_t num;        /**< Native value or TC_CMD_ENV_TEXT  */
+	tc_cmd_env_format_t format;  /**< Formatter of the native value    */
+	const char *name;            /**< Name of the variable for the CSV */
+	tc_cmd_env_text_t *text;     /**< Text or NULL if not formatted    */
+} tc_cmd_env_value_t;
+
+/** Environment entry, kept until tc_cmd_release */
 typedef struct tc_cmd_env_t {
-	const char *name;
-	const char *value;
-	tc_cmd_env_t *next;
+	const char *name;  /**< Interned name of the variable      */
+	uint32_t namelen;  /**< Length of the name                 */
+	uint32_t hash;     /**< Hash of the name                   */
+	tc_cmd_env_value_t *value; /**< Current value or NULL      */
+	char *change;      /**< Script executed on change or NULL  */
+	bool pending;      /**< Change notified and not executed   */
+	uint64_t changed;  /**< Last execution of the change (ms)  */
+	uint32_t version;  /**< Version of the last value change   */
 } tc_cmd_env_t;
 
-/** Environment for command execution */
-static tc_cmd_env_t *tc_cmd_env = NULL;
+/** Minimum time between executions of a change command in ms */
+#define TC_CMD_ENV_CHANGE_MS 100
+
+/** Index of the environment, replaced when it grows */
+typedef struct tc_cmd_env_index_t {
+	uint32_t count;        /**< Entries published                 */
+	uint32_t alloc;        /**< Entries allocated                 */
+	uint32_t size;         /**< Slots of the table (power of two) */
+	tc_cmd_env_t **entry;  /**< Entries indexed by their handle   */
+	uint32_t *slot;        /**< Handle + 1 of each name (0: free) */
+} tc_cmd_env_index_t;
+
+/** Object retired until no reader can see it */
+typedef struct tc_cmd_env_retired_t {
+	struct tc_cmd_env_retired_t *next;
+	void *ptr;
+	void (*release)(void *ptr);
+} tc_cmd_env_retired_t;
+
+/** Initial number of slots of the environment table (power of two) */
+#define TC_CMD_ENV_SIZE 64
+
+/** Current index of the environment */
+static tc_cmd_env_index_t *tc_cmd_env = NULL;
+
+/** Version of the environment, changed with every value change under
+    tc_cmd_env_lock, after the version of the entry changed */
+static uint32_t tc_cmd_env_version = 0;
+
+/** Last snapshot of the environment, NULL if none was requested */
+static tc_cmd_env_csv_t *tc_cmd_env_snapshot = NULL;
+
+/** Lock of the writers of the environment */
+static pthread_mutex_t tc_cmd_env_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Epoch of the readers, and readers in each epoch parity */
+static uint32_t tc_cmd_env_epoch = 0;
+static uint32_t tc_cmd_env_readers[2] = { 0, 0 };
+
+/** Objects retired in each epoch parity */
+static tc_cmd_env_retired_t *tc_cmd_env_retired[2] = { NULL, NULL };
+
+/**
+ *  Start reading the environment. The objects read are valid until
+ *  tc_cmd_env_read_end.
+ *
+ *  \return The epoch to end the reading.
+ */
+static uint32_t tc_cmd_env_read_begin(void)
+{
+	while (true) {
+		uint32_t epoch = __atomic_load_n(&tc_cmd_env_epoch, __ATOMIC_SEQ_CST);
+		__atomic_add_fetch(&tc_cmd_env_readers[epoch & 1], 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&tc_cmd_env_epoch, __ATOMIC_SEQ_CST) == epoch)
+			return epoch;
+		/* The epoch changed meanwhile, announce in the new one */
+		__atomic_sub_fetch(&tc_cmd_env_readers[epoch & 1], 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+/**
+ *  End reading the environment.
+ *
+ *  \param epoch  Epoch returned by tc_cmd_env_read_begin.
+ */
+static void tc_cmd_env_read_end(uint32_t epoch)
+{
+	__atomic_sub_fetch(&tc_cmd_env_readers[epoch & 1], 1, __ATOMIC_SEQ_CST);
+}
+
+/**
+ *  Release the objects of a retired list.
+ *
+ *  \param list  List of retired objects.
+ */
+static void tc_cmd_env_reclaim(tc_cmd_env_retired_t *list)
+{
+	while (list) {
+		tc_cmd_env_retired_t *next = list->next;
+		list->release(list->ptr);
+		free(list);
+		list = next;
+	}
+}
+
+/**
+ *  Retire an object replaced in the environment, with the writer lock.
+ *
+ *  The epoch advances if there are no readers of the previous one, and
+ *  the objects retired then are released.
+ *
+ *  \param ptr      Object no longer reachable by new readers.
+ *  \param release  Function to release it.
+ */
+static void tc_cmd_env_retire(void *ptr, void (*release)(void *ptr))
+{
+	uint32_t epoch = tc_cmd_env_epoch;
+	tc_cmd_env_retired_t *r =
+		(tc_cmd_env_retired_t *)malloc(sizeof(tc_cmd_env_retired_t));
+	r->ptr = ptr;
+	r->release = release;
+	r->next = tc_cmd_env_retired[epoch & 1];
+	tc_cmd_env_retired[epoch & 1] = r;
+
+	/* The readers of the previous epoch could see the objects retired in it */
+	uint32_t prev = (epoch + 1) & 1;
+	if (__atomic_load_n(&tc_cmd_env_readers[prev], __ATOMIC_SEQ_CST))
+		return;
+	tc_cmd_env_reclaim(tc_cmd_env_retired[prev]);
+	tc_cmd_env_retired[prev] = NULL;
+	__atomic_store_n(&tc_cmd_env_epoch, epoch + 1, __ATOMIC_SEQ_CST);
+}
+
+/**
+ *  Release an index of the environment, without its entries.
+ *
+ *  \param ptr  Index of the environment.
+ */
+static void tc_cmd_env_index_free(void *ptr)
+{
+	tc_cmd_env_index_t *index = (tc_cmd_env_index_t *)ptr;
+	free(index->entry);
+	free(index->slot);
+	free(index);
+}
+
+/**
+ *  Release the reference of the environment to a snapshot.
+ *
+ *  \param ptr  Snapshot of the environment.
+ */
+static void tc_cmd_env_snapshot_free(void *ptr)
+{
+	tc_cmd_env_csv_release((tc_cmd_env_csv_t *)ptr);
+}
 
 /**
- *  Find the environment variable structure.
+ *  Find the slot of a name in the environment table.
  *
+ *  \param index    Index of the environment.
  *  \param name     Name of the environment variable.
  *  \param namelen  Length of the name of the variable.
- *  \retval NULL if not found.
- *  \retval A pointer to the environment structure if found.
+ *  \param hash     Hash of the name.
+ *  \return The slot with the handle of the name or the free slot for it.
  */
-static tc_cmd_env_t *tc_cmd_env_find(const char *name, uint32_t namelen)
+static uint32_t *tc_cmd_env_slot(tc_cmd_env_index_t *index, const char *name,
+                                 uint32_t namelen, uint32_t hash)
 {
-	tc_cmd_env_t *e = tc_cmd_env;
-	while (e) {
-		if (strlen(e->name) == namelen &&
-		    !strncmp(e->name, name, namelen))
-			return e;
-		e = e->next;
+	uint32_t mask = index->size - 1;
+	uint32_t i = hash & mask;
+	while (true) {
+		uint32_t *slot = &index->slot[i];
+		uint32_t h = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+		if (!h)
+			return slot;
+		tc_cmd_env_t *e = index->entry[h - 1];
+		if (e->hash == hash && e->namelen == namelen &&
+		    !memcmp(e->name, name, namelen))
+			return slot;
+		i = (i + 1) & mask;
 	}
-	return NULL;
+}
+
+/**
+ *  Find the handle of an environment variable, while reading.
+ *
+ *  \param name     Name of the environment variable.
+ *  \param namelen  Length of the name of the variable.
+ *  \retval TC_CMD_ENV_INVALID if not found.
+ *  \retval The handle of the variable if found.
+ */
+static tc_cmd_env_handle_t tc_cmd_env_find(const char *name, uint32_t namelen)
+{
+	tc_cmd_env_index_t *index =
+		__atomic_load_n(&tc_cmd_env, __ATOMIC_ACQUIRE);
+	if (!index)
+		return TC_CMD_ENV_INVALID;
+	uint32_t *slot = tc_cmd_env_slot(index, name, namelen,
+	                                 tc_hash(name, namelen));
+	uint32_t h = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+	return h ? h - 1 : TC_CMD_ENV_INVALID;
+}
+
+/**
+ *  Get the entry of an environment variable, while reading.
+ *
+ *  \param handle  Handle of the environment variable.
+ *  \retval NULL if the handle is not valid.
+ *  \retval The entry of the variable.
+ */
+static tc_cmd_env_t *tc_cmd_env_entry(tc_cmd_env_handle_t handle)
+{
+	tc_cmd_env_index_t *index =
+		__atomic_load_n(&tc_cmd_env, __ATOMIC_ACQUIRE);
+	if (!index || handle >= __atomic_load_n(&index->count, __ATOMIC_ACQUIRE))
+		return NULL;
+	return index->entry[handle];
 }
 
 /**
@@ -152,8 +433,33 @@ static bool tc_cmd_env_ischar(char ch)
 	return isalnum(ch) || ch == '_';
 }
 
-int tc_cmd_env_set(const char *name,  uint32_t namelen,
-                   const char *value, uint32_t valuelen)
+/**
+ *  Create an index of the environment with the entries of another.
+ *
+ *  \param old   Index to copy or NULL.
+ *  \param size  Number of slots (power of two).
+ *  \return The new index.
+ */
+static tc_cmd_env_index_t *tc_cmd_env_index_new(tc_cmd_env_index_t *old,
+                                                uint32_t size)
+{
+	tc_cmd_env_index_t *index =
+		(tc_cmd_env_index_t *)malloc(sizeof(tc_cmd_env_index_t));
+	index->count = old ? old->count : 0;
+	index->alloc = size / 2;
+	index->size = size;
+	index->entry = (tc_cmd_env_t **)malloc(index->alloc * sizeof(tc_cmd_env_t *));
+	index->slot = (uint32_t *)calloc(size, sizeof(uint32_t));
+	uint32_t i;
+	for (i = 0; i < index->count; i++) {
+		tc_cmd_env_t *e = old->entry[i];
+		index->entry[i] = e;
+		*tc_cmd_env_slot(index, e->name, e->namelen, e->hash) = i + 1;
+	}
+	return index;
+}
+
+tc_cmd_env_handle_t tc_cmd_env_intern(const char *name, uint32_t namelen)
 {
 	/* Validate the name */
 	uint32_t i = 0;
@@ -162,30 +468,49 @@ int tc_cmd_env_set(const char *name,  uint32_t namelen,
 			break;
 	}
 	if (i < namelen || namelen == 0) {
-		tc_log(TC_LOG_ERR, "Invalid name for variable \"%s\"",
-		       strndupa(name, namelen));
-		return -1;
+		tc_log(TC_LOG_ERR, "Invalid name for variable \"%.*s\"",
+		       (int)namelen, namelen ? name : "");
+		return TC_CMD_ENV_INVALID;
 	}
 
-	/* Replace an existing value if found */
-	tc_cmd_env_t *e = tc_cmd_env_find(name, namelen);
-	if (e) {
-		free((void *)e->value);
-		e->value = strndup(value, valuelen);
-		tc_log(TC_LOG_INFO, "Variable %s = \"%s\" (replaced value)",
-		       strndupa(name, namelen), strndupa(value, valuelen));
-		return 0;
+	pthread_mutex_lock(&tc_cmd_env_lock);
+
+	/* Return the existing name if found */
+	tc_cmd_env_index_t *index = tc_cmd_env;
+	uint32_t hash = tc_hash(name, namelen);
+	uint32_t *slot = index ? tc_cmd_env_slot(index, name, namelen, hash) : NULL;
+	if (slot && *slot) {
+		pthread_mutex_unlock(&tc_cmd_env_lock);
+		return *slot - 1;
+	}
+
+	/* Replace the index to keep the table at most half full */
+	if (!index || index->count == index->alloc) {
+		index = tc_cmd_env_index_new(index, index ? index->size << 1 :
+		                                            TC_CMD_ENV_SIZE);
+		tc_cmd_env_index_t *old = tc_cmd_env;
+		__atomic_store_n(&tc_cmd_env, index, __ATOMIC_RELEASE);
+		if (old)
+			tc_cmd_env_retire(old, tc_cmd_env_index_free);
+		slot = tc_cmd_env_slot(index, name, namelen, hash);
 	}
 
-	/* Add the new value if not found */
-	e = (tc_cmd_env_t *)malloc(sizeof(tc_cmd_env_t));
+	/* Add the new name, visible once its slot is set */
+	tc_cmd_env_t *e = (tc_cmd_env_t *)malloc(sizeof(tc_cmd_env_t));
 	e->name = strndup(name, namelen);
-	e->value = strndup(value, valuelen);
-	e->next = tc_cmd_env;
-	tc_cmd_env = e;
-	tc_log(TC_LOG_INFO, "Variable %s = \"%s\" (new value)",
-	       strndupa(name, namelen), strndupa(value, valuelen));
-	return 0;
+	e->namelen = namelen;
+	e->hash = hash;
+	e->value = NULL;
+	e->change = NULL;
+	e->pending = false;
+	e->changed = 0;
+	e->version = 0;
+	tc_cmd_env_handle_t handle = index->count;
+	index->entry[handle] = e;
+	__atomic_store_n(&index->count, handle + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(slot, handle + 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&tc_cmd_env_lock);
+	return handle;
 }
 
 /**
@@ -257,165 +582,906 @@ static char *tc_cmd_env_csv_scape(char *output, const char *text)
 	return output;
 }
 
-const char *tc_cmd_env_csv(void)
+
+/**
+ *  Create the text of a value with its CSV line.
+ *
+ *  \param name   Name of the variable.
+ *  \param value  Value of the variable.
+ *  \param len    Length of the value.
+ *  \return The text, to be freed with free.
+ */
+static tc_cmd_env_text_t *tc_cmd_env_text_new(const char *name,
+                                              const char *value, uint32_t len)
 {
-	/* Debug */
-	#ifdef TC_CMD_DEBUG
-	tc_log(TC_LOG_DEBUG, "tc_cmd: env_csv");
-	#endif /* TC_CMD_DEBUG */
+	tc_cmd_env_text_t *t =
+		(tc_cmd_env_text_t *)malloc(sizeof(tc_cmd_env_text_t) + len + 1);
+	char *text = (char *)(t + 1);
+	if (len)
+		memcpy(text, value, len);
+	text[len] = 0;
+	uint32_t csvlen = tc_cmd_env_csv_scape_len(name) + 1 +
+	                  tc_cmd_env_csv_scape_len(text) + 1;
+	t = (tc_cmd_env_text_t *)realloc(t, sizeof(tc_cmd_env_text_t) +
+	                                    len + 1 + csvlen);
+	t->len = len;
+	t->csvlen = csvlen;
+	t->value = (char *)(t + 1);
+	t->csv = t->value + len + 1;
+	char *o = tc_cmd_env_csv_scape(t->csv, name);
+	*o++ = ',';
+	o = tc_cmd_env_csv_scape(o, t->value);
+	*o++ = '\n';
+	return t;
+}
 
-	/* Calculate tht length */
-	uint32_t len = 1;
-	tc_cmd_env_t *e = tc_cmd_env;
-	while (e) {
-		len += tc_cmd_env_csv_scape_len(e->name);
-		len++;
-		len += tc_cmd_env_csv_scape_len(e->value);
-		len++;
-		e = e->next;
+/**
+ *  Default formatter of the native values.
+ *
+ *  \param buf  Buffer to write the text into.
+ *  \param len  Length of the buffer.
+ *  \param num  Value to format.
+ *  \return The length of the text, as snprintf.
+ */
+static int tc_cmd_env_format(char *buf, uint32_t len,
+                             const tc_cmd_env_num_t *num)
+{
+	switch (num->type) {
+	case TC_CMD_ENV_INT:   return snprintf(buf, len, "%lld", (long long)num->i);
+	case TC_CMD_ENV_FLOAT: return snprintf(buf, len, "%g", num->f);
+	case TC_CMD_ENV_BOOL:  return snprintf(buf, len, "%d", num->b ? 1 : 0);
+	}
+	return snprintf(buf, len, "%s", "");
+}
+
+/**
+ *  Get the text of a value, formatting it the first time, while reading.
+ *
+ *  \param v  Value of a variable.
+ *  \return The text of the value, valid until the reading ends.
+ */
+static tc_cmd_env_text_t *tc_cmd_env_text(tc_cmd_env_value_t *v)
+{
+	tc_cmd_env_text_t *t = __atomic_load_n(&v->text, __ATOMIC_ACQUIRE);
+	if (t)
+		return t;
+	char buf[64];
+	int n = (v->format ? v->format : tc_cmd_env_format)(buf, sizeof(buf),
+	                                                     &v->num);
+	if (n < 0)
+		n = 0;
+	else if (n >= (int)sizeof(buf))
+		n = sizeof(buf) - 1;
+	t = tc_cmd_env_text_new(v->name, buf, n);
+
+	/* Another reader could have formatted it meanwhile */
+	tc_cmd_env_text_t *prev = NULL;
+	if (!__atomic_compare_exchange_n(&v->text, &prev, t, false,
+	                                 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		free(t);
+		t = prev;
+	}
+	return t;
+}
+
+/**
+ *  Release a value of a variable.
+ *
+ *  \param ptr  Value of the variable.
+ */
+static void tc_cmd_env_value_free(void *ptr)
+{
+	tc_cmd_env_value_t *v = (tc_cmd_env_value_t *)ptr;
+	free(v->text);
+	free(v);
+}
+
+/**
+ *  Get the value of an environment variable, while reading.
+ *
+ *  \param handle  Handle of the environment variable.
+ *  \retval NULL if the variable has no value.
+ *  \retval The value of the variable, valid until the reading ends.
+ */
+static const char *tc_cmd_env_value(tc_cmd_env_handle_t handle)
+{
+	tc_cmd_env_t *e = tc_cmd_env_entry(handle);
+	if (!e)
+		return NULL;
+	tc_cmd_env_value_t *v = __atomic_load_n(&e->value, __ATOMIC_ACQUIRE);
+	return v ? tc_cmd_env_text(v)->value : NULL;
+}
+
+/**
+ *  Get the native value of an environment variable, parsing the text
+ *  values that are numbers.
+ *
+ *  \param handle  Handle of the environment variable.
+ *  \param num     Native value to fill.
+ *  \retval -1 if the variable has no value or it is not a number.
+ *  \retval 0 on success.
+ */
+static int tc_cmd_env_num(tc_cmd_env_handle_t handle, tc_cmd_env_num_t *num)
+{
+	int r = -1;
+	uint32_t epoch = tc_cmd_env_read_begin();
+	tc_cmd_env_t *e = tc_cmd_env_entry(handle);
+	tc_cmd_env_value_t *v =
+		e ? __atomic_load_n(&e->value, __ATOMIC_ACQUIRE) : NULL;
+	if (v && v->num.type != TC_CMD_ENV_TEXT) {
+		*num = v->num;
+		r = 0;
+	} else if (v && v->text->len) {
+		const char *text = v->text->value;
+		char *end;
+		num->type = TC_CMD_ENV_INT;
+		num->i = strtoll(text, &end, 10);
+		if (*end) {
+			num->type = TC_CMD_ENV_FLOAT;
+			num->f = strtod(text, &end);
+		}
+		r = *end ? -1 : 0;
+	}
+	tc_cmd_env_read_end(epoch);
+	return r;
+}
+
+/**
+ *  Notify the change of a variable with a subscription.
+ *
+ *  The changes are coalesced: no other notification is enqueued for the
+ *  variable until the subscription is executed, and then it sees the last
+ *  value.
+ *
+ *  \param handle  Handle of the variable changed.
+ *  \param e       Entry of the variable.
+ */
+static void tc_cmd_env_notify(tc_cmd_env_handle_t handle, tc_cmd_env_t *e)
+{
+	if (!__atomic_load_n(&e->change, __ATOMIC_ACQUIRE) ||
+	    __atomic_exchange_n(&e->pending, true, __ATOMIC_ACQ_REL))
+		return;
+	if (tc_server_notify(handle))
+		__atomic_store_n(&e->pending, false, __ATOMIC_RELEASE);
+}
+
+/**
+ *  Publish the new value of a variable, while reading.
+ *
+ *  \param handle  Handle of the variable.
+ *  \param e       Entry of the variable.
+ *  \param v       New value, the previous one is released when unread.
+ *  \return True if the variable had a previous value.
+ */
+static bool tc_cmd_env_replace(tc_cmd_env_handle_t handle, tc_cmd_env_t *e,
+                               tc_cmd_env_value_t *v)
+{
+	pthread_mutex_lock(&tc_cmd_env_lock);
+	tc_cmd_env_value_t *old = e->value;
+	__atomic_store_n(&e->value, v, __ATOMIC_RELEASE);
+	/* The entry has its version before it is published, so the readers
+	   of a version see every change up to it */
+	uint32_t version = tc_cmd_env_version + 1;
+	__atomic_store_n(&e->version, version, __ATOMIC_RELEASE);
+	__atomic_store_n(&tc_cmd_env_version, version, __ATOMIC_RELEASE);
+	if (old)
+		tc_cmd_env_retire(old, tc_cmd_env_value_free);
+	pthread_mutex_unlock(&tc_cmd_env_lock);
+	tc_cmd_env_notify(handle, e);
+	tc_server_changed();
+	return old != NULL;
+}
+
+int tc_cmd_env_set_handle(tc_cmd_env_handle_t handle,
+                          const char *value, uint32_t valuelen)
+{
+	/* The device threads are cancelled, not in the middle of this */
+	int cancel;
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel);
+	uint32_t epoch = tc_cmd_env_read_begin();
+	tc_cmd_env_t *e = tc_cmd_env_entry(handle);
+	if (!e) {
+		tc_cmd_env_read_end(epoch);
+		pthread_setcancelstate(cancel, NULL);
+		tc_log(TC_LOG_ERR, "Invalid variable handle %u", (unsigned)handle);
+		return -1;
+	}
+
+	/* Nothing changes if the value is the same */
+	tc_cmd_env_value_t *v = __atomic_load_n(&e->value, __ATOMIC_ACQUIRE);
+	if (v && v->num.type == TC_CMD_ENV_TEXT && v->text->len == valuelen &&
+	    !memcmp(v->text->value, value, valuelen)) {
+		tc_cmd_env_read_end(epoch);
+		pthread_setcancelstate(cancel, NULL);
+		return 0;
+	}
+
+	/* Prepare the value and its CSV line before locking */
+	v = (tc_cmd_env_value_t *)malloc(sizeof(tc_cmd_env_value_t));
+	v->num.type = TC_CMD_ENV_TEXT;
+	v->format = NULL;
+	v->name = e->name;
+	v->text = tc_cmd_env_text_new(e->name, value, valuelen);
+	bool replaced = tc_cmd_env_replace(handle, e, v);
+	tc_log(TC_LOG_INFO, "Variable %s = \"%s\" (%s value)",
+	       e->name, v->text->value, replaced ? "replaced" : "new");
+	tc_cmd_env_read_end(epoch);
+	pthread_setcancelstate(cancel, NULL);
+	return 0;
+}
+
+int tc_cmd_env_set_num(tc_cmd_env_handle_t handle,
+                       const tc_cmd_env_num_t *num,
+                       tc_cmd_env_format_t format)
+{
+	/* The device threads are cancelled, not in the middle of this */
+	int cancel;
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel);
+	uint32_t epoch = tc_cmd_env_read_begin();
+	tc_cmd_env_t *e = tc_cmd_env_entry(handle);
+	if (!e) {
+		tc_cmd_env_read_end(epoch);
+		pthread_setcancelstate(cancel, NULL);
+		tc_log(TC_LOG_ERR, "Invalid variable handle %u", (unsigned)handle);
+		return -1;
+	}
+
+	/* Nothing changes if the value is the same */
+	tc_cmd_env_value_t *v = __atomic_load_n(&e->value, __ATOMIC_ACQUIRE);
+	if (v && v->num.type == num->type && v->format == format &&
+	    ((num->type == TC_CMD_ENV_INT && v->num.i == num->i) ||
+	     (num->type == TC_CMD_ENV_FLOAT && v->num.f == num->f) ||
+	     (num->type == TC_CMD_ENV_BOOL && v->num.b == num->b))) {
+		tc_cmd_env_read_end(epoch);
+		pthread_setcancelstate(cancel, NULL);
+		return 0;
 	}
 
-	/* Allocate the output */
+	/* The text is formatted by the first reader */
+	v = (tc_cmd_env_value_t *)malloc(sizeof(tc_cmd_env_value_t));
+	v->num = *num;
+	v->format = format;
+	v->name = e->name;
+	v->text = NULL;
+	tc_cmd_env_replace(handle, e, v);
 	#ifdef TC_CMD_DEBUG
-	tc_log(TC_LOG_DEBUG, "tc_cmd: env_csv: alloc:%u", (unsigned)len);
+	tc_log(TC_LOG_DEBUG, "tc_cmd: env_set_num: %s type:%u", e->name,
+	       (unsigned)num->type);
 	#endif /* TC_CMD_DEBUG */
-	char *output = (char *)malloc(len);
+	tc_cmd_env_read_end(epoch);
+	pthread_setcancelstate(cancel, NULL);
+	return 0;
+}
 
-	/* Write each entry of the output */
-	char *o = output;
-	e = tc_cmd_env;
-	while (e) {
-		o = tc_cmd_env_csv_scape(o, e->name);
-		*o++ = ',';
-		o = tc_cmd_env_csv_scape(o, e->value);
-		*o++ = '\n';
-		e = e->next;
-	}
+/**
+ *  Subscribe a script to the changes of a variable, replacing the
+ *  previous one. Only the main thread changes the subscriptions.
+ *
+ *  \param handle  Handle of the environment variable.
+ *  \param cmd     Name of the script to execute when the value changes.
+ *  \param len     Length of the name, 0 to remove the subscription.
+ */
+static void tc_cmd_env_subscribe(tc_cmd_env_handle_t handle,
+                                 const char *cmd, uint32_t len)
+{
+	uint32_t epoch = tc_cmd_env_read_begin();
+	tc_cmd_env_t *e = tc_cmd_env_entry(handle);
+	tc_cmd_env_read_end(epoch);
+	char *change = len ? strndup(cmd, len) : NULL;
+	free(__atomic_exchange_n(&e->change, change, __ATOMIC_ACQ_REL));
+}
 
-	/* Write the end of text */
-	*o++ = 0;
+int tc_cmd_env_set(const char *name,  uint32_t namelen,
+                   const char *value, uint32_t valuelen)
+{
+	tc_cmd_env_handle_t handle = tc_cmd_env_intern(name, namelen);
+	if (handle == TC_CMD_ENV_INVALID)
+		return -1;
+	return tc_cmd_env_set_handle(handle, value, valuelen);
+}
+
+const tc_cmd_env_csv_t *tc_cmd_env_csv(void)
+{
+	uint32_t epoch = tc_cmd_env_read_begin();
+
+	/* Share the last snapshot while the environment doesn't change */
+	uint32_t version = __atomic_load_n(&tc_cmd_env_version, __ATOMIC_ACQUIRE);
+	tc_cmd_env_csv_t *csv =
+		__atomic_load_n(&tc_cmd_env_snapshot, __ATOMIC_ACQUIRE);
+	if (csv && csv->version == version) {
+		__atomic_add_fetch(&csv->refs, 1, __ATOMIC_RELAXED);
+		tc_cmd_env_read_end(epoch);
+		return csv;
+	}
 
 	/* Debug */
 	#ifdef TC_CMD_DEBUG
-	tc_log(TC_LOG_DEBUG, "tc_cmd: env_csv: finished");
+	tc_log(TC_LOG_DEBUG, "tc_cmd: env_csv: version:%u", (unsigned)version);
 	#endif /* TC_CMD_DEBUG */
 
-	/* Return the output */
-	return output;
+	/* Take the values, a newer version is rebuilt later */
+	tc_cmd_env_index_t *index =
+		__atomic_load_n(&tc_cmd_env, __ATOMIC_ACQUIRE);
+	uint32_t count = index ? __atomic_load_n(&index->count, __ATOMIC_ACQUIRE) : 0;
+	tc_cmd_env_text_t **texts = (tc_cmd_env_text_t **)
+		malloc(count * sizeof(tc_cmd_env_text_t *));
+	uint32_t len = 0;
+	uint32_t i;
+	for (i = 0; i < count; i++) {
+		tc_cmd_env_value_t *v =
+			__atomic_load_n(&index->entry[i]->value, __ATOMIC_ACQUIRE);
+		texts[i] = v ? tc_cmd_env_text(v) : NULL;
+		if (texts[i])
+			len += texts[i]->csvlen;
+	}
+
+	/* Join the lines of the variables, newest first */
+	csv = (tc_cmd_env_csv_t *)malloc(sizeof(tc_cmd_env_csv_t) + len + 1);
+	csv->refs = 1;
+	csv->version = version;
+	csv->len = len;
+	csv->text = (char *)(csv + 1);
+	char *o = csv->text;
+	for (i = count; i--; ) {
+		if (!texts[i])
+			continue;
+		memcpy(o, texts[i]->csv, texts[i]->csvlen);
+		o += texts[i]->csvlen;
+	}
+	*o = 0;
+	tc_cmd_env_read_end(epoch);
+	free(texts);
+
+	/* Keep it as the last snapshot, unless a writer is busy */
+	if (!pthread_mutex_trylock(&tc_cmd_env_lock)) {
+		tc_cmd_env_csv_t *old = tc_cmd_env_snapshot;
+		if (!old || (int32_t)(version - old->version) > 0) {
+			csv->refs++;
+			__atomic_store_n(&tc_cmd_env_snapshot, csv, __ATOMIC_RELEASE);
+			if (old)
+				tc_cmd_env_retire(old, tc_cmd_env_snapshot_free);
+		}
+		pthread_mutex_unlock(&tc_cmd_env_lock);
+	}
+	return csv;
+}
+
+void tc_cmd_env_csv_release(const tc_cmd_env_csv_t *csv)
+{
+	tc_cmd_env_csv_t *c = (tc_cmd_env_csv_t *)csv;
+	if (c && !__atomic_sub_fetch(&c->refs, 1, __ATOMIC_ACQ_REL))
+		free(c);
+}
+
+int tc_cmd_env_changes(uint32_t *version, tc_cmd_env_change_t change,
+                       void *param)
+{
+	uint32_t current = __atomic_load_n(&tc_cmd_env_version, __ATOMIC_ACQUIRE);
+	if (current == *version)
+		return 0;
+
+	/* The changes after reading the version are seen again later */
+	uint32_t epoch = tc_cmd_env_read_begin();
+	tc_cmd_env_index_t *index =
+		__atomic_load_n(&tc_cmd_env, __ATOMIC_ACQUIRE);
+	uint32_t count = index ? __atomic_load_n(&index->count, __ATOMIC_ACQUIRE) : 0;
+	uint32_t i;
+	for (i = 0; i < count; i++) {
+		tc_cmd_env_t *e = index->entry[i];
+		uint32_t v = __atomic_load_n(&e->version, __ATOMIC_ACQUIRE);
+		if (!v || (int32_t)(v - *version) <= 0)
+			continue;
+		tc_cmd_env_value_t *value =
+			__atomic_load_n(&e->value, __ATOMIC_ACQUIRE);
+		tc_cmd_env_text_t *t = tc_cmd_env_text(value);
+		if (!change(param, t->csv, t->csvlen - 1)) {
+			tc_cmd_env_read_end(epoch);
+			return -1;
+		}
+	}
+	tc_cmd_env_read_end(epoch);
+	*version = current;
+	return 0;
 }
 
 /**
- *  Create a new buffer with the replaced environment values.
- * 
+ *  Replace the environment values of a buffer.
+ *
  *  \param buf  Buffer with values to be replaced.
- *  \param len  Length of original buffer and output of final.
- *  \return The allocated buffer that should be freed with free.
+ *  \param len  Length of the buffer.
+ *  \param out  Output buffer or NULL to check the syntax and length.
+ *  \retval -1 on error (with a log entry when not writing).
+ *  \retval The length of the buffer with the values replaced.
  */
-static char *tc_cmd_env_subs(const char *buf, uint32_t *len)
+static int32_t tc_cmd_env_subs_write(const char *buf, uint32_t len, char *out)
 {
-	uint8_t state = 0;
 	uint32_t l = 0;
-	uint32_t alloc = 0;
-	char *result = NULL;
 	uint32_t i = 0;
-	bool finished = false;
-	while (true) {
-		if (l == alloc) {
-			alloc = alloc ? (alloc << 1) : 16;
-			result = (char *)realloc(result, alloc);
-		}
-		if (i == *len) {
-			finished = true;
-			break;
-		}
+	while (i < len) {
 		if (buf[i] == '$') {
 			i++;
-			if (i == *len)  {
-				tc_log(TC_LOG_ERR, "Syntax error: $ at end of command");
-				break;
+			if (i == len)  {
+				if (!out)
+					tc_log(TC_LOG_ERR, "Syntax error: $ at end of command");
+				return -1;
 			}
 			if (buf[i] != '$') {
 				uint32_t endi;
-				for (endi = i; endi < *len; endi++)
+				for (endi = i; endi < len; endi++)
 					if (!tc_cmd_env_ischar(buf[endi]))
 						break;
-				if (endi == i) { 
-					tc_log(TC_LOG_ERR, "Syntax error: $ not followed by variable name");
-					break;
-				}
-				tc_cmd_env_t *env = tc_cmd_env_find(buf + i, endi - i);
-				if (!env) {
-					tc_log(TC_LOG_ERR, "Syntax error: Variable \"%s\" not found",
-					       strndupa(buf + i, endi - i));
-					break;
+				if (endi == i) {
+					if (!out)
+						tc_log(TC_LOG_ERR, "Syntax error: $ not followed by variable name");
+					return -1;
 				}
-				uint32_t newl = l + strlen(env->value);
-				while (alloc < newl) {
-					alloc = alloc << 1;
-					result = (char *)realloc(result, alloc);
+				const char *value =
+					tc_cmd_env_value(tc_cmd_env_find(buf + i, endi - i));
+				if (!value) {
+					if (!out)
+						tc_log(TC_LOG_ERR, "Syntax error: Variable \"%s\" not found",
+						       tc_arena_strndup(&tc_cmd_scratch, buf + i, endi - i));
+					return -1;
 				}
-				memcpy(result + l, env->value, strlen(env->value));
-				l = newl;
+				uint32_t vl = strlen(value);
+				if (out)
+					memcpy(out + l, value, vl);
+				l += vl;
 				i = endi;
 				continue;
 			}
 		}
-		result[l++] = buf[i++];
+		if (out)
+			out[l] = buf[i];
+		l++;
+		i++;
 	}
-	*len = l;
-	if (!finished) {
-		if (result) {
-			free(result);
-			result = NULL;
-		}
+	return l;
+}
+
+/**
+ *  Create a new buffer with the replaced environment values.
+ *
+ *  \param buf  Buffer with values to be replaced.
+ *  \param len  Length of original buffer and output of final.
+ *  \return The zero terminated buffer allocated in the scratch arena,
+ *          or NULL on error (with a log entry).
+ */
+static char *tc_cmd_env_subs(const char *buf, uint32_t *len)
+{
+	/* Both passes should see the same values */
+	uint32_t epoch = tc_cmd_env_read_begin();
+	int32_t l = tc_cmd_env_subs_write(buf, *len, NULL);
+	if (l < 0) {
+		tc_cmd_env_read_end(epoch);
+		return NULL;
 	}
+	char *result = (char *)tc_arena_alloc(&tc_cmd_scratch, l + 1);
+	tc_cmd_env_subs_write(buf, *len, result);
+	tc_cmd_env_read_end(epoch);
+	result[l] = 0;
+	*len = l;
 	return result;
 }
 
 
-/* --- List of commands registered --------------------------------------- */
+/* --- Command dispatch index -------------------------------------------- */
+
+/**
+ *  Slot of the command dispatch index.
+ */
+typedef struct tc_cmd_index_slot_t {
+	uint32_t hash;  /**< Hash of the command name         */
+	uint32_t order; /**< Registration order of the command */
+	tc_cmd_t *cmd;  /**< Command or NULL if the slot is free */
+} tc_cmd_index_slot_t;
+
+/** Initial number of slots of the index (power of two) */
+#define TC_CMD_INDEX_SIZE 64
+
+/** Number of bits of the negative lookup filter (power of two) */
+#define TC_CMD_FILTER_BITS 4096
 
 /**
- *  List of commands to be able to process.
+ *  Graph of commands loaded from the configuration, with its index.
  */
-static tc_cmd_t *tc_cmd_first = NULL;
+typedef struct tc_cmd_graph_t {
+	tc_cmd_t *first;            /**< Commands to be freed with the graph */
+	tc_cmd_index_slot_t *index; /**< Open addressing table by name       */
+	uint32_t size;              /**< Number of slots of the index        */
+	uint32_t count;             /**< Number of commands indexed          */
+	uint32_t order;             /**< Registration counter, newer commands
+	                                 hide the older ones                 */
+	uint32_t words;             /**< Maximum words of a command name     */
+	uint32_t filter[TC_CMD_FILTER_BITS / 32]; /**< Bit per hash of name, to
+	                                 discard unknown names quickly      */
+	void *map;                  /**< Configuration cache mapped, or NULL */
+	size_t maplen;              /**< Length of the cache mapped          */
+} tc_cmd_graph_t;
+
+/** Graph of commands in use */
+static tc_cmd_graph_t *tc_cmd_graph = NULL;
+
+/** Previous graph of commands while the configuration is reloaded */
+static tc_cmd_graph_t *tc_cmd_graph_prev = NULL;
+
+/** Generation of the index, changed every time a command is added */
+static uint32_t tc_cmd_index_gen = 0;
+
+/** Check and set the filter bit of a hash */
+#define TC_CMD_FILTER_BIT(_h)  ((_h) & (TC_CMD_FILTER_BITS - 1))
+#define TC_CMD_FILTER_TEST(_g, _h) \
+	((_g)->filter[TC_CMD_FILTER_BIT(_h) >> 5] & (1u << ((_h) & 31)))
+#define TC_CMD_FILTER_SET(_g, _h) \
+	((_g)->filter[TC_CMD_FILTER_BIT(_h) >> 5] |= (1u << ((_h) & 31)))
 
 /**
- *  Add a new command to the list of available commands.
+ *  Find the slot of a name in the index.
  *
- *  \param cmd  Command to be added.
+ *  \param g     Graph of commands.
+ *  \param name  Name of the command.
+ *  \param len   Length of the name.
+ *  \param hash  Hash of the name.
+ *  \return The slot with the command or the free slot to add it.
  */
-static void tc_cmd_add(tc_cmd_t *cmd)
+static tc_cmd_index_slot_t *tc_cmd_index_slot(tc_cmd_graph_t *g,
+                                              const char *name, uint32_t len,
+                                              uint32_t hash)
 {
-	cmd->next = tc_cmd_first;
-	tc_cmd_first = cmd;
-	#ifdef TC_CMD_DEBUG
-	tc_log(TC_LOG_DEBUG, "cmd: add: \"%s\"", cmd->name);
-	#endif /* TC_CMD_DEBUG */
+	uint32_t mask = g->size - 1;
+	uint32_t i = hash & mask;
+	while (true) {
+		tc_cmd_index_slot_t *s = &g->index[i];
+		if (!s->cmd)
+			return s;
+		if (s->hash == hash && s->cmd->namelen == len &&
+		    !memcmp(s->cmd->name, name, len))
+			return s;
+		i = (i + 1) & mask;
+	}
 }
 
-
-/* --- Native command list ----------------------------------------------- */
-
 /**
- *  Execute the exit command.
+ *  Resize the index keeping the commands already added.
  *
- *  \param cmd   Pointer to the command to execute
- *  \param buf   Buffer with the name of the command to execute
- *  \param len   Length of the command to execute.
+ *  \param g     Graph of commands.
+ *  \param size  New number of slots (power of two).
+ */
+static void tc_cmd_index_resize(tc_cmd_graph_t *g, uint32_t size)
+{
+	tc_cmd_index_slot_t *old = g->index;
+	uint32_t old_size = g->size;
+	g->index = (tc_cmd_index_slot_t *)
+		calloc(size, sizeof(tc_cmd_index_slot_t));
+	g->size = size;
+	uint32_t i;
+	for (i = 0; i < old_size; i++) {
+		if (!old[i].cmd)
+			continue;
+		*tc_cmd_index_slot(g, old[i].cmd->name, old[i].cmd->namelen,
+		                   old[i].hash) = old[i];
+	}
+	free(old);
+}
+
+/**
+ *  Add a command to the dispatch index of the graph in use.
+ *
+ *  \param cmd  Command to be indexed, replacing any other with its name.
+ */
+static void tc_cmd_index_add(tc_cmd_t *cmd)
+{
+	tc_cmd_graph_t *g = tc_cmd_graph;
+	if ((g->count + 1) * 2 > g->size)
+		tc_cmd_index_resize(g, g->size ? g->size << 1 : TC_CMD_INDEX_SIZE);
+	uint32_t hash = tc_hash(cmd->name, cmd->namelen);
+	tc_cmd_index_slot_t *s = tc_cmd_index_slot(g, cmd->name, cmd->namelen,
+	                                           hash);
+	if (!s->cmd)
+		g->count++;
+	s->hash = hash;
+	s->order = g->order++;
+	s->cmd = cmd;
+	tc_cmd_index_gen++;
+	TC_CMD_FILTER_SET(g, hash);
+	uint32_t words = 1;
+	uint32_t i;
+	for (i = 0; i < cmd->namelen; i++)
+		if (cmd->name[i] == ' ')
+			words++;
+	if (words > g->words)
+		g->words = words;
+}
+
+/**
+ *  Find the command that should process a buffer.
+ *
+ *  The name of the command must be followed by a space or by the end
+ *  of the buffer, that are removed from the buffer as tc_cmd_starts does.
+ *
+ *  \param buf  Input and output parameter with the buffer.
+ *  \param len  Input and output parameter with the buffer length.
+ *  \return The command found or NULL if there is no command for it.
+ */
+static tc_cmd_t *tc_cmd_index_find(const char **buf, uint32_t *len)
+{
+	tc_cmd_graph_t *g = tc_cmd_graph;
+	if (!g || !g->count)
+		return NULL;
+	const char *b = *buf;
+	uint32_t l = *len;
+	tc_cmd_index_slot_t *found = NULL;
+	uint32_t hash = TC_HASH_INIT;
+	uint32_t words = 0;
+	uint32_t i;
+	for (i = 0; i <= l && words < g->words; i++) {
+		if (i < l && b[i] != ' ') {
+			hash = TC_HASH_STEP(hash, b[i]);
+			continue;
+		}
+		words++;
+		if (TC_CMD_FILTER_TEST(g, hash)) {
+			tc_cmd_index_slot_t *s = tc_cmd_index_slot(g, b, i, hash);
+			if (s->cmd && (!found || s->order > found->order))
+				found = s;
+		}
+		hash = TC_HASH_STEP(hash, ' ');
+	}
+	if (!found)
+		return NULL;
+	uint32_t n = found->cmd->namelen;
+	if (n == l) {
+		*buf = NULL;
+		*len = 0;
+	} else {
+		*buf += n + 1;
+		*len -= n + 1;
+	}
+	return found->cmd;
+}
+
+
+/* --- List of commands registered --------------------------------------- */
+
+/**
+ *  Add a new command to the graph in use.
+ *
+ *  \param cmd  Command to be added.
+ */
+static void tc_cmd_add(tc_cmd_t *cmd)
+{
+	cmd->namelen = strlen(cmd->name);
+	/* Native commands are shared by every graph and never freed */
+	if (cmd->free) {
+		cmd->next = tc_cmd_graph->first;
+		tc_cmd_graph->first = cmd;
+	}
+	tc_cmd_index_add(cmd);
+	#ifdef TC_CMD_DEBUG
+	tc_log(TC_LOG_DEBUG, "cmd: add: \"%s\"", cmd->name);
+	#endif /* TC_CMD_DEBUG */
+}
+
+/**
+ *  Create a new empty graph of commands.
+ *
+ *  \return The new graph.
+ */
+static tc_cmd_graph_t *tc_cmd_graph_create(void)
+{
+	return (tc_cmd_graph_t *)calloc(1, sizeof(tc_cmd_graph_t));
+}
+
+/**
+ *  Release a graph of commands and every command owned by it.
+ *
+ *  \param g  Graph to release.
+ */
+static void tc_cmd_graph_release(tc_cmd_graph_t *g)
+{
+	if (!g)
+		return;
+	while (g->first) {
+		tc_cmd_t *c = g->first;
+		g->first = c->next;
+		if (c->ring)
+			tc_work_drain(&c->ring->lane);
+		c->free(c);
+	}
+	if (g->map)
+		munmap(g->map, g->maplen);
+	free(g->index);
+	free(g);
+	tc_cmd_index_gen++;
+}
+
+/**
+ *  Take a command of the previous graph while reloading, to reuse it.
+ *
+ *  \param release  Free function of the type of command to take.
+ *  \param name     Name of the command.
+ *  \param len      Length of the name.
+ *  \param same     Function to check if it is configured the same way.
+ *  \param arg      Argument for the check function.
+ *  \return The command removed from the previous graph or NULL.
+ */
+static tc_cmd_t *tc_cmd_graph_take(void (*release)(tc_cmd_t *cmd),
+                                   const char *name, uint32_t len,
+                                   bool (*same)(tc_cmd_t *cmd, void *arg),
+                                   void *arg)
+{
+	if (!tc_cmd_graph_prev)
+		return NULL;
+	tc_cmd_t **c = &tc_cmd_graph_prev->first;
+	while (*c) {
+		tc_cmd_t *cmd = *c;
+		if (cmd->free == release && cmd->namelen == len &&
+		    !memcmp(cmd->name, name, len) && same(cmd, arg)) {
+			*c = cmd->next;
+			cmd->reused = true;
+			return cmd;
+		}
+		c = &cmd->next;
+	}
+	return NULL;
+}
+
+/**
+ *  Give back the reused commands of a graph to the previous graph.
+ *
+ *  \param g     Graph with the reused commands.
+ *  \param prev  Graph to give them back to, or NULL to keep them.
+ */
+static void tc_cmd_graph_giveback(tc_cmd_graph_t *g, tc_cmd_graph_t *prev)
+{
+	tc_cmd_t **c = &g->first;
+	while (*c) {
+		tc_cmd_t *cmd = *c;
+		if (cmd->reused && prev) {
+			*c = cmd->next;
+			cmd->next = prev->first;
+			prev->first = cmd;
+		} else
+			c = &cmd->next;
+		cmd->reused = false;
+	}
+}
+
+/**
+ *  Parse the arguments of a command.
+ *
+ *  \param cmd  Command to parse the arguments for.
+ *  \param buf  Buffer with the arguments.
+ *  \param len  Length of the arguments.
+ *  \return The code to run the command or -1 if the command has no
+ *          parser or the arguments are not valid.
+ */
+static int tc_cmd_parse(tc_cmd_t *cmd, const char *buf, uint32_t len)
+{
+	if (!cmd->parse)
+		return -1;
+	return cmd->parse(cmd, buf, len);
+}
+
+/**
+ *  Run a device command in a thread of the pool.
+ *
+ *  \param job  Job of the command.
+ *  \retval 0 on success.
+ *  \retval -1 on error in command.
+ */
+static int tc_cmd_job_run(tc_work_job_t *job)
+{
+	tc_cmd_job_t *j = tc_containerof(job, tc_cmd_job_t, job);
+	tc_cmd_t *cmd = j->cmd;
+	int r = cmd->parse ? cmd->run(cmd, j->code) :
+	                     cmd->exec(cmd, j->arg, j->len);
+	if (r)
+		tc_log(TC_LOG_ERR, "Error in command \"%s %s\"", cmd->name, j->arg);
+	return r;
+}
+
+/**
+ *  Post a device command to the lane of its device, so the server
+ *  doesn't wait for the device. The commands of a script keep their
+ *  order through the sequence of the script. The command takes the slot
+ *  of the oldest one of the device, and fails if it is still pending.
+ *
+ *  \param cmd   Device command.
+ *  \param code  Code parsed for the command, or -1 without parser.
+ *  \param buf   Buffer with the arguments, copied.
+ *  \param len   Length of the arguments.
+ *  \retval 0 once posted, or on success if run without pool.
+ *  \retval -1 on error in command.
+ */
+static int tc_cmd_post(tc_cmd_t *cmd, int code, const char *buf, uint32_t len)
+{
+	tc_cmd_ring_t *ring = cmd->ring;
+	if (len >= TC_CMD_LINE_MAX) {
+		tc_log(TC_LOG_ERR, "Command \"%s\" too long", cmd->name);
+		return -1;
+	}
+	if (!tc_work_reserve(&ring->lane, TC_CMD_RING_JOBS)) {
+		tc_log(TC_LOG_ERR, "Device of \"%s\" busy, command dropped",
+		       cmd->name);
+		return -1;
+	}
+	tc_cmd_job_t *j = &ring->job[ring->posted++ % TC_CMD_RING_JOBS];
+	j->job.run = tc_cmd_job_run;
+	j->job.free = NULL;
+	j->cmd = cmd;
+	j->code = code;
+	j->len = len;
+	if (len)
+		memcpy(j->arg, buf, len);
+	j->arg[len] = 0;
+	int r = tc_work_post(&ring->lane, &j->job, tc_cmd_seq);
+	if (r > 0) {
+		tc_cmd_posted = true;
+		r = 0;
+	}
+	return r;
+}
+
+/**
+ *  Call a command with its arguments, posting it if it is a device one.
+ *
+ *  \param cmd  Command to call.
+ *  \param buf  Buffer with the arguments.
+ *  \param len  Length of the arguments.
  *  \retval 0 on success of normal command.
  *  \retval 1 on exit command.
  *  \retval -1 on error in command.
  */
-static int tc_cmd_exit_exec(tc_cmd_t *cmd, const char *buf, uint32_t len)
+static int tc_cmd_call(tc_cmd_t *cmd, const char *buf, uint32_t len)
+{
+	int code = -1;
+	if (cmd->parse) {
+		code = cmd->parse(cmd, buf, len);
+		if (code < 0)
+			return -1;
+	}
+	if (cmd->ring)
+		return tc_cmd_post(cmd, code, buf, len);
+	if (!cmd->parse)
+		return cmd->exec(cmd, buf, len);
+	return cmd->run(cmd, code);
+}
+
+
+/* --- Native command list ----------------------------------------------- */
+
+/**
+ *  Parse the exit command.
+ *
+ *  \param cmd   Pointer to the command to parse.
+ *  \param buf   Buffer with the arguments of the command.
+ *  \param len   Length of the arguments.
+ *  \retval 0 if there are no arguments.
+ *  \retval -1 on error in command.
+ */
+static int tc_cmd_exit_parse(tc_cmd_t *cmd, const char *buf, uint32_t len)
 {
-	return len ? -1 : 1;
+	return len ? -1 : 0;
+}
+
+/**
+ *  Run the exit command.
+ *
+ *  \param cmd   Pointer to the command to run.
+ *  \param code  Code returned by the parser.
+ *  \retval 1 on exit command.
+ */
+static int tc_cmd_exit_run(tc_cmd_t *cmd, int code)
+{
+	return 1;
 }
 
 /** Exit command object */
 static tc_cmd_t tc_cmd_exit = {
 	.name = "exit",
-	.exec = tc_cmd_exit_exec
+	.parse = tc_cmd_exit_parse,
+	.run = tc_cmd_exit_run
 };
 
 /**
@@ -466,64 +1532,83 @@ static int tc_cmd_osd_exec(tc_cmd_t *cmd, const char *buf, uint32_t len)
 	return -1;
 }
 
+/** Lane of the OSD */
+static tc_cmd_ring_t tc_cmd_osd_ring;
+
 /** OSD command object */
 static tc_cmd_t tc_cmd_osd = {
 	.name = "osd",
-	.exec = tc_cmd_osd_exec
+	.exec = tc_cmd_osd_exec,
+	.ring = &tc_cmd_osd_ring
 };
 #endif /* ENABLE_OSD */
 
 #ifdef ENABLE_CEC
+/* Codes of the CEC commands */
+#define TC_CMD_CEC_POWERON_ALL (0)
+#define TC_CMD_CEC_STANDBY_ALL (1)
+#define TC_CMD_CEC_SETACTIVE   (2)
+#define TC_CMD_CEC_VOLUMEUP    (3)
+#define TC_CMD_CEC_VOLUMEDOWN  (4)
+#define TC_CMD_CEC_MUTE        (5)
+
+/** Words of the CEC commands */
+static constexpr tc_vocab_word_t tc_cmd_cec_words[] = {
+	TC_VOCAB_WORD("poweron all", TC_CMD_CEC_POWERON_ALL),
+	TC_VOCAB_WORD("standby all", TC_CMD_CEC_STANDBY_ALL),
+	TC_VOCAB_WORD("setactive",   TC_CMD_CEC_SETACTIVE),
+	TC_VOCAB_WORD("volumeup",    TC_CMD_CEC_VOLUMEUP),
+	TC_VOCAB_WORD("volumedown",  TC_CMD_CEC_VOLUMEDOWN),
+	TC_VOCAB_WORD("mute",        TC_CMD_CEC_MUTE)
+};
+
+/** Vocabulary of the CEC commands */
+static constexpr auto tc_cmd_cec_vocab = tc_vocab_build(tc_cmd_cec_words);
+static_assert(tc_cmd_cec_vocab.seed, "No perfect hash for CEC");
+
 /**
- *  Execute a CEC command.
+ *  Parse a CEC command.
  *
- *  \param cmd   Pointer to the command to execute
- *  \param buf   Buffer with the name of the command to execute
- *  \param len   Length of the command to execute.
+ *  \param cmd   Pointer to the command to parse.
+ *  \param buf   Buffer with the arguments of the command.
+ *  \param len   Length of the arguments.
+ *  \return The TC_CMD_CEC_* code or -1 on error in command.
+ */
+static int tc_cmd_cec_parse(tc_cmd_t *cmd, const char *buf, uint32_t len)
+{
+	return tc_vocab_find(&tc_cmd_cec_vocab, buf, len);
+}
+
+/**
+ *  Run a CEC command.
+ *
+ *  \param cmd   Pointer to the command to run.
+ *  \param code  TC_CMD_CEC_* code returned by the parser.
  *  \retval 0 on success of normal command.
- *  \retval 1 on exit command.
  *  \retval -1 on error in command.
  */
-static int tc_cmd_cec_exec(tc_cmd_t *cmd, const char *buf, uint32_t len)
+static int tc_cmd_cec_run(tc_cmd_t *cmd, int code)
 {
-	/* poweron ... */
-	if (tc_cmd_starts(&buf, &len, "poweron")) {
-		/* poweron all */
-		if (tc_cmd_is(buf, len, "all")) {
-			tc_cec_poweron_all();
-			return 0;
-		}
-	/* standby ... */
-	} else if (tc_cmd_starts(&buf, &len, "standby")) {
-		/* poweroff all */
-		if (tc_cmd_is(buf, len, "all")) {
-			tc_cec_standby_all();
-			return 0;
-		}
-	/* setactive */
-	} else if (tc_cmd_is(buf, len, "setactive")) {
-		tc_cec_setactive();
-		return 0;
-	/* volumeup */
-	} else if (tc_cmd_is(buf, len, "volumeup")) {
-		tc_cec_volumeup();
-		return 0;
-	/* volumedown */
-	} else if (tc_cmd_is(buf, len, "volumedown")) {
-		tc_cec_volumedown();
-		return 0;
-	/* mute */
-	} else if (tc_cmd_is(buf, len, "mute")) {
-		tc_cec_mute();
-		return 0;
+	switch (code) {
+	case TC_CMD_CEC_POWERON_ALL: tc_cec_poweron_all(); return 0;
+	case TC_CMD_CEC_STANDBY_ALL: tc_cec_standby_all(); return 0;
+	case TC_CMD_CEC_SETACTIVE:   tc_cec_setactive();   return 0;
+	case TC_CMD_CEC_VOLUMEUP:    tc_cec_volumeup();    return 0;
+	case TC_CMD_CEC_VOLUMEDOWN:  tc_cec_volumedown();  return 0;
+	case TC_CMD_CEC_MUTE:        tc_cec_mute();        return 0;
 	}
 	return -1;
 }
 
+/** Lane of the CEC adapter */
+static tc_cmd_ring_t tc_cmd_cec_ring;
+
 /** CEC command object */
 static tc_cmd_t tc_cmd_cec = {
 	.name = "cec",
-	.exec = tc_cmd_cec_exec
+	.parse = tc_cmd_cec_parse,
+	.run = tc_cmd_cec_run,
+	.ring = &tc_cmd_cec_ring
 };
 #endif /* ENABLE_CEC */
 
@@ -531,73 +1616,47 @@ static tc_cmd_t tc_cmd_cec = {
 typedef struct tc_cmd_pioneer_t {
 	tc_cmd_t cmd;
 	tc_pioneer_t pioneer;
+	tc_cmd_ring_t ring;
 } tc_cmd_pioneer_t;
 
+/** Words of the pioneer commands */
+static constexpr tc_vocab_word_t tc_cmd_pioneer_words[] = {
+#define TC_CMD_PIONEER_WORD(_id, _words, _tx) \
+	TC_VOCAB_WORD(_words, TC_PIONEER_CMD_##_id),
+	TC_PIONEER_CMDS(TC_CMD_PIONEER_WORD)
+#undef TC_CMD_PIONEER_WORD
+};
+
+/** Vocabulary of the pioneer commands */
+static constexpr auto tc_cmd_pioneer_vocab =
+	tc_vocab_build(tc_cmd_pioneer_words);
+static_assert(tc_cmd_pioneer_vocab.seed, "No perfect hash for pioneer");
+
 /**
- *  Execute a pioneer command.
+ *  Parse a pioneer command.
  *
- *  \param cmd   Pointer to the command to execute
- *  \param buf   Buffer with the name of the command to execute
- *  \param len   Length of the command to execute.
+ *  \param cmd   Pointer to the command to parse.
+ *  \param buf   Buffer with the arguments of the command.
+ *  \param len   Length of the arguments.
+ *  \return The TC_PIONEER_CMD_* code or -1 on error in command.
+ */
+static int tc_cmd_pioneer_parse(tc_cmd_t *cmd, const char *buf, uint32_t len)
+{
+	return tc_vocab_find(&tc_cmd_pioneer_vocab, buf, len);
+}
+
+/**
+ *  Run a pioneer command.
+ *
+ *  \param cmd   Pointer to the command to run.
+ *  \param code  TC_PIONEER_CMD_* code returned by the parser.
  *  \retval 0 on success of normal command.
- *  \retval 1 on exit command.
  *  \retval -1 on error in command.
  */
-static int tc_cmd_pioneer_exec(tc_cmd_t *cmd, const char *buf, uint32_t len)
+static int tc_cmd_pioneer_run(tc_cmd_t *cmd, int code)
 {
 	tc_cmd_pioneer_t *p = tc_containerof(cmd, tc_cmd_pioneer_t, cmd);
-	uint8_t c = TC_PIONEER_CMD_NONE;
-	if (tc_cmd_is(buf, len, "poweron"))
-		c = TC_PIONEER_CMD_POWERON;
-	else if (tc_cmd_is(buf, len, "standby"))
-		c = TC_PIONEER_CMD_STANDBY;
-	else if (tc_cmd_is(buf, len, "volumeup"))
-		c = TC_PIONEER_CMD_VOLUMEUP;
-	else if (tc_cmd_is(buf, len, "volumedown"))
-		c = TC_PIONEER_CMD_VOLUMEDOWN;
-	else if (tc_cmd_is(buf, len, "muteon"))
-		c = TC_PIONEER_CMD_MUTEON;
-	else if (tc_cmd_is(buf, len, "muteoff"))
-		c = TC_PIONEER_CMD_MUTEOFF;
-	else if (tc_cmd_is(buf, len, "mute"))
-		c = TC_PIONEER_CMD_MUTE;
-	else if (tc_cmd_starts(&buf, &len, "mcacc")) {
-		if (tc_cmd_is(buf, len, "1"))
-			c = TC_PIONEER_CMD_MCACC1;
-		else if (tc_cmd_is(buf, len, "2"))
-			c = TC_PIONEER_CMD_MCACC2;
-		else if (tc_cmd_is(buf, len, "3"))
-			c = TC_PIONEER_CMD_MCACC3;
-		else if (tc_cmd_is(buf, len, "4"))
-			c = TC_PIONEER_CMD_MCACC4;
-		else if (tc_cmd_is(buf, len, "5"))
-			c = TC_PIONEER_CMD_MCACC5;
-		else if (tc_cmd_is(buf, len, "6"))
-			c = TC_PIONEER_CMD_MCACC6;
-	} else if (tc_cmd_starts(&buf, &len, "listenmode")) {
-		if (tc_cmd_is(buf, len, "stereo"))
-			c = TC_PIONEER_CMD_LISTENMODE_STEREO;
-		else if (tc_cmd_is(buf, len, "extstereo"))
-			c = TC_PIONEER_CMD_LISTENMODE_EXTSTEREO;
-		else if (tc_cmd_is(buf, len, "direct"))
-			c = TC_PIONEER_CMD_LISTENMODE_DIRECT;
-		else if (tc_cmd_is(buf, len, "alc"))
-			c = TC_PIONEER_CMD_LISTENMODE_ALC;
-		else if (tc_cmd_is(buf, len, "expanded"))
-			c = TC_PIONEER_CMD_LISTENMODE_EXPANDED;
-	} else if (tc_cmd_starts(&buf, &len, "input")) {
-		if (tc_cmd_is(buf, len, "tuner"))
-			c = TC_PIONEER_CMD_INPUT_TUNER;
-		else if (tc_cmd_is(buf, len, "dvd"))
-			c = TC_PIONEER_CMD_INPUT_DVD;
-		else if (tc_cmd_is(buf, len, "tv"))
-			c = TC_PIONEER_CMD_INPUT_TV;
-		else if (tc_cmd_is(buf, len, "sat"))
-			c = TC_PIONEER_CMD_INPUT_SAT;
-	}
-	if (c == TC_PIONEER_CMD_NONE)
-		return -1;
-	return tc_pioneer_send(&p->pioneer, c);
+	return tc_pioneer_send(&p->pioneer, code);
 }
 
 /**
@@ -613,6 +1672,19 @@ static void tc_cmd_pioneer_free(tc_cmd_t *cmd)
 	free(p);
 }
 
+/**
+ *  Check if a pioneer object is connected to a host.
+ *
+ *  \param cmd  Command of the pioneer object.
+ *  \param arg  Name of the host.
+ *  \return true if it is connected to the host.
+ */
+static bool tc_cmd_pioneer_same(tc_cmd_t *cmd, void *arg)
+{
+	tc_cmd_pioneer_t *p = tc_containerof(cmd, tc_cmd_pioneer_t, cmd);
+	return !strcmp(p->pioneer.host, (const char *)arg);
+}
+
 /**
  *  Function to initialize a new pioneer object.
  * 
@@ -627,182 +1699,911 @@ static int tc_cmd_pioneer_init(const char *buf, uint32_t len)
 	tc_cmd_wordrm(&buf, &len);
 	if (wl < 1 || len < 1)
 		return -1;
+	if (tc_cmd_dryrun)
+		return 0;
+	/* Keep the connected object if the host is the same on reload */
+	const char *host = tc_arena_strndup(&tc_cmd_scratch, buf, len);
+	tc_cmd_t *prev = tc_cmd_graph_take(tc_cmd_pioneer_free, name, wl,
+	                                   tc_cmd_pioneer_same, (void *)host);
+	if (prev) {
+		tc_log(TC_LOG_INFO, "Keeping pioneer \"%s\" connected to \"%s\"",
+		       prev->name, host);
+		tc_cmd_add(prev);
+		return 0;
+	}
 	/* Create the new objecct */
 	tc_cmd_pioneer_t *p = (tc_cmd_pioneer_t *)malloc(sizeof(tc_cmd_pioneer_t));
-	memset(p, 0, sizeof(p));
+	memset(p, 0, sizeof(tc_cmd_pioneer_t));
 	if (tc_pioneer_init(&p->pioneer, buf, len, name, wl)) {
 		free(p);
 		return -1;
 	}
 	p->cmd.name = strndup(name, wl);
-	p->cmd.exec = tc_cmd_pioneer_exec;
+	p->cmd.parse = tc_cmd_pioneer_parse;
+	p->cmd.run = tc_cmd_pioneer_run;
 	p->cmd.free = tc_cmd_pioneer_free;
+	p->cmd.ring = &p->ring;
 	tc_cmd_add(&p->cmd);
 	return 0;
 }
 
+/** Code of the mouse move command */
+#define TC_CMD_MOUSE_MOVE (0)
+
 /**
- *  Execute a Mouse command.
+ *  Parse a Mouse command.
  *
- *  \param cmd   Pointer to the command to execute
- *  \param buf   Buffer with the name of the command to execute
- *  \param len   Length of the command to execute.
+ *  \param cmd   Pointer to the command to parse.
+ *  \param buf   Buffer with the arguments of the command.
+ *  \param len   Length of the arguments.
+ *  \return The TC_CMD_MOUSE_* code or -1 on error in command.
+ */
+static int tc_cmd_mouse_parse(tc_cmd_t *cmd, const char *buf, uint32_t len)
+{
+	/* move ... */
+	if (tc_cmd_starts(&buf, &len, "move"))
+		return TC_CMD_MOUSE_MOVE;
+	return -1;
+}
+
+/**
+ *  Run a Mouse command.
+ *
+ *  \param cmd   Pointer to the command to run.
+ *  \param code  TC_CMD_MOUSE_* code returned by the parser.
  *  \retval 0 on success of normal command.
- *  \retval 1 on exit command.
  *  \retval -1 on error in command.
  */
-static int tc_cmd_mouse_exec(tc_cmd_t *cmd, const char *buf, uint32_t len)
+static int tc_cmd_mouse_run(tc_cmd_t *cmd, int code)
 {
-	/* svg ... */
-	if (tc_cmd_starts(&buf, &len, "move")) {
-		tc_mouse_move();
-		return 0;
-	}
-	return -1;
+	if (code != TC_CMD_MOUSE_MOVE)
+		return -1;
+	tc_mouse_move();
+	return 0;
 }
 
-/** OSD command object */
+/** Lane of the mouse */
+static tc_cmd_ring_t tc_cmd_mouse_ring;
+
+/** Mouse command object */
 static tc_cmd_t tc_cmd_mouse = {
 	.name = "mouse",
-	.exec = tc_cmd_mouse_exec
+	.parse = tc_cmd_mouse_parse,
+	.run = tc_cmd_mouse_run,
+	.ring = &tc_cmd_mouse_ring
 };
 
 
 /* --- Scripting commands ------------------------------------------------- */
 
+/** Maximum depth of nested scripts */
+#define TC_CMD_SCRIPT_DEPTH 16
+
+/**
+ *  Variable slot of a subcommand, replaced when it is executed.
+ */
+typedef struct tc_cmd_script_var_t {
+	uint16_t offset;         /**< Offset of the '$' in the subcommand */
+	uint16_t len;            /**< Length of the name, 0 for "$$"      */
+	tc_cmd_env_handle_t env; /**< Handle of the variable              */
+} tc_cmd_script_var_t;
+
+/** Kinds of subcommands of a script */
+#define TC_CMD_SCRIPT_OP_CMD      (0) /**< Command to execute             */
+#define TC_CMD_SCRIPT_OP_PARALLEL (1) /**< Start of a parallel block      */
+#define TC_CMD_SCRIPT_OP_JOIN     (2) /**< End of a parallel block        */
+
 /**
- *  Entry for the scripting of the command.
+ *  Compiled subcommand of a script.
  */
-typedef struct tc_cmd_script_entry_t {
-	const char *cmd;
-	tc_cmd_script_entry_t *next;
-} tc_cmd_script_entry_t;
+typedef struct tc_cmd_script_op_t {
+	const char *text;  /**< Text of the subcommand (zero terminated)  */
+	uint32_t len;      /**< Length of the text                        */
+	uint8_t kind;      /**< TC_CMD_SCRIPT_OP_* kind of subcommand     */
+	bool valid;        /**< False if the text has syntax errors       */
+	bool mapped;       /**< The text is in the cache mapping          */
+	tc_cmd_t *cmd;     /**< Resolved command, NULL if not resolved    */
+	uint32_t gen;      /**< Index generation of the resolution        */
+	const char *arg;   /**< Arguments for the resolved command        */
+	uint32_t arglen;   /**< Length of the arguments                   */
+	int code;          /**< Code parsed for the command or -1         */
+	uint32_t var;      /**< First variable slot of the subcommand     */
+	uint32_t nvars;    /**< Number of variable slots                  */
+} tc_cmd_script_op_t;
 
 /**
  *  Scripting command obect.
  */
 typedef struct tc_cmd_script_t {
 	tc_cmd_t cmd;
-	tc_cmd_script_entry_t *entry;
+	tc_cmd_script_op_t *op;   /**< Compiled subcommands          */
+	uint32_t nops;            /**< Number of subcommands         */
+	uint32_t aops;            /**< Allocated subcommands         */
+	tc_cmd_script_var_t *var; /**< Variable slots of every op    */
+	uint32_t nvars;           /**< Number of variable slots      */
+	uint32_t avars;           /**< Allocated variable slots      */
+	bool mapped;              /**< The name is in the cache
+	                               mapping of the graph          */
+	bool parallel;            /**< A parallel block is open while
+	                               compiling                     */
 } tc_cmd_script_t;
 
 /**
- *  Internal function to execute an scripting command.
+ *  Frame of the script interpreter.
+ */
+typedef struct tc_cmd_script_frame_t {
+	tc_cmd_script_t *script; /**< Script being executed     */
+	uint32_t pc;             /**< Next subcommand to execute */
+} tc_cmd_script_frame_t;
+
+static int tc_cmd_script_exec(tc_cmd_t *cmd, const char *buf, uint32_t len);
+
+/**
+ *  Resolve the command of a subcommand without variables.
  *
- *  \param cmd  Pointer to the command to execute.
- *  \param buf  Buffer with the command to execute.
- *  \param len  Length of the command to execute
- *  \retval 0 on success of normal command.
- *  \retval 1 on exit command.
- *  \retval -1 on error in command.
+ *  \param op  Subcommand to resolve.
  */
-static int tc_cmd_script_exec(tc_cmd_t *cmd, const char *buf, uint32_t len)
+static void tc_cmd_script_resolve(tc_cmd_script_op_t *op)
 {
-	tc_cmd_script_t *s = tc_containerof(cmd, tc_cmd_script_t, cmd);
-	tc_cmd_script_entry_t *e = s->entry;
-	while (e) {
-		tc_log(TC_LOG_INFO, "Subcommand \"%s\"", e->cmd);
-		int r = tc_cmd(e->cmd, strlen(e->cmd));
-		if (r) {
-			if (r < 0)
-				tc_log(TC_LOG_ERR, "Error in subcommand \"%s\"",
-				       e->cmd);
-			return r;
-		}
-		e = e->next;
-	}
-	return 0;
+	const char *arg = op->text;
+	uint32_t arglen = op->len;
+	op->cmd = tc_cmd_index_find(&arg, &arglen);
+	op->arg = arg;
+	op->arglen = arglen;
+	op->code = op->cmd ? tc_cmd_parse(op->cmd, arg, arglen) : -1;
+	op->gen = tc_cmd_index_gen;
 }
 
 /**
- *  Called to extend the given command.
+ *  Replace the variables of a subcommand.
  *
- *  \param cmd  Command to be extended.
- *  \param buf  Buffer with the data.
- *  \param len  Length of the data to extend.
- *  \retval 0 on success of normal command.
- *  \retval 1 on exit command.
- *  \retval -1 on error in command.
+ *  \param s     Script of the subcommand.
+ *  \param op    Subcommand to replace the variables of.
+ *  \param out   Output buffer or NULL to check the length.
+ *  \retval -1 on error (with a log entry when not writing).
+ *  \retval The length of the subcommand with the variables replaced.
  */
-static int tc_cmd_script_extend(tc_cmd_t *cmd, const char *buf, uint32_t len)
+static int32_t tc_cmd_script_subs_write(tc_cmd_script_t *s,
+                                        tc_cmd_script_op_t *op, char *out)
 {
-	tc_cmd_script_t *s = tc_containerof(cmd, tc_cmd_script_t, cmd);
-	tc_cmd_script_entry_t **e = &s->entry;
-	while (*e)
-		e = &(*e)->next;
-	tc_cmd_script_entry_t *ne;
-	ne = (tc_cmd_script_entry_t *)malloc(sizeof(tc_cmd_script_entry_t));
-	memset(ne, 0, sizeof(tc_cmd_script_entry_t));
-	ne->cmd = strndup(buf, len);
-	*e = ne;
-	return 0;
+	uint32_t l = 0;
+	uint32_t i = 0;
+	uint32_t v;
+	for (v = 0; v <= op->nvars; v++) {
+		tc_cmd_script_var_t *var = v < op->nvars ? &s->var[op->var + v] : NULL;
+		uint32_t end = var ? var->offset : op->len;
+		const char *value = "";
+		uint32_t next = end;
+		if (var && !var->len) {
+			value = "$";
+			next = end + 2;
+		} else if (var) {
+			value = tc_cmd_env_value(var->env);
+			if (!value) {
+				if (!out)
+					tc_log(TC_LOG_ERR, "Syntax error: Variable \"%s\" not found",
+					       tc_arena_strndup(&tc_cmd_scratch,
+					                        op->text + end + 1, var->len));
+				return -1;
+			}
+			next = end + 1 + var->len;
+		}
+		uint32_t vl = strlen(value);
+		if (out) {
+			memcpy(out + l, op->text + i, end - i);
+			memcpy(out + l + end - i, value, vl);
+		}
+		l += end - i + vl;
+		i = next;
+	}
+	return l;
 }
 
 /**
- *  Called to free the script command.
+ *  Replace the variables of a subcommand.
  *
- *  \param cmd  Command to be freed.
+ *  \param s     Script of the subcommand.
+ *  \param op    Subcommand to replace the variables of.
+ *  \param len   Output length of the line.
+ *  \return The zero terminated line allocated in the scratch arena,
+ *          or NULL on error (with a log entry).
  */
-static void tc_cmd_script_free(tc_cmd_t *cmd)
+static char *tc_cmd_script_subs(tc_cmd_script_t *s, tc_cmd_script_op_t *op,
+                                uint32_t *len)
 {
-	tc_cmd_script_t *s = tc_containerof(cmd, tc_cmd_script_t, cmd);
-	while (s->entry) {
-		tc_cmd_script_entry_t *e = s->entry;
-		s->entry = e->next;
-		free((void *)e->cmd);
-		free(e);
+	/* Both passes should see the same values */
+	uint32_t epoch = tc_cmd_env_read_begin();
+	int32_t l = tc_cmd_script_subs_write(s, op, NULL);
+	if (l < 0) {
+		tc_cmd_env_read_end(epoch);
+		return NULL;
 	}
-	free((void *)s->cmd.name);
-	free(s);
+	char *line = (char *)tc_arena_alloc(&tc_cmd_scratch, l + 1);
+	tc_cmd_script_subs_write(s, op, line);
+	tc_cmd_env_read_end(epoch);
+	line[l] = 0;
+	*len = l;
+	return line;
 }
 
 /**
- *  Initialize the script command.
+ *  Start a sequence for a script, taking the next one whose device
+ *  commands have finished, or a new one if every one is in use.
  *
- *  \param buf   Buffer to initialize it with.
- *  \param len   Length of the command to execute.
+ *  \return The sequence started.
  */
-static int tc_cmd_script_init(const char *buf, uint32_t len)
+static tc_work_seq_t *tc_cmd_seq_start(void)
 {
-	tc_cmd_script_t *cmd = (tc_cmd_script_t *)malloc(sizeof(tc_cmd_script_t));
-	memset(cmd, 0, sizeof(tc_cmd_script_t));
-	cmd->cmd.name = strndup(buf, len);
-	cmd->cmd.exec = &tc_cmd_script_exec;
-	cmd->cmd.extend = &tc_cmd_script_extend;
-	cmd->cmd.free = &tc_cmd_script_free;
-	tc_cmd_add(&cmd->cmd);
-	tc_cmd_extend = &cmd->cmd;
-	return 0;
+	uint32_t i;
+	for (i = 0; i < tc_cmd_seqs_count; i++) {
+		tc_work_seq_t *seq =
+			tc_cmd_seqs[tc_cmd_seqs_next++ % tc_cmd_seqs_count];
+		if (tc_work_seq_start(seq))
+			return seq;
+	}
+	tc_cmd_seqs = (tc_work_seq_t **)realloc(tc_cmd_seqs,
+		(tc_cmd_seqs_count + 1) * sizeof(tc_work_seq_t *));
+	tc_work_seq_t *seq = (tc_work_seq_t *)calloc(1, sizeof(tc_work_seq_t));
+	tc_cmd_seqs[tc_cmd_seqs_count++] = seq;
+	tc_work_seq_start(seq);
+	return seq;
 }
 
-
-/* --- Process execution commands ---------------------------------------- */
-
 /**
- *  Execute an process command
+ *  Interpret a script and every script called from it.
  *
- *  \param cmd  Pointer to the command to execute.
- *  \param buf  Buffer with the command to execute.
- *  \param len  Length of the command to execute
+ *  The device subcommands are posted to the lane of their device in the
+ *  sequence of the script, so each one waits for the ones before it. In
+ *  a parallel block, including the scripts called from it, they only
+ *  wait for the ones before the block. The rest of subcommands are
+ *  executed when found, and a device subcommand that fails skips the
+ *  device subcommands after it.
+ *
+ *  \param script  Script to execute.
  *  \retval 0 on success of normal command.
  *  \retval 1 on exit command.
  *  \retval -1 on error in command.
  */
-static int tc_cmd_exec_exec(tc_cmd_t *cmd, const char *buf, uint32_t len)
+static int tc_cmd_script_run(tc_cmd_script_t *script)
 {
-	/* exec <process> <arguments> */
-	char *command = (char *)malloc(len + 1);
-	memcpy(command, buf, len);
-	command[len] = 0;
+	tc_cmd_script_frame_t frame[TC_CMD_SCRIPT_DEPTH];
+	uint32_t depth = 0;
+	uint32_t mark = tc_arena_mark(&tc_cmd_scratch);
+	/* The scripts called through other commands use the same sequence */
+	tc_work_seq_t *caller = tc_cmd_seq;
+	if (!caller)
+		tc_cmd_seq = tc_cmd_seq_start();
+	uint32_t par_depth = 0;
+	int r = 0;
+	frame[depth].script = script;
+	frame[depth].pc = 0;
+	depth++;
+	while (depth) {
+		/* Get the next subcommand, joining the block open at the end */
+		tc_cmd_script_frame_t *f = &frame[depth - 1];
+		tc_cmd_script_t *s = f->script;
+		if (f->pc == s->nops) {
+			if (par_depth == depth) {
+				par_depth = 0;
+				tc_work_seq_parallel(tc_cmd_seq, false);
+			}
+			depth--;
+			continue;
+		}
+		tc_cmd_script_op_t *op = &s->op[f->pc++];
+		tc_log(TC_LOG_INFO, "Subcommand \"%s\"", op->text);
+		tc_arena_rewind(&tc_cmd_scratch, mark);
+
+		/* Open and join the parallel blocks, nested ones are merged */
+		if (op->valid && op->kind == TC_CMD_SCRIPT_OP_PARALLEL) {
+			if (!par_depth && !tc_work_seq_parallel(tc_cmd_seq, true))
+				par_depth = depth;
+			continue;
+		} else if (op->valid && op->kind == TC_CMD_SCRIPT_OP_JOIN) {
+			if (par_depth != depth)
+				continue;
+			par_depth = 0;
+			tc_work_seq_parallel(tc_cmd_seq, false);
+			continue;
+		}
+
+		/* Resolve the command */
+		tc_cmd_t *cmd = NULL;
+		const char *arg = NULL;
+		uint32_t arglen = 0;
+		int code = -1;
+		if (!op->valid) {
+			tc_log(TC_LOG_ERR, "Syntax error in subcommand \"%s\"", op->text);
+			r = -1;
+		} else if (op->nvars) {
+			char *line = tc_cmd_script_subs(s, op, &arglen);
+			if (!line)
+				r = -1;
+			else if (!arglen || line[0] == '#')
+				continue;
+			else {
+				arg = line;
+				cmd = tc_cmd_index_find(&arg, &arglen);
+				if (!cmd)
+					tc_log(TC_LOG_ERR, "Unknown command \"%s\"", line);
+				else
+					code = tc_cmd_parse(cmd, arg, arglen);
+			}
+		} else {
+			if (!op->cmd || op->gen != tc_cmd_index_gen)
+				tc_cmd_script_resolve(op);
+			cmd = op->cmd;
+			arg = op->arg;
+			arglen = op->arglen;
+			code = op->code;
+			if (!cmd)
+				tc_log(TC_LOG_ERR, "Unknown command \"%s\"", op->text);
+		}
+
+		/* Execute it, entering the scripts without recursion */
+		if (r || !cmd)
+			r = -1;
+		else if (cmd->exec == tc_cmd_script_exec) {
+			if (depth == TC_CMD_SCRIPT_DEPTH) {
+				tc_log(TC_LOG_ERR, "Too many nested scripts");
+				r = -1;
+			} else {
+				frame[depth].script = tc_containerof(cmd, tc_cmd_script_t, cmd);
+				frame[depth].pc = 0;
+				depth++;
+				continue;
+			}
+		} else if (cmd->ring)
+			r = cmd->parse && code < 0 ? -1 :
+			    tc_cmd_post(cmd, code, arg, arglen);
+		else if (cmd->parse)
+			r = code < 0 ? -1 : cmd->run(cmd, code);
+		else
+			r = cmd->exec(cmd, arg, arglen);
+		if (r) {
+			if (r < 0)
+				tc_log(TC_LOG_ERR, "Error in subcommand \"%s\"",
+				       op->text);
+			break;
+		}
+	}
+	if (par_depth)
+		tc_work_seq_parallel(tc_cmd_seq, false);
+	if (!caller) {
+		tc_work_seq_put(tc_cmd_seq);
+		tc_cmd_seq = NULL;
+	}
+	return r;
+}
+
+/**
+ *  Internal function to execute an scripting command.
+ *
+ *  \param cmd  Pointer to the command to execute.
+ *  \param buf  Buffer with the command to execute.
+ *  \param len  Length of the command to execute
+ *  \retval 0 on success of normal command.
+ *  \retval 1 on exit command.
+ *  \retval -1 on error in command.
+ */
+static int tc_cmd_script_exec(tc_cmd_t *cmd, const char *buf, uint32_t len)
+{
+	return tc_cmd_script_run(tc_containerof(cmd, tc_cmd_script_t, cmd));
+}
+
+/**
+ *  Called to extend the given command, compiling the new subcommand.
+ *
+ *  \param cmd  Command to be extended.
+ *  \param buf  Buffer with the data.
+ *  \param len  Length of the data to extend.
+ *  \retval 0 on success of normal command.
+ *  \retval 1 on exit command.
+ *  \retval -1 on error in command.
+ */
+static int tc_cmd_script_extend(tc_cmd_t *cmd, const char *buf, uint32_t len)
+{
+	tc_cmd_script_t *s = tc_containerof(cmd, tc_cmd_script_t, cmd);
+
+	/* Comments and empty lines are never executed */
+	if (!len || buf[0] == '#')
+		return 0;
+
+	/* Parallel blocks cannot be nested in the same script */
+	uint8_t kind = TC_CMD_SCRIPT_OP_CMD;
+	bool valid = len < TC_CMD_LINE_MAX;
+	if (tc_cmd_is(buf, len, "parallel")) {
+		kind = TC_CMD_SCRIPT_OP_PARALLEL;
+		valid = !s->parallel;
+		s->parallel = true;
+	} else if (tc_cmd_is(buf, len, "join")) {
+		kind = TC_CMD_SCRIPT_OP_JOIN;
+		valid = s->parallel;
+		s->parallel = false;
+	}
+
+	/* Find the variable slots to be replaced on execution */
+	uint32_t first = s->nvars;
+	uint32_t i;
+	for (i = 0; kind == TC_CMD_SCRIPT_OP_CMD && valid && i < len; i++) {
+		if (buf[i] != '$')
+			continue;
+		uint32_t endi = i + 1;
+		if (endi < len && buf[endi] == '$')
+			endi++;
+		else
+			while (endi < len && tc_cmd_env_ischar(buf[endi]))
+				endi++;
+		if (endi == i + 1) {
+			valid = false;
+			break;
+		}
+		if (s->nvars == s->avars) {
+			s->avars = s->avars ? s->avars << 1 : 4;
+			s->var = (tc_cmd_script_var_t *)
+				realloc(s->var, s->avars * sizeof(tc_cmd_script_var_t));
+		}
+		tc_cmd_script_var_t *v = &s->var[s->nvars++];
+		v->offset = i;
+		v->len = buf[i + 1] == '$' ? 0 : endi - i - 1;
+		v->env = v->len ? tc_cmd_env_intern(buf + i + 1, v->len) :
+		                  TC_CMD_ENV_INVALID;
+		i = endi - 1;
+	}
+	if (!valid)
+		s->nvars = first;
+
+	/* Add the compiled subcommand */
+	if (s->nops == s->aops) {
+		s->aops = s->aops ? s->aops << 1 : 4;
+		s->op = (tc_cmd_script_op_t *)
+			realloc(s->op, s->aops * sizeof(tc_cmd_script_op_t));
+	}
+	tc_cmd_script_op_t *op = &s->op[s->nops++];
+	memset(op, 0, sizeof(tc_cmd_script_op_t));
+	op->mapped = tc_cmd_mapped;
+	op->text = tc_cmd_mapped ? buf : strndup(buf, len);
+	op->len = len;
+	op->kind = kind;
+	op->valid = valid;
+	op->code = -1;
+	op->var = first;
+	op->nvars = s->nvars - first;
+	if (kind == TC_CMD_SCRIPT_OP_CMD && valid && !op->nvars)
+		tc_cmd_script_resolve(op);
+	return 0;
+}
+
+/**
+ *  Called to free the script command.
+ *
+ *  \param cmd  Command to be freed.
+ */
+static void tc_cmd_script_free(tc_cmd_t *cmd)
+{
+	tc_cmd_script_t *s = tc_containerof(cmd, tc_cmd_script_t, cmd);
+	uint32_t i;
+	for (i = 0; i < s->nops; i++)
+		if (!s->op[i].mapped)
+			free((void *)s->op[i].text);
+	if (!s->mapped)
+		free((void *)s->cmd.name);
+	free(s->op);
+	free(s->var);
+	free(s);
+}
+
+/**
+ *  Initialize the script command.
+ *
+ *  When the line comes from the configuration cache the name and the
+ *  subcommands without variables are used from the mapping, that ends
+ *  with the line.
+ *
+ *  \param buf   Buffer to initialize it with.
+ *  \param len   Length of the command to execute.
+ */
+static int tc_cmd_script_init(const char *buf, uint32_t len)
+{
+	tc_cmd_script_t *cmd = (tc_cmd_script_t *)malloc(sizeof(tc_cmd_script_t));
+	memset(cmd, 0, sizeof(tc_cmd_script_t));
+	cmd->mapped = tc_cmd_mapped;
+	cmd->cmd.name = tc_cmd_mapped ? buf : strndup(buf, len);
+	cmd->cmd.exec = &tc_cmd_script_exec;
+	cmd->cmd.extend = &tc_cmd_script_extend;
+	cmd->cmd.free = &tc_cmd_script_free;
+	tc_cmd_add(&cmd->cmd);
+	tc_cmd_extend = &cmd->cmd;
+	return 0;
+}
+
+
+/* --- Process execution commands ---------------------------------------- */
+
+/** Maximum number of arguments of a process executed without shell */
+#define TC_CMD_EXEC_ARGS 32
+
+/**
+ *  Execute an process command, without waiting for it to finish.
+ *
+ *  \param cmd  Pointer to the command to execute.
+ *  \param buf  Buffer with the command to execute.
+ *  \param len  Length of the command to execute
+ *  \retval 0 on success of normal command.
+ *  \retval 1 on exit command.
+ *  \retval -1 on error in command.
+ */
+static int tc_cmd_exec_exec(tc_cmd_t *cmd, const char *buf, uint32_t len)
+{
+	/* exec [-a] [-n <name>] <process> <arguments> */
+	bool shell = true;
+	const char *name = NULL;
+	uint32_t namelen = 0;
+	while (len && buf[0] == '-') {
+		if (tc_cmd_starts(&buf, &len, "-a"))
+			shell = false;
+		else if (tc_cmd_starts(&buf, &len, "-n")) {
+			name = buf;
+			namelen = tc_cmd_wordlen(buf, len);
+			tc_cmd_wordrm(&buf, &len);
+		} else
+			break;
+	}
+	if (!len || (name && !namelen))
+		return -1;
+
+	/* By default the name is the one of the program */
+	if (!name) {
+		namelen = tc_cmd_wordlen(buf, len);
+		name = buf;
+		uint32_t i;
+		for (i = 0; i + 1 < namelen; i++)
+			if (buf[i] == '/')
+				name = buf + i + 1;
+		namelen -= name - buf;
+	}
+
+	/* Split the arguments only if there is no shell, in a copy out of the
+	   scratch arena as it is run in the lane of the command */
+	if (len >= TC_CMD_LINE_MAX)
+		return -1;
+	char command[TC_CMD_LINE_MAX];
+	memcpy(command, buf, len);
+	command[len] = 0;
 	tc_log(TC_LOG_INFO, "Executing command: \"%s\"", command);
-	int r = system(command);
-	return r ? -1 : 0;
+	char *argv[TC_CMD_EXEC_ARGS + 1];
+	uint32_t argc = 0;
+	if (shell) {
+		argv[argc++] = (char *)"/bin/sh";
+		argv[argc++] = (char *)"-c";
+		argv[argc++] = command;
+	} else {
+		char *c = command;
+		while (*c) {
+			if (argc == TC_CMD_EXEC_ARGS)
+				return -1;
+			argv[argc++] = c;
+			while (*c && *c != ' ')
+				c++;
+			while (*c == ' ')
+				*c++ = 0;
+		}
+	}
+	argv[argc] = NULL;
+	char n[TC_CMD_LINE_MAX];
+	memcpy(n, name, namelen);
+	n[namelen] = 0;
+	return tc_exec_spawn(n, argv);
 }
 
+/** Lane of the processes */
+static tc_cmd_ring_t tc_cmd_exec_ring;
+
 /** Init command object */
 static tc_cmd_t tc_cmd_exec_cmd = {
 	.name = "exec",
-	.exec = tc_cmd_exec_exec
+	.exec = tc_cmd_exec_exec,
+	.ring = &tc_cmd_exec_ring
+};
+
+
+/* --- Timer commands ---------------------------------------------------- */
+
+/**
+ *  Parse a delay in milliseconds and remove it from the buffer.
+ *
+ *  \param buf  Input and output parameter with the buffer.
+ *  \param len  Input and output parameter with the buffer length.
+ *  \param ms   Delay to fill.
+ *  \retval -1 on error.
+ *  \retval 0 on success.
+ */
+static int tc_cmd_timer_ms(const char **buf, uint32_t *len, uint32_t *ms)
+{
+	uint32_t wl = tc_cmd_wordlen(*buf, *len);
+	if (!wl || wl > 10)
+		return -1;
+	uint64_t v = 0;
+	uint32_t i;
+	for (i = 0; i < wl; i++) {
+		if (!isdigit((*buf)[i]))
+			return -1;
+		v = v * 10 + (*buf)[i] - '0';
+	}
+	if (v > UINT32_MAX)
+		return -1;
+	*ms = v;
+	tc_cmd_wordrm(buf, len);
+	return 0;
+}
+
+/**
+ *  Execute the after command.
+ *
+ *  \param cmd  Pointer to the command to execute.
+ *  \param buf  Buffer with the command to execute.
+ *  \param len  Length of the command to execute
+ *  \retval 0 on success of normal command.
+ *  \retval -1 on error in command.
+ */
+static int tc_cmd_after_exec(tc_cmd_t *cmd, const char *buf, uint32_t len)
+{
+	/* after <ms> <command> */
+	uint32_t ms;
+	if (tc_cmd_timer_ms(&buf, &len, &ms) || !len)
+		return -1;
+	return tc_timer_add(NULL, 0, ms, false, buf, len);
+}
+
+/** After command object */
+static tc_cmd_t tc_cmd_after = {
+	.name = "after",
+	.exec = tc_cmd_after_exec
+};
+
+/**
+ *  Execute the every command.
+ *
+ *  \param cmd  Pointer to the command to execute.
+ *  \param buf  Buffer with the command to execute.
+ *  \param len  Length of the command to execute
+ *  \retval 0 on success of normal command.
+ *  \retval -1 on error in command.
+ */
+static int tc_cmd_every_exec(tc_cmd_t *cmd, const char *buf, uint32_t len)
+{
+	/* every <ms> <name> <command> */
+	uint32_t ms;
+	if (tc_cmd_timer_ms(&buf, &len, &ms) || !len)
+		return -1;
+	const char *name = buf;
+	uint32_t namelen = tc_cmd_wordlen(buf, len);
+	tc_cmd_wordrm(&buf, &len);
+	if (!namelen || !len)
+		return -1;
+	return tc_timer_add(name, namelen, ms, true, buf, len);
+}
+
+/** Every command object */
+static tc_cmd_t tc_cmd_every = {
+	.name = "every",
+	.exec = tc_cmd_every_exec
+};
+
+/**
+ *  Execute the cancel command.
+ *
+ *  \param cmd  Pointer to the command to execute.
+ *  \param buf  Buffer with the command to execute.
+ *  \param len  Length of the command to execute
+ *  \retval 0 on success of normal command.
+ *  \retval -1 on error in command.
+ */
+static int tc_cmd_cancel_exec(tc_cmd_t *cmd, const char *buf, uint32_t len)
+{
+	/* cancel <name> */
+	if (!len || tc_cmd_wordlen(buf, len) != len)
+		return -1;
+	return tc_timer_cancel(buf, len);
+}
+
+/** Cancel command object */
+static tc_cmd_t tc_cmd_cancel = {
+	.name = "cancel",
+	.exec = tc_cmd_cancel_exec
+};
+
+
+/* --- Variable change subscriptions ------------------------------------- */
+
+/**
+ *  Execute the subscription of a variable notified again, after a delay.
+ *
+ *  \param arg  Handle of the variable.
+ *  \retval 0 on success.
+ *  \retval 1 on exit command.
+ *  \retval -1 on error in command.
+ */
+static int tc_cmd_env_notified_call(void *arg)
+{
+	return tc_cmd_env_notified((tc_cmd_env_handle_t)(uintptr_t)arg);
+}
+
+int tc_cmd_env_notified(tc_cmd_env_handle_t handle)
+{
+	uint32_t epoch = tc_cmd_env_read_begin();
+	tc_cmd_env_t *e = tc_cmd_env_entry(handle);
+	tc_cmd_env_read_end(epoch);
+	if (!e) {
+		tc_log(TC_LOG_ERR, "Invalid variable handle %u", (unsigned)handle);
+		return -1;
+	}
+	if (!e->change) {
+		__atomic_store_n(&e->pending, false, __ATOMIC_RELEASE);
+		return 0;
+	}
+
+	/* Delay it if executed recently, coalescing until then */
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	uint64_t now = ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+	if (e->changed && now - e->changed < TC_CMD_ENV_CHANGE_MS) {
+		if (!tc_timer_call(e->changed + TC_CMD_ENV_CHANGE_MS - now,
+		                   tc_cmd_env_notified_call, (void *)(uintptr_t)handle))
+			return 0;
+		__atomic_store_n(&e->pending, false, __ATOMIC_RELEASE);
+		return -1;
+	}
+
+	/* The changes from now on are notified again */
+	e->changed = now;
+	__atomic_store_n(&e->pending, false, __ATOMIC_RELEASE);
+
+	/* The script can change the subscription, it runs from a copy */
+	char script[TC_CMD_LINE_MAX];
+	uint32_t len = strlen(e->change);
+	if (len >= sizeof(script)) {
+		tc_log(TC_LOG_ERR, "Script of %s too long", e->name);
+		return -1;
+	}
+	memcpy(script, e->change, len + 1);
+
+	/* Only scripts are executed, the configuration may define them later */
+	const char *arg = script;
+	uint32_t arglen = len;
+	tc_cmd_t *cmd = tc_cmd_index_find(&arg, &arglen);
+	if (!cmd || cmd->exec != tc_cmd_script_exec || arglen) {
+		tc_log(TC_LOG_ERR, "Script \"%s\" of %s not found", script, e->name);
+		return -1;
+	}
+	tc_log(TC_LOG_INFO, "Change of %s: \"%s\"", e->name, script);
+	int r = tc_cmd(script, len);
+	if (r < 0)
+		tc_log(TC_LOG_ERR, "Error in change of %s: \"%s\"", e->name, script);
+	return r;
+}
+
+/**
+ *  Execute the on command.
+ *
+ *  \param cmd  Pointer to the command to execute.
+ *  \param buf  Buffer with the command to execute.
+ *  \param len  Length of the command to execute
+ *  \retval 0 on success of normal command.
+ *  \retval 1 on exit command.
+ *  \retval -1 on error in command.
+ */
+static int tc_cmd_on_exec(tc_cmd_t *cmd, const char *buf, uint32_t len)
+{
+	/* on change <var> [<script>] */
+	if (tc_cmd_starts(&buf, &len, "change")) {
+		const char *name = buf;
+		uint32_t namelen = tc_cmd_wordlen(buf, len);
+		tc_cmd_wordrm(&buf, &len);
+		if (tc_cmd_wordlen(buf, len) != len) {
+			tc_log(TC_LOG_ERR, "Only the name of a script is executed on change");
+			return -1;
+		}
+		tc_cmd_env_handle_t handle = tc_cmd_env_intern(name, namelen);
+		if (handle == TC_CMD_ENV_INVALID)
+			return -1;
+		tc_cmd_env_subscribe(handle, buf, len);
+		return 0;
+	}
+
+	return -1;
+}
+
+/** On command object */
+static tc_cmd_t tc_cmd_on = {
+	.name = "on",
+	.exec = tc_cmd_on_exec
+};
+
+
+/* --- Conditions --------------------------------------------------------- */
+
+static int tc_cmd_line_exec(const char *buf, uint32_t len);
+
+/**
+ *  Execute the if command.
+ *
+ *  \param cmd  Pointer to the command to execute.
+ *  \param buf  Buffer with the command to execute.
+ *  \param len  Length of the command to execute
+ *  \retval 0 on success of normal command.
+ *  \retval 1 on exit command.
+ *  \retval -1 on error in command.
+ */
+static int tc_cmd_if_exec(tc_cmd_t *cmd, const char *buf, uint32_t len)
+{
+	/* if <var> <op> <number> <command> */
+	const char *name = buf;
+	uint32_t namelen = tc_cmd_wordlen(buf, len);
+	tc_cmd_wordrm(&buf, &len);
+	const char *op = buf;
+	uint32_t oplen = tc_cmd_wordlen(buf, len);
+	tc_cmd_wordrm(&buf, &len);
+	char *number = tc_arena_strndup(&tc_cmd_scratch, buf,
+	                                tc_cmd_wordlen(buf, len));
+	tc_cmd_wordrm(&buf, &len);
+	if (!namelen || !oplen || !*number || !len)
+		return -1;
+
+	/* Get the values to compare */
+	uint32_t epoch = tc_cmd_env_read_begin();
+	tc_cmd_env_handle_t handle = tc_cmd_env_find(name, namelen);
+	tc_cmd_env_read_end(epoch);
+	tc_cmd_env_num_t num;
+	if (tc_cmd_env_num(handle, &num)) {
+		tc_log(TC_LOG_ERR, "Variable \"%s\" is not a number",
+		       tc_arena_strndup(&tc_cmd_scratch, name, namelen));
+		return -1;
+	}
+	char *end;
+	long long i = strtoll(number, &end, 10);
+	bool isint = !*end;
+	double f = isint ? i : strtod(number, &end);
+	if (*end) {
+		tc_log(TC_LOG_ERR, "Invalid number \"%s\"", number);
+		return -1;
+	}
+
+	/* Compare the integers without converting them */
+	int c;
+	if (num.type == TC_CMD_ENV_FLOAT || !isint) {
+		double v = num.type == TC_CMD_ENV_FLOAT ? num.f :
+		           num.type == TC_CMD_ENV_BOOL ? num.b : num.i;
+		c = v < f ? -1 : v > f ? 1 : 0;
+	} else {
+		int64_t v = num.type == TC_CMD_ENV_BOOL ? num.b : num.i;
+		c = v < i ? -1 : v > i ? 1 : 0;
+	}
+	bool match;
+	if (tc_cmd_is(op, oplen, "=="))
+		match = c == 0;
+	else if (tc_cmd_is(op, oplen, "!="))
+		match = c != 0;
+	else if (tc_cmd_is(op, oplen, "<"))
+		match = c < 0;
+	else if (tc_cmd_is(op, oplen, "<="))
+		match = c <= 0;
+	else if (tc_cmd_is(op, oplen, ">"))
+		match = c > 0;
+	else if (tc_cmd_is(op, oplen, ">="))
+		match = c >= 0;
+	else {
+		tc_log(TC_LOG_ERR, "Invalid comparison \"%s\"",
+		       tc_arena_strndup(&tc_cmd_scratch, op, oplen));
+		return -1;
+	}
+	return match ? tc_cmd_line_exec(buf, len) : 0;
+}
+
+/** If command object */
+static tc_cmd_t tc_cmd_if = {
+	.name = "if",
+	.exec = tc_cmd_if_exec
 };
 
 
@@ -826,6 +2627,16 @@ static int tc_cmd_init_exec(tc_cmd_t *cmd, const char *buf, uint32_t len)
 	/* init pioneer <name> <host> */
 	else if (tc_cmd_starts(&buf, &len, "pioneer"))
 		return tc_cmd_pioneer_init(buf, len);
+	/* init exec <limit> */
+	else if (tc_cmd_starts(&buf, &len, "exec")) {
+		char *e;
+		const char *limit = tc_arena_strndup(&tc_cmd_scratch, buf, len);
+		unsigned long l = strtoul(limit, &e, 10);
+		if (!len || *e || !l)
+			return -1;
+		tc_exec_limit(l);
+		return 0;
+	}
 	return -1;
 }
 
@@ -838,6 +2649,17 @@ static tc_cmd_t tc_cmd_init_cmd = {
 
 /* --- Main API for commands ---------------------------------------------- */
 
+/** Directories and name of the configuration files */
+#define TC_CMD_CONF_DIR_ETC  "/etc/tvcontrold"
+#define TC_CMD_CONF_DIR_HOME ".tvcontrold"
+#define TC_CMD_CONF_NAME     "cmd.conf"
+
+/** True if the configuration of the home path should be read */
+static bool tc_cmd_readhome = false;
+
+/** Descriptor to watch the configuration changes, or -1 */
+static int tc_cmd_inotify = -1;
+
 /**
  *  Load a file to add new commands 
  *
@@ -875,7 +2697,7 @@ static int tc_cmd_load(const char *path)
 		}
 
 		/* Execute the commands */
-		tc_log(TC_LOG_INFO, "Command \"%s\"", strndupa(buf, buf_len));
+		tc_log(TC_LOG_INFO, "Command \"%s\"", buf);
 		int nr = tc_cmd(buf, buf_len);
 		if (nr) {
 			if (nr < 0)
@@ -892,7 +2714,345 @@ static int tc_cmd_load(const char *path)
 }
 
 
-int tc_cmd_init(bool readhome)
+
+/* --- Configuration cache ------------------------------------------------ */
+
+/** Paths of the configuration cache */
+#define TC_CMD_CACHE_HOME TC_CMD_CONF_DIR_HOME "/cmd.cache"
+#define TC_CMD_CACHE_VAR  "/var/cache/tvcontrold/cmd.cache"
+
+/** Identifier and version of the format of the configuration cache */
+#define TC_CMD_CACHE_MAGIC   "TVCC"
+#define TC_CMD_CACHE_VERSION 2
+
+/** Number of configuration files stamped in the cache */
+#define TC_CMD_CACHE_SOURCES 2
+
+/** Modification time of a file in nanoseconds */
+#define TC_CMD_CACHE_MTIME(_st) \
+	((int64_t)(_st).st_mtim.tv_sec * 1000000000 + (_st).st_mtim.tv_nsec)
+
+/**
+ *  Stamp of a configuration file the cache was compiled from.
+ */
+typedef struct tc_cmd_cache_stamp_t {
+	int64_t size;      /**< Size of the file, -1 if not present */
+	int64_t mtime;     /**< Modification time in nanoseconds    */
+	uint32_t hash;     /**< Hash of the contents of the file    */
+	uint32_t reserved; /**< Zero                                */
+} tc_cmd_cache_stamp_t;
+
+/**
+ *  Header of the configuration cache.
+ *
+ *  It is followed by the lines of the configuration as written, so the
+ *  variables are replaced with their values when the cache is loaded, as
+ *  records of a native 32 bits length, the text and a zero, so every text
+ *  without variables can be used from the mapping of the file. An empty
+ *  record ends the lines of each configuration file.
+ */
+typedef struct tc_cmd_cache_header_t {
+	char magic[4];     /**< TC_CMD_CACHE_MAGIC                  */
+	uint32_t version;  /**< TC_CMD_CACHE_VERSION                */
+	uint32_t len;      /**< Length of the records               */
+	uint32_t checksum; /**< Hash of the records                 */
+	tc_cmd_cache_stamp_t stamp[TC_CMD_CACHE_SOURCES]; /**< Sources */
+} tc_cmd_cache_header_t;
+
+/** Configuration files, in the order they are loaded */
+static const char *tc_cmd_cache_source[TC_CMD_CACHE_SOURCES] = {
+	TC_CMD_CONF_DIR_ETC "/" TC_CMD_CONF_NAME,
+	TC_CMD_CONF_DIR_HOME "/" TC_CMD_CONF_NAME
+};
+
+/** True while the lines of the configuration files are recorded */
+static bool tc_cmd_cache_recording = false;
+
+/** Records of the configuration being loaded */
+static char *tc_cmd_cache_buf = NULL;
+static uint32_t tc_cmd_cache_len = 0;
+static uint32_t tc_cmd_cache_alloc = 0;
+
+/**
+ *  Get the path of the configuration cache.
+ *
+ *  \return The path of the cache.
+ */
+static const char *tc_cmd_cache_path(void)
+{
+	return tc_cmd_readhome ? TC_CMD_CACHE_HOME : TC_CMD_CACHE_VAR;
+}
+
+/**
+ *  Hash the contents of a file.
+ *
+ *  \param path  Path of the file.
+ *  \return The hash of the contents.
+ */
+static uint32_t tc_cmd_cache_hash(const char *path)
+{
+	uint32_t hash = TC_HASH_INIT;
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return hash;
+	char buf[4096];
+	size_t r;
+	while ((r = fread(buf, 1, sizeof(buf), f)) > 0) {
+		size_t i;
+		for (i = 0; i < r; i++)
+			hash = TC_HASH_STEP(hash, buf[i]);
+	}
+	fclose(f);
+	return hash;
+}
+
+/**
+ *  Stamp a configuration file.
+ *
+ *  \param i   Index of the configuration file.
+ *  \param st  Stamp to fill.
+ */
+static void tc_cmd_cache_stamp(uint32_t i, tc_cmd_cache_stamp_t *st)
+{
+	memset(st, 0, sizeof(tc_cmd_cache_stamp_t));
+	st->size = -1;
+	struct stat s;
+	if ((i && !tc_cmd_readhome) || stat(tc_cmd_cache_source[i], &s))
+		return;
+	st->size = s.st_size;
+	st->mtime = TC_CMD_CACHE_MTIME(s);
+	st->hash = tc_cmd_cache_hash(tc_cmd_cache_source[i]);
+}
+
+/**
+ *  Check if a configuration file is the one stamped.
+ *
+ *  The contents are only hashed if the file has been modified.
+ *
+ *  \param i      Index of the configuration file.
+ *  \param st     Stamp of the file.
+ *  \param mtime  Set to the modification time of a file modified with
+ *                the same contents, to stamp it again.
+ *  \return true if the file has not changed.
+ */
+static bool tc_cmd_cache_fresh(uint32_t i, const tc_cmd_cache_stamp_t *st,
+                               int64_t *mtime)
+{
+	struct stat s;
+	if ((i && !tc_cmd_readhome) || stat(tc_cmd_cache_source[i], &s))
+		return st->size < 0;
+	if (st->size != s.st_size)
+		return false;
+	if (st->mtime == TC_CMD_CACHE_MTIME(s))
+		return true;
+	if (st->hash != tc_cmd_cache_hash(tc_cmd_cache_source[i]))
+		return false;
+	*mtime = TC_CMD_CACHE_MTIME(s);
+	return true;
+}
+
+/**
+ *  Stamp again a configuration file modified with the same contents, so
+ *  it is not hashed again. Only the stamp of the cache is written, the
+ *  records keep their checksum.
+ *
+ *  \param path   Path of the cache.
+ *  \param i      Index of the configuration file.
+ *  \param mtime  Modification time of the file.
+ */
+static void tc_cmd_cache_touch(const char *path, uint32_t i, int64_t mtime)
+{
+	off_t off = offsetof(tc_cmd_cache_header_t, stamp) +
+	            i * sizeof(tc_cmd_cache_stamp_t) +
+	            offsetof(tc_cmd_cache_stamp_t, mtime);
+	int fd = open(path, O_WRONLY | O_CLOEXEC);
+	if (fd < 0 || pwrite(fd, &mtime, sizeof(mtime), off) != sizeof(mtime))
+		tc_log(TC_LOG_WARN, "Cannot stamp the configuration cache \"%s\"",
+		       path);
+	if (fd >= 0)
+		close(fd);
+}
+
+/**
+ *  Record a line of the configuration being loaded.
+ *
+ *  \param buf  Line as written, before replacing its variables.
+ *  \param len  Length of the line.
+ */
+static void tc_cmd_cache_record(const char *buf, uint32_t len)
+{
+	uint32_t n = sizeof(uint32_t) + len + 1;
+	if (tc_cmd_cache_len + n > tc_cmd_cache_alloc) {
+		while (tc_cmd_cache_len + n > tc_cmd_cache_alloc)
+			tc_cmd_cache_alloc = tc_cmd_cache_alloc ?
+			                     tc_cmd_cache_alloc << 1 : 4096;
+		tc_cmd_cache_buf = (char *)realloc(tc_cmd_cache_buf,
+		                                   tc_cmd_cache_alloc);
+	}
+	char *r = tc_cmd_cache_buf + tc_cmd_cache_len;
+	memcpy(r, &len, sizeof(uint32_t));
+	memcpy(r + sizeof(uint32_t), buf, len);
+	r[sizeof(uint32_t) + len] = 0;
+	tc_cmd_cache_len += n;
+}
+
+/**
+ *  Write the lines recorded to the configuration cache.
+ *
+ *  \param h  Header with the stamps taken before loading the files.
+ *  \retval -1 on error (with a log entry).
+ *  \retval 0 on success.
+ */
+static int tc_cmd_cache_write(tc_cmd_cache_header_t *h)
+{
+	const char *path = tc_cmd_cache_path();
+	memcpy(h->magic, TC_CMD_CACHE_MAGIC, sizeof(h->magic));
+	h->version = TC_CMD_CACHE_VERSION;
+	h->len = tc_cmd_cache_len;
+	h->checksum = tc_hash(tc_cmd_cache_buf, tc_cmd_cache_len);
+
+	/* Replace the cache at once, it can be mapped by other process */
+	char tmp[64];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		tc_log(TC_LOG_WARN, "Cannot write the configuration cache \"%s\"",
+		       path);
+		return -1;
+	}
+	bool ok = write(fd, h, sizeof(tc_cmd_cache_header_t)) ==
+	          sizeof(tc_cmd_cache_header_t) &&
+	          write(fd, tc_cmd_cache_buf, tc_cmd_cache_len) ==
+	          (ssize_t)tc_cmd_cache_len;
+	if (close(fd))
+		ok = false;
+	if (!ok || rename(tmp, path)) {
+		tc_log(TC_LOG_WARN, "Cannot write the configuration cache \"%s\"",
+		       path);
+		unlink(tmp);
+		return -1;
+	}
+	tc_log(TC_LOG_INFO, "Configuration cache \"%s\" written", path);
+	return 0;
+}
+
+/**
+ *  Load the configuration from the cache if it is up to date.
+ *
+ *  The cache is mapped while the graph in use exists, and the scripts
+ *  use their texts from the mapping.
+ *
+ *  \retval -1 on error (with a log entry).
+ *  \retval 1 on cache not present or outdated.
+ *  \retval 0 on success.
+ */
+static int tc_cmd_cache_load(void)
+{
+	/* Map the cache */
+	const char *path = tc_cmd_cache_path();
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 1;
+	struct stat s;
+	if (fstat(fd, &s) || s.st_size < (off_t)sizeof(tc_cmd_cache_header_t)) {
+		close(fd);
+		return 1;
+	}
+	size_t maplen = s.st_size;
+	void *map = mmap(NULL, maplen, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return 1;
+
+	/* Check it was compiled from the current configuration */
+	const tc_cmd_cache_header_t *h = (const tc_cmd_cache_header_t *)map;
+	const char *rec = (const char *)(h + 1);
+	if (memcmp(h->magic, TC_CMD_CACHE_MAGIC, sizeof(h->magic)) ||
+	    h->version != TC_CMD_CACHE_VERSION ||
+	    h->len != maplen - sizeof(tc_cmd_cache_header_t) ||
+	    h->checksum != tc_hash(rec, h->len)) {
+		tc_log(TC_LOG_WARN, "Configuration cache \"%s\" not valid", path);
+		munmap(map, maplen);
+		return 1;
+	}
+	int64_t mtime[TC_CMD_CACHE_SOURCES];
+	uint32_t i;
+	for (i = 0; i < TC_CMD_CACHE_SOURCES; i++) {
+		mtime[i] = h->stamp[i].mtime;
+		if (!tc_cmd_cache_fresh(i, &h->stamp[i], &mtime[i])) {
+			tc_log(TC_LOG_INFO, "Configuration cache \"%s\" outdated", path);
+			munmap(map, maplen);
+			return 1;
+		}
+	}
+	for (i = 0; i < TC_CMD_CACHE_SOURCES; i++) {
+		if (mtime[i] != h->stamp[i].mtime)
+			tc_cmd_cache_touch(path, i, mtime[i]);
+	}
+	tc_cmd_graph->map = map;
+	tc_cmd_graph->maplen = maplen;
+	tc_log(TC_LOG_INFO, "Executing configuration cache \"%s\"", path);
+
+	/* Execute the lines until the exit of each file, the ones with
+	   variables replaced out of the mapping */
+	int result = 0;
+	bool skip = false;
+	bool corrupt = false;
+	uint32_t off = 0;
+	tc_cmd_mapped = true;
+	while (!result && off < h->len) {
+		uint32_t len;
+		if (h->len - off < sizeof(uint32_t) + 1) {
+			corrupt = true;
+			break;
+		}
+		memcpy(&len, rec + off, sizeof(uint32_t));
+		off += sizeof(uint32_t);
+		if (len >= h->len - off || rec[off + len]) {
+			corrupt = true;
+			break;
+		}
+		const char *line = rec + off;
+		off += len + 1;
+		if (!len) {
+			skip = false;
+			continue;
+		}
+		if (skip)
+			continue;
+		tc_cmd_depth++;
+		const char *text = line;
+		if (memchr(line, '$', len))
+			text = tc_cmd_env_subs(line, &len);
+		tc_cmd_mapped = text == line;
+		int r = text ? tc_cmd_line_exec(text, len) : -1;
+		if (!--tc_cmd_depth)
+			tc_arena_reset(&tc_cmd_scratch);
+		if (r < 0)
+			result = -1;
+		else if (r > 0)
+			skip = true;
+	}
+	tc_cmd_mapped = false;
+	if (corrupt) {
+		tc_log(TC_LOG_ERR, "Configuration cache \"%s\" corrupted", path);
+		result = -1;
+	}
+	return result;
+}
+
+
+/**
+ *  Load the native commands and the configuration into the graph in use.
+ *
+ *  The configuration cache is used if it is up to date, otherwise the
+ *  configuration files are loaded and the cache is written again.
+ *
+ *  \param cache  Use the configuration cache if it is up to date.
+ *  \retval -1 on error (with a log entry).
+ *  \retval 0 on success.
+ */
+static int tc_cmd_graph_load(bool cache)
 {
 	tc_cmd_add(&tc_cmd_exit);
 	tc_cmd_add(&tc_cmd_set);
@@ -904,68 +3064,254 @@ int tc_cmd_init(bool readhome)
 	#endif /* ENABLE_CEC */
 	tc_cmd_add(&tc_cmd_mouse);
 	tc_cmd_add(&tc_cmd_exec_cmd);
+	tc_cmd_add(&tc_cmd_after);
+	tc_cmd_add(&tc_cmd_every);
+	tc_cmd_add(&tc_cmd_cancel);
+	tc_cmd_add(&tc_cmd_on);
+	tc_cmd_add(&tc_cmd_if);
 	tc_cmd_add(&tc_cmd_init_cmd);
-	if (tc_cmd_load("/etc/tvcontrold/cmd.conf") < 0)
-		return -1;
-	if (readhome) {
-		if (tc_cmd_load(".tvcontrold/cmd.conf") < 0)
-			return -1;
+	tc_exec_limit(TC_EXEC_LIMIT);
+	if (cache) {
+		int r = tc_cmd_cache_load();
+		if (r <= 0)
+			return r;
 	}
+
+	/* Load the files recording the lines for the cache */
+	tc_cmd_cache_header_t h;
+	memset(&h, 0, sizeof(tc_cmd_cache_header_t));
+	uint32_t i;
+	for (i = 0; i < TC_CMD_CACHE_SOURCES; i++)
+		tc_cmd_cache_stamp(i, &h.stamp[i]);
+	int r = 0;
+	tc_cmd_cache_recording = true;
+	for (i = 0; !r && i < TC_CMD_CACHE_SOURCES; i++) {
+		if (i && !tc_cmd_readhome)
+			break;
+		if (tc_cmd_load(tc_cmd_cache_source[i]) < 0)
+			r = -1;
+		tc_cmd_cache_record("", 0);
+	}
+	tc_cmd_cache_recording = false;
+	if (!r && tc_cmd_cache_write(&h) && tc_cmd_dryrun)
+		r = -1;
+	free(tc_cmd_cache_buf);
+	tc_cmd_cache_buf = NULL;
+	tc_cmd_cache_len = 0;
+	tc_cmd_cache_alloc = 0;
+	return r;
+}
+
+/**
+ *  Watch the directories of the configuration files for changes.
+ */
+static void tc_cmd_watch_init(void)
+{
+	tc_cmd_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (tc_cmd_inotify < 0) {
+		tc_log(TC_LOG_WARN, "Configuration changes are not watched");
+		return;
+	}
+	uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE;
+	uint32_t n = 0;
+	if (inotify_add_watch(tc_cmd_inotify, TC_CMD_CONF_DIR_ETC, mask) >= 0)
+		n++;
+	if (tc_cmd_readhome &&
+	    inotify_add_watch(tc_cmd_inotify, TC_CMD_CONF_DIR_HOME, mask) >= 0)
+		n++;
+	if (!n) {
+		tc_log(TC_LOG_WARN, "Configuration changes are not watched");
+		close(tc_cmd_inotify);
+		tc_cmd_inotify = -1;
+	}
+}
+
+int tc_cmd_init(bool readhome)
+{
+	tc_cmd_readhome = readhome;
+	tc_cmd_graph = tc_cmd_graph_create();
+	if (tc_cmd_graph_load(true))
+		return -1;
+	tc_cmd_watch_init();
 	return 0;
 }
 
-int tc_cmd(const char *buf, uint32_t len)
+int tc_cmd_compile(bool readhome)
 {
-	char *newb = tc_cmd_env_subs(buf, &len);
-	if (!newb)
+	tc_cmd_readhome = readhome;
+	tc_cmd_dryrun = true;
+	tc_cmd_graph = tc_cmd_graph_create();
+	int r = tc_cmd_graph_load(false);
+	tc_cmd_dryrun = false;
+	tc_cmd_release();
+	return r;
+}
+
+int tc_cmd_reload(void)
+{
+	/* The graph cannot be replaced while a command uses it */
+	if (tc_cmd_depth) {
+		tc_log(TC_LOG_ERR, "Configuration cannot be reloaded from a command");
 		return -1;
-	if (len == 0)
-		return 0;
-	buf = newb;
-	if (buf[0] == '#') {
-		free(newb);
-		return 0;
 	}
+	tc_log(TC_LOG_INFO, "Reloading the configuration");
+
+	/* Load the configuration into a new graph */
+	tc_cmd_graph_t *prev = tc_cmd_graph;
+	tc_cmd_graph_prev = prev;
+	tc_cmd_graph = tc_cmd_graph_create();
+	int r = tc_cmd_graph_load(true);
+	tc_cmd_graph_prev = NULL;
+	tc_cmd_extend = NULL;
+
+	/* Keep the previous graph if there is any error, the variables and
+	   subscriptions already changed by the new configuration stay */
+	if (r) {
+		tc_cmd_graph_giveback(tc_cmd_graph, prev);
+		tc_cmd_graph_release(tc_cmd_graph);
+		tc_cmd_graph = prev;
+		tc_log(TC_LOG_ERR, "Error reloading, previous commands kept");
+		return -1;
+	}
+
+	/* Release the previous graph, but the objects reused */
+	tc_cmd_graph_giveback(tc_cmd_graph, NULL);
+	tc_cmd_graph_release(prev);
+	tc_log(TC_LOG_INFO, "Configuration reloaded");
+	return 0;
+}
+
+int tc_cmd_watch_fd(void)
+{
+	return tc_cmd_inotify;
+}
+
+bool tc_cmd_watch_changed(void)
+{
+	bool changed = false;
+	while (true) {
+		char buf[4096]
+			__attribute__ ((aligned(__alignof__(struct inotify_event))));
+		ssize_t r = read(tc_cmd_inotify, buf, sizeof(buf));
+		if (r <= 0)
+			break;
+		ssize_t i = 0;
+		while (i < r) {
+			struct inotify_event *e = (struct inotify_event *)(buf + i);
+			if (e->len && !strcmp(e->name, TC_CMD_CONF_NAME))
+				changed = true;
+			i += sizeof(struct inotify_event) + e->len;
+		}
+	}
+	return changed;
+}
+
+/**
+ *  Execute a command line with the variables already replaced.
+ *
+ *  \param buf   Buffer with the command to execute.
+ *  \param len   Length of the command to execute.
+ *  \retval 0 on success of normal command.
+ *  \retval 1 on exit command.
+ *  \retval -1 on error in command.
+ */
+static int tc_cmd_line_exec(const char *buf, uint32_t len)
+{
+	if (len == 0 || buf[0] == '#')
+		return 0;
 	bool extend = (buf[0] == '\t');
 	if (!extend)
 		tc_cmd_extend = NULL;
 	if (extend) {
 		if (!tc_cmd_extend || !tc_cmd_extend->extend) {
 			tc_log(TC_LOG_ERR, "Error extending command not supported");
-			free(newb);
 			return -1;
 		}
-		int r = tc_cmd_extend->extend(tc_cmd_extend, buf+1, len-1);
-		free(newb);
-		return r;
-	}
-	tc_cmd_t *cmd = tc_cmd_first;
-	while (cmd) {
-		if (tc_cmd_starts(&buf, &len, cmd->name)) {
-			int r = cmd->exec(cmd, buf, len);
-			free(newb);
-			return r;
-		}
-		cmd = cmd->next;
+		return tc_cmd_extend->extend(tc_cmd_extend, buf+1, len-1);
 	}
-	tc_log(TC_LOG_ERR, "Unknown command \"%s\"", strndupa(buf, len));
-	free(newb);
-	return -1;
+	const char *line = buf;
+	tc_cmd_t *cmd = tc_cmd_index_find(&buf, &len);
+	if (!cmd) {
+		tc_log(TC_LOG_ERR, "Unknown command \"%s\"", line);
+		return -1;
+	}
+	/* Only the declarations are executed when compiling */
+	if (tc_cmd_dryrun && cmd != &tc_cmd_set && cmd != &tc_cmd_init_cmd &&
+	    cmd != &tc_cmd_exit)
+		return 0;
+	return tc_cmd_call(cmd, buf, len);
+}
+
+/**
+ *  Execute a command line.
+ *
+ *  \param buf   Buffer with the command to execute.
+ *  \param len   Length of the command to execute.
+ *  \retval 0 on success of normal command.
+ *  \retval 1 on exit command.
+ *  \retval -1 on error in command.
+ */
+static int tc_cmd_line(const char *buf, uint32_t len)
+{
+	const char *raw = buf;
+	uint32_t rawlen = len;
+	buf = tc_cmd_env_subs(buf, &len);
+	if (!buf)
+		return -1;
+	/* The cache keeps the lines as written but the comments, so the
+	   variables get the values they have when it is loaded */
+	if (tc_cmd_cache_recording && tc_cmd_depth == 1 && len &&
+	    buf[0] != '#' && !(buf[0] == '\t' && (len == 1 || buf[1] == '#')))
+		tc_cmd_cache_record(raw, rawlen);
+	return tc_cmd_line_exec(buf, len);
+}
+
+int tc_cmd(const char *buf, uint32_t len)
+{
+	if (!tc_cmd_depth++)
+		tc_cmd_posted = false;
+	int r = tc_cmd_line(buf, len);
+	if (!--tc_cmd_depth)
+		tc_arena_reset(&tc_cmd_scratch);
+	return r;
+}
+
+bool tc_cmd_queued(void)
+{
+	return tc_cmd_posted;
 }
 
 void tc_cmd_release(void)
 {
-	while (tc_cmd_first) {
-		tc_cmd_t *c = tc_cmd_first;
-		tc_cmd_first = c->next;
-		if (c->free)
-			c->free(c);
+	if (tc_cmd_inotify >= 0) {
+		close(tc_cmd_inotify);
+		tc_cmd_inotify = -1;
 	}
-	while (tc_cmd_env) {
-		tc_cmd_env_t *e = tc_cmd_env;
-		tc_cmd_env = e->next;
+	tc_cmd_graph_release(tc_cmd_graph);
+	tc_cmd_graph = NULL;
+	tc_cmd_extend = NULL;
+	tc_cmd_env_reclaim(tc_cmd_env_retired[0]);
+	tc_cmd_env_reclaim(tc_cmd_env_retired[1]);
+	tc_cmd_env_retired[0] = NULL;
+	tc_cmd_env_retired[1] = NULL;
+	uint32_t i;
+	for (i = 0; tc_cmd_env && i < tc_cmd_env->count; i++) {
+		tc_cmd_env_t *e = tc_cmd_env->entry[i];
 		free((void *)e->name);
-		free((void *)e->value);
+		if (e->value)
+			tc_cmd_env_value_free(e->value);
+		free(e->change);
 		free(e);
 	}
+	if (tc_cmd_env)
+		tc_cmd_env_index_free(tc_cmd_env);
+	tc_cmd_env = NULL;
+	tc_cmd_env_csv_release(tc_cmd_env_snapshot);
+	tc_cmd_env_snapshot = NULL;
+	for (i = 0; i < tc_cmd_seqs_count; i++)
+		free(tc_cmd_seqs[i]);
+	free(tc_cmd_seqs);
+	tc_cmd_seqs = NULL;
+	tc_cmd_seqs_count = 0;
+	tc_arena_reset(&tc_cmd_scratch);
 }
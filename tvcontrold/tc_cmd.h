@@ -12,6 +12,48 @@
  */
 int tc_cmd_init(bool readhome);
 
+/**
+ *  Compile the configuration files into the configuration cache, that
+ *  is used by tc_cmd_init and tc_cmd_reload while the files don't change.
+ *
+ *  Only the variables and the declarations of the configuration are
+ *  executed, and the command system is released afterwards.
+ *
+ *  \param readhome  Read the home configurations
+ *  \retval -1 on error (with a log entry).
+ *  \retval 0 on success
+ */
+int tc_cmd_compile(bool readhome);
+
+/**
+ *  Reload the configuration files, replacing every command at once.
+ *
+ *  The pioneer objects declared again with the same host are kept
+ *  connected. If the new configuration has errors the previous commands
+ *  are kept, but the variables and subscriptions it already changed keep
+ *  their new values. It should be called between commands.
+ *
+ *  \retval -1 on error (with a log entry).
+ *  \retval 0 on success
+ */
+int tc_cmd_reload(void);
+
+/**
+ *  Get the descriptor to poll for changes of the configuration files.
+ *
+ *  \retval -1 if the changes are not watched.
+ *  \retval The descriptor to poll for reading.
+ */
+int tc_cmd_watch_fd(void);
+
+/**
+ *  Process the changes notified through the watch descriptor.
+ *
+ *  \retval true if a configuration file has changed.
+ *  \retval false otherwise.
+ */
+bool tc_cmd_watch_changed(void);
+
 /**
  *  Execute a command
  *
@@ -23,6 +65,89 @@ int tc_cmd_init(bool readhome);
  */
 int tc_cmd(const char *buf, uint32_t len);
 
+/**
+ *  Check if the last command executed has posted device commands, that
+ *  run after it returns, so its success only means they are queued.
+ *
+ *  \retval true if device commands have been queued.
+ *  \retval false if the command has finished.
+ */
+bool tc_cmd_queued(void);
+
+/** Handle of an environment variable */
+typedef uint32_t tc_cmd_env_handle_t;
+
+/** Value of an invalid environment variable handle */
+#define TC_CMD_ENV_INVALID ((tc_cmd_env_handle_t)-1)
+
+/**
+ *  Get the handle of an environment variable, creating it without value
+ *  if it doesn't exist.
+ *
+ *  \param name     Name of the environment variable.
+ *  \param namelen  Length of the name of the variable.
+ *  \retval TC_CMD_ENV_INVALID on error (with a log entry).
+ *  \retval The handle of the variable, valid until tc_cmd_release.
+ */
+tc_cmd_env_handle_t tc_cmd_env_intern(const char *name, uint32_t namelen);
+
+/**
+ *  Set the value of an environment variable through its handle.
+ *
+ *  \param handle   Handle of the environment variable.
+ *  \param value    Value of the environment variable.
+ *  \param valuelen Length of the value of the variable.
+ *  \retval -1 on error (with a log entry).
+ *  \retval 0 on success.
+ */
+int tc_cmd_env_set_handle(tc_cmd_env_handle_t handle,
+                          const char *value, uint32_t valuelen);
+
+/* Types of the values of the environment variables */
+#define TC_CMD_ENV_TEXT  (0)
+#define TC_CMD_ENV_INT   (1)
+#define TC_CMD_ENV_FLOAT (2)
+#define TC_CMD_ENV_BOOL  (3)
+
+/**
+ *  Native value of an environment variable.
+ */
+typedef struct tc_cmd_env_num_t {
+	uint8_t type;    /**< TC_CMD_ENV_* type of the value  */
+	union {
+		int64_t i;   /**< Value of TC_CMD_ENV_INT         */
+		double f;    /**< Value of TC_CMD_ENV_FLOAT       */
+		bool b;      /**< Value of TC_CMD_ENV_BOOL        */
+	};
+} tc_cmd_env_num_t;
+
+/**
+ *  Function to format the text of a native value.
+ *
+ *  \param buf  Buffer to write the text into.
+ *  \param len  Length of the buffer.
+ *  \param num  Value to format.
+ *  \return The length of the text, as snprintf.
+ */
+typedef int (*tc_cmd_env_format_t)(char *buf, uint32_t len,
+                                   const tc_cmd_env_num_t *num);
+
+/**
+ *  Set the native value of an environment variable through its handle.
+ *
+ *  The text of the value is only formatted when it is read, and the
+ *  integer values are compared without parsing it.
+ *
+ *  \param handle   Handle of the environment variable.
+ *  \param num      Value of the environment variable.
+ *  \param format   Function to format the text, or NULL for the default.
+ *  \retval -1 on error (with a log entry).
+ *  \retval 0 on success.
+ */
+int tc_cmd_env_set_num(tc_cmd_env_handle_t handle,
+                       const tc_cmd_env_num_t *num,
+                       tc_cmd_env_format_t format);
+
 /**
  *  Set a new environment variable.
  *
@@ -37,12 +162,68 @@ int tc_cmd_env_set(const char *name,  uint32_t namelen,
                    const char *value, uint32_t valuelen);
 
 /**
- *  Get an string of the environment variables in csv format.
+ *  Immutable snapshot of the environment in CSV format.
+ */
+typedef struct tc_cmd_env_csv_t {
+	uint32_t refs;    /**< References to the snapshot          */
+	uint32_t version; /**< Version of the environment          */
+	uint32_t len;     /**< Length of the text                  */
+	char *text;       /**< CSV text (zero terminated)          */
+} tc_cmd_env_csv_t;
+
+/**
+ *  Get a snapshot of the environment variables in csv format.
+ *
+ *  The snapshot is shared by every caller until a variable changes.
  *
- *  \retval The pointer to the CSV with the complete environment.
- *  \remarks The memory is allocated so free should be called.
+ *  \retval The snapshot with the complete environment.
+ *  \remarks tc_cmd_env_csv_release should be called when not used.
+ */
+const tc_cmd_env_csv_t *tc_cmd_env_csv(void);
+
+/**
+ *  Release a reference to a snapshot of the environment.
+ *
+ *  \param csv  Snapshot returned by tc_cmd_env_csv, or NULL.
+ */
+void tc_cmd_env_csv_release(const tc_cmd_env_csv_t *csv);
+
+/**
+ *  Function called with the CSV line of a changed variable.
+ *
+ *  \param param  Parameter given to tc_cmd_env_changes.
+ *  \param line   CSV line of the variable, without the new line.
+ *  \param len    Length of the line.
+ *  \return False to stop, true to continue with the next variable.
+ */
+typedef bool (*tc_cmd_env_change_t)(void *param, const char *line,
+                                    uint32_t len);
+
+/**
+ *  Get the variables changed after a version of the environment, with
+ *  their current value: several changes of a variable are seen once.
+ *
+ *  \param version  Version seen (0 for every variable), updated to the
+ *                  current one when every variable has been seen.
+ *  \param change   Function called with every variable changed.
+ *  \param param    Parameter of the function.
+ *  \retval -1 if the function stopped, the version is not updated.
+ *  \retval 0 on success.
+ */
+int tc_cmd_env_changes(uint32_t *version, tc_cmd_env_change_t change,
+                       void *param);
+
+/**
+ *  Execute the script subscribed to the changes of a variable, notified
+ *  through tc_server_notify. It is executed at most every 100ms, with
+ *  the last value of the variable.
+ *
+ *  \param handle  Handle of the variable changed.
+ *  \retval 0 on success.
+ *  \retval 1 on exit command.
+ *  \retval -1 on error (with a log entry).
  */
-const char *tc_cmd_env_csv(void);
+int tc_cmd_env_notified(tc_cmd_env_handle_t handle);
 
 /**
  *  Release the memory of this module
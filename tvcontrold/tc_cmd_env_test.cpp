@@ -0,0 +1,157 @@
+/**
+ *  Stress test of the environment: several threads set variables, as the
+ *  device threads do, while other threads read snapshots of it and the
+ *  main thread replaces variables in commands, as the server does.
+ *
+ *  Every value has two equal halves, so a snapshot with a value torn or
+ *  freed while read fails the test. It is built with ThreadSanitizer when
+ *  the compiler has it, which fails on any data race.
+ */
+#include <tc_cmd.h>
+#include <tc_log.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+/** Threads setting variables */
+#define TC_TEST_WRITERS 4
+
+/** Threads reading snapshots */
+#define TC_TEST_READERS 2
+
+/** Variables set by every writer */
+#define TC_TEST_VARS 8
+
+/** Values set by every writer */
+#define TC_TEST_SETS 5000
+
+/** True once the writers have finished */
+static bool tc_test_done = false;
+
+/** Number of errors found by the readers */
+static uint32_t tc_test_errors = 0;
+
+/** Number of snapshots read */
+static uint32_t tc_test_snapshots = 0;
+
+/**
+ *  Set the variables of a writer many times.
+ *
+ *  \param arg  Number of the writer.
+ *  \return NULL.
+ */
+static void *tc_test_writer(void *arg)
+{
+	uint32_t w = (uint32_t)(uintptr_t)arg;
+	char name[16];
+	char value[32];
+	uint32_t n;
+	for (n = 0; n < TC_TEST_SETS; n++) {
+		int nl = snprintf(name, sizeof(name), "w%u_%u", w, n % TC_TEST_VARS);
+		int vl = snprintf(value, sizeof(value), "%u:%u", n, n);
+		if (tc_cmd_env_set(name, nl, value, vl))
+			__atomic_add_fetch(&tc_test_errors, 1, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+/**
+ *  Check the lines of a snapshot of the environment.
+ *
+ *  \param csv  Snapshot.
+ *  \return The number of values torn.
+ */
+static uint32_t tc_test_check(const tc_cmd_env_csv_t *csv)
+{
+	uint32_t errors = 0;
+	const char *line = csv->text;
+	while (*line) {
+		const char *end = strchr(line, '\n');
+		if (!end)
+			return errors + 1;
+		unsigned a, b;
+		char c;
+		if (line[0] == 'w' &&
+		    (sscanf(strchr(line, ',') + 1, "%u:%u%c", &a, &b, &c) != 3 ||
+		     a != b || c != '\n'))
+			errors++;
+		line = end + 1;
+	}
+	return errors;
+}
+
+/**
+ *  Read snapshots of the environment until the writers finish.
+ *
+ *  \param arg  Not used.
+ *  \return NULL.
+ */
+static void *tc_test_reader(void *arg)
+{
+	while (!__atomic_load_n(&tc_test_done, __ATOMIC_ACQUIRE)) {
+		const tc_cmd_env_csv_t *csv = tc_cmd_env_csv();
+		uint32_t errors = tc_test_check(csv);
+		tc_cmd_env_csv_release(csv);
+		if (errors)
+			__atomic_add_fetch(&tc_test_errors, errors, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&tc_test_snapshots, 1, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	tc_log_init();
+
+	/* Every variable exists before the commands replace them */
+	uint32_t w, i;
+	for (w = 0; w < TC_TEST_WRITERS; w++) {
+		for (i = 0; i < TC_TEST_VARS; i++) {
+			char name[16];
+			int nl = snprintf(name, sizeof(name), "w%u_%u", w, i);
+			tc_cmd_env_set(name, nl, "0:0", 3);
+		}
+	}
+
+	pthread_t writer[TC_TEST_WRITERS];
+	pthread_t reader[TC_TEST_READERS];
+	for (i = 0; i < TC_TEST_READERS; i++)
+		pthread_create(&reader[i], NULL, tc_test_reader, NULL);
+	for (w = 0; w < TC_TEST_WRITERS; w++)
+		pthread_create(&writer[w], NULL, tc_test_writer,
+		               (void *)(uintptr_t)w);
+
+	/* Replace the variables in comments, which are not executed */
+	const char *cmd = "# $w0_0 $w1_1 $w2_2 $w3_3 $w0_7 $w3_4";
+	uint32_t subs = 0;
+	while (__atomic_load_n(&tc_test_snapshots, __ATOMIC_RELAXED) < 100 ||
+	       subs < 1000) {
+		if (tc_cmd(cmd, strlen(cmd)))
+			__atomic_add_fetch(&tc_test_errors, 1, __ATOMIC_RELAXED);
+		subs++;
+	}
+	for (w = 0; w < TC_TEST_WRITERS; w++)
+		pthread_join(writer[w], NULL);
+	__atomic_store_n(&tc_test_done, true, __ATOMIC_RELEASE);
+	for (i = 0; i < TC_TEST_READERS; i++)
+		pthread_join(reader[i], NULL);
+
+	/* The last values are the ones of the last sets */
+	const tc_cmd_env_csv_t *csv = tc_cmd_env_csv();
+	uint32_t errors = tc_test_check(csv);
+	for (w = 0; w < TC_TEST_WRITERS; w++) {
+		for (i = 0; i < TC_TEST_VARS; i++) {
+			char line[64];
+			uint32_t n = TC_TEST_SETS - TC_TEST_VARS + i;
+			snprintf(line, sizeof(line), "w%u_%u,%u:%u\n", w, i, n, n);
+			if (!strstr(csv->text, line))
+				errors++;
+		}
+	}
+	tc_cmd_env_csv_release(csv);
+	tc_test_errors += errors;
+
+	printf("%u snapshots, %u substitutions, %u errors\n",
+	       tc_test_snapshots, subs, tc_test_errors);
+	return tc_test_errors ? 1 : 0;
+}
@@ -0,0 +1,178 @@
+#include <tc_exec.h>
+#include <tc_cmd.h>
+#include <tc_log.h>
+#include <tc_server.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <signal.h>
+#include <spawn.h>
+#include <pthread.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+
+/* Define the following macro to debug */
+/* #define TC_EXEC_DEBUG */
+
+extern char **environ;
+
+/**
+ *  Process running.
+ */
+typedef struct tc_exec_proc_t {
+	pid_t pid;  /**< Identifier of the process        */
+	char *name; /**< Name for the variable and event  */
+} tc_exec_proc_t;
+
+/** Descriptor receiving SIGCHLD, or -1 */
+static int tc_exec_sigfd = -1;
+
+/** Processes running */
+static tc_exec_proc_t *tc_exec_proc = NULL;
+static uint32_t tc_exec_count = 0;
+static uint32_t tc_exec_alloc = 0;
+
+/** Maximum number of processes running */
+static uint32_t tc_exec_max = TC_EXEC_LIMIT;
+
+/** Lock of the processes, started from the lane of the exec command */
+static pthread_mutex_t tc_exec_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int tc_exec_init(void)
+{
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	if (pthread_sigmask(SIG_BLOCK, &mask, NULL)) {
+		tc_log(TC_LOG_ERR, "Error blocking SIGCHLD");
+		return -1;
+	}
+	tc_exec_sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (tc_exec_sigfd < 0) {
+		tc_log(TC_LOG_ERR, "Error creating the SIGCHLD descriptor");
+		return -1;
+	}
+	return 0;
+}
+
+void tc_exec_limit(uint32_t limit)
+{
+	pthread_mutex_lock(&tc_exec_lock);
+	tc_exec_max = limit;
+	pthread_mutex_unlock(&tc_exec_lock);
+}
+
+int tc_exec_spawn(const char *name, char *const argv[])
+{
+	if (tc_exec_sigfd < 0) {
+		tc_log(TC_LOG_ERR, "Processes cannot be executed");
+		return -1;
+	}
+	/* Kept locked until it is added, so it is not reaped before */
+	pthread_mutex_lock(&tc_exec_lock);
+	if (tc_exec_count >= tc_exec_max) {
+		tc_log(TC_LOG_ERR, "Too many processes running (%u)", tc_exec_count);
+		pthread_mutex_unlock(&tc_exec_lock);
+		return -1;
+	}
+
+	/* The child should not inherit the blocked SIGCHLD */
+	posix_spawnattr_t attr;
+	posix_spawnattr_init(&attr);
+	sigset_t mask;
+	sigemptyset(&mask);
+	posix_spawnattr_setsigmask(&attr, &mask);
+	sigaddset(&mask, SIGCHLD);
+	sigaddset(&mask, SIGPIPE);
+	posix_spawnattr_setsigdefault(&attr, &mask);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK |
+	                                POSIX_SPAWN_SETSIGDEF);
+	pid_t pid;
+	int r = posix_spawnp(&pid, argv[0], NULL, &attr, argv, environ);
+	posix_spawnattr_destroy(&attr);
+	if (r) {
+		tc_log(TC_LOG_ERR, "Error executing \"%s\": %s", argv[0], strerror(r));
+		pthread_mutex_unlock(&tc_exec_lock);
+		return -1;
+	}
+
+	/* Keep it to be reaped */
+	if (tc_exec_count == tc_exec_alloc) {
+		tc_exec_alloc = tc_exec_alloc ? tc_exec_alloc << 1 : 4;
+		tc_exec_proc = (tc_exec_proc_t *)
+			realloc(tc_exec_proc, tc_exec_alloc * sizeof(tc_exec_proc_t));
+	}
+	tc_exec_proc_t *p = &tc_exec_proc[tc_exec_count++];
+	p->pid = pid;
+	p->name = strdup(name);
+	char *c;
+	for (c = p->name; *c; c++)
+		if (!isalnum(*c) && *c != '_')
+			*c = '_';
+	#ifdef TC_EXEC_DEBUG
+	tc_log(TC_LOG_DEBUG, "exec: %s: pid:%u", p->name, (unsigned)pid);
+	#endif /* TC_EXEC_DEBUG */
+	pthread_mutex_unlock(&tc_exec_lock);
+	return 0;
+}
+
+int tc_exec_fd(void)
+{
+	return tc_exec_sigfd;
+}
+
+void tc_exec_reap(void)
+{
+	/* Consume the signals, several children can share one */
+	struct signalfd_siginfo info;
+	while (read(tc_exec_sigfd, &info, sizeof(info)) == sizeof(info))
+		;
+
+	/* Check every process running */
+	pthread_mutex_lock(&tc_exec_lock);
+	uint32_t i = 0;
+	while (i < tc_exec_count) {
+		tc_exec_proc_t *p = &tc_exec_proc[i];
+		int st;
+		if (waitpid(p->pid, &st, WNOHANG) != p->pid) {
+			i++;
+			continue;
+		}
+		int status = WIFEXITED(st) ? WEXITSTATUS(st) :
+		             WIFSIGNALED(st) ? 128 + WTERMSIG(st) : -1;
+		tc_log(TC_LOG_INFO, "Process \"%s\" finished with status %d",
+		       p->name, status);
+
+		/* Publish the status and post the event */
+		char buf[256];
+		int n = snprintf(buf, sizeof(buf), "exec_%s_status", p->name);
+		if (n < (int)sizeof(buf)) {
+			tc_cmd_env_num_t num;
+			num.type = TC_CMD_ENV_INT;
+			num.i = status;
+			tc_cmd_env_set_num(tc_cmd_env_intern(buf, n), &num, NULL);
+		}
+		n = snprintf(buf, sizeof(buf), "on_exec_%s_done", p->name);
+		if (n < (int)sizeof(buf))
+			tc_server_event(buf, n);
+		free(p->name);
+		*p = tc_exec_proc[--tc_exec_count];
+	}
+	pthread_mutex_unlock(&tc_exec_lock);
+}
+
+void tc_exec_release(void)
+{
+	uint32_t i;
+	for (i = 0; i < tc_exec_count; i++)
+		free(tc_exec_proc[i].name);
+	free(tc_exec_proc);
+	tc_exec_proc = NULL;
+	tc_exec_count = 0;
+	tc_exec_alloc = 0;
+	if (tc_exec_sigfd >= 0) {
+		close(tc_exec_sigfd);
+		tc_exec_sigfd = -1;
+	}
+}
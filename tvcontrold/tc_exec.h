@@ -0,0 +1,63 @@
+/**
+ *  Processes executed without blocking the server
+ */
+#ifndef TC_EXEC_H_INCLUDED
+#define TC_EXEC_H_INCLUDED
+
+#include <tc_types.h>
+
+/** Default maximum number of processes running at the same time */
+#define TC_EXEC_LIMIT 8
+
+/**
+ *  Initialize the execution of processes.
+ *
+ *  SIGCHLD is blocked to be received through a descriptor, so it should
+ *  be called before creating any thread.
+ *
+ *  \retval -1 on error (with a log entry).
+ *  \retval 0 on success.
+ */
+int tc_exec_init(void);
+
+/**
+ *  Configure the maximum number of processes running at the same time.
+ *
+ *  \param limit  Maximum number of processes.
+ */
+void tc_exec_limit(uint32_t limit);
+
+/**
+ *  Start a process without waiting for it.
+ *
+ *  When the process finishes the variable exec_<name>_status is set with
+ *  its exit status and the event on_exec_<name>_done is executed.
+ *
+ *  \param name  Name of the process for the variable and the event.
+ *  \param argv  Arguments of the process, ended with NULL. The first
+ *               one is the program, searched in the PATH.
+ *  \retval -1 on error (with a log entry).
+ *  \retval 0 on success.
+ */
+int tc_exec_spawn(const char *name, char *const argv[]);
+
+/**
+ *  Get the descriptor to poll for finished processes.
+ *
+ *  \retval -1 if not initialized.
+ *  \retval The descriptor to poll for reading.
+ */
+int tc_exec_fd(void);
+
+/**
+ *  Reap the finished processes, notified through the descriptor.
+ */
+void tc_exec_reap(void);
+
+/**
+ *  Release the resources of the execution of processes. The processes
+ *  still running are not waited for.
+ */
+void tc_exec_release(void);
+
+#endif /* TC_EXEC_H_INCLUDED */
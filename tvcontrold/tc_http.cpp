@@ -0,0 +1,300 @@
+#include <tc_http.h>
+#include <string.h>
+#include <strings.h>
+
+/* Enable this to debug */
+/* #define TC_HTTP_DEBUG */
+
+#ifdef TC_HTTP_DEBUG
+#include <tc_log.h>
+#endif /* TC_HTTP_DEBUG */
+
+void tc_http_init(tc_http_t *req)
+{
+	memset(req, 0, sizeof(*req));
+	req->state = TC_HTTP_METHOD;
+}
+
+/**
+ *  Check if a character can be part of a token.
+ *
+ *  \param c  Character.
+ *  \retval true if it is valid in a token.
+ *  \retval false otherwise.
+ */
+static bool tc_http_token(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+	       (c >= '0' && c <= '9') || (c && strchr("!#$%&'*+-.^_`|~", c));
+}
+
+/**
+ *  Compare a token with a name, without case.
+ *
+ *  \param token  Token.
+ *  \param len    Length of the token.
+ *  \param name   Name to compare with.
+ *  \retval true if they are equal.
+ *  \retval false otherwise.
+ */
+static bool tc_http_is(const char *token, uint32_t len, const char *name)
+{
+	return strlen(name) == len && !strncasecmp(token, name, len);
+}
+
+/**
+ *  Add a decoded character to the path or the query.
+ *
+ *  \param req  Request being parsed.
+ *  \param c    Character to add.
+ *  \retval -1 if it is over the limit.
+ *  \retval 0 on success.
+ */
+static int tc_http_path_add(tc_http_t *req, char c)
+{
+	char *buf = req->query ? req->args : req->path;
+	uint32_t *len = req->query ? &req->argslen : &req->pathlen;
+	if (*len == TC_HTTP_PATH_MAX)
+		return -1;
+	buf[(*len)++] = c;
+	buf[*len] = 0;
+	return 0;
+}
+
+/**
+ *  Parse a character of the path or the query.
+ *
+ *  \param req  Request being parsed.
+ *  \param c    Character of the request line.
+ *  \retval -1 on error.
+ *  \retval 0 on success.
+ */
+static int tc_http_path(tc_http_t *req, char c)
+{
+	if ((uint8_t)c < 0x21 || c == 0x7f)
+		return -1;
+	if (!req->pathlen && c != '/')
+		return -1;
+	if (req->escape) {
+		uint8_t digit;
+		if (c >= '0' && c <= '9')
+			digit = c - '0';
+		else if (c >= 'a' && c <= 'f')
+			digit = c - ('a' - 10);
+		else if (c >= 'A' && c <= 'F')
+			digit = c - ('A' - 10);
+		else
+			return -1;
+		req->escaped = req->escaped << 4 | digit;
+		if (--req->escape)
+			return 0;
+		/* The commands can't have zeros */
+		if (!req->escaped)
+			return -1;
+		return tc_http_path_add(req, req->escaped);
+	}
+	if (c == '%') {
+		req->escape = 2;
+		req->escaped = 0;
+		return 0;
+	}
+	if (c == '?' && !req->query) {
+		req->query = true;
+		return 0;
+	}
+	return tc_http_path_add(req, c);
+}
+
+/**
+ *  Parse a header line.
+ *
+ *  \param req   Request being parsed.
+ *  \param data  Data of the request.
+ *  \param line  Offset of the line.
+ *  \param len   Length of the line, without the end.
+ *  \retval -1 on error.
+ *  \retval 0 on success.
+ */
+static int tc_http_header(tc_http_t *req, const uint8_t *data, uint32_t line,
+                          uint32_t len)
+{
+	const char *name = (const char *)data + line;
+	if (++req->headers > TC_HTTP_HEADERS_MAX)
+		return -1;
+	uint32_t n = 0;
+	while (n < len && tc_http_token(name[n]))
+		n++;
+	if (!n || n == len || name[n] != ':')
+		return -1;
+
+	/* Get the value without the spaces around it */
+	const char *value = name + n + 1;
+	uint32_t vlen = len - n - 1;
+	while (vlen && (*value == ' ' || *value == '\t')) {
+		value++;
+		vlen--;
+	}
+	while (vlen && (value[vlen - 1] == ' ' || value[vlen - 1] == '\t'))
+		vlen--;
+	#ifdef TC_HTTP_DEBUG
+	tc_log(TC_LOG_DEBUG, "http: header: %.*s: %.*s", (int)n, name,
+	       (int)vlen, value);
+	#endif /* TC_HTTP_DEBUG */
+
+	if (tc_http_is(name, n, "Content-Length")) {
+		uint64_t length = 0;
+		uint32_t i;
+		for (i = 0; i < vlen; i++) {
+			if (value[i] < '0' || value[i] > '9')
+				return -1;
+			length = length * 10 + value[i] - '0';
+			if (length > 0xffffffff)
+				return -1;
+		}
+		if (!vlen || (req->length_known && req->length != length))
+			return -1;
+		req->length_known = true;
+		req->length = length;
+	} else if (tc_http_is(name, n, "Transfer-Encoding")) {
+		/* The bodies are only delimited by their length */
+		return -1;
+	} else if (tc_http_is(name, n, "Connection")) {
+		while (vlen) {
+			uint32_t l = 0;
+			while (l < vlen && value[l] != ',')
+				l++;
+			uint32_t t = l;
+			while (t && (value[t - 1] == ' ' || value[t - 1] == '\t'))
+				t--;
+			if (tc_http_is(value, t, "close"))
+				req->connection |= TC_HTTP_CLOSE;
+			else if (tc_http_is(value, t, "keep-alive"))
+				req->connection |= TC_HTTP_KEEPALIVE;
+			else if (tc_http_is(value, t, "upgrade"))
+				req->connection |= TC_HTTP_UPGRADE;
+			while (l < vlen && (value[l] == ',' || value[l] == ' ' ||
+			                    value[l] == '\t'))
+				l++;
+			value += l;
+			vlen -= l;
+		}
+	} else if (tc_http_is(name, n, "Upgrade")) {
+		req->websocket = tc_http_is(value, vlen, "websocket");
+	} else if (tc_http_is(name, n, "Sec-WebSocket-Key")) {
+		req->key = (const uint8_t *)value - data;
+		req->keylen = vlen;
+	}
+	return 0;
+}
+
+int tc_http_parse(tc_http_t *req, const uint8_t *data, uint32_t len,
+                  uint32_t size)
+{
+	while (true) {
+		switch (req->state) {
+		case TC_HTTP_METHOD: {
+			if (req->pos == len)
+				return 1;
+			char c = data[req->pos++];
+			if (c != ' ') {
+				if (c < 'A' || c > 'Z' || req->methodlen == TC_HTTP_METHOD_MAX)
+					return -1;
+				req->method[req->methodlen++] = c;
+				break;
+			}
+			if (tc_http_is(req->method, req->methodlen, "POST"))
+				req->post = true;
+			else if (!tc_http_is(req->method, req->methodlen, "GET"))
+				return -1;
+			req->state = TC_HTTP_PATH;
+			break;
+		}
+		case TC_HTTP_PATH: {
+			if (req->pos == len)
+				return 1;
+			char c = data[req->pos++];
+			if (c != ' ' && c != '\r' && c != '\n') {
+				if (tc_http_path(req, c))
+					return -1;
+				break;
+			}
+			if (req->escape || !req->pathlen)
+				return -1;
+			if (c == ' ') {
+				req->version = req->pos;
+				req->state = TC_HTTP_VERSION;
+				break;
+			}
+			/* Simple requests are answered at once and closed */
+			if (req->post)
+				return -1;
+			req->simple = true;
+			req->end = req->pos;
+			req->state = TC_HTTP_DONE;
+			return 0;
+		}
+		case TC_HTTP_VERSION: {
+			const uint8_t *nl = (const uint8_t *)
+				memchr(data + req->pos, '\n', len - req->pos);
+			if (!nl) {
+				req->pos = len;
+				if (len - req->version > 9)
+					return -1;
+				return 1;
+			}
+			const char *v = (const char *)data + req->version;
+			uint32_t l = nl - data - req->version;
+			if (l && v[l - 1] == '\r')
+				l--;
+			if (l != 8 || memcmp(v, "HTTP/1.", 7) || v[7] < '0' || v[7] > '9')
+				return -1;
+			req->minor = v[7] - '0';
+			req->pos = req->scan = nl - data + 1;
+			req->state = TC_HTTP_HEADER;
+			break;
+		}
+		case TC_HTTP_HEADER: {
+			const uint8_t *nl = (const uint8_t *)
+				memchr(data + req->scan, '\n', len - req->scan);
+			if (!nl) {
+				req->scan = len;
+				if (len - req->pos > TC_HTTP_LINE_MAX)
+					return -1;
+				return 1;
+			}
+			uint32_t line = req->pos;
+			uint32_t l = nl - data - line;
+			req->pos = req->scan = nl - data + 1;
+			if (l && data[line + l - 1] == '\r')
+				l--;
+			if (l > TC_HTTP_LINE_MAX)
+				return -1;
+			if (l) {
+				if (tc_http_header(req, data, line, l))
+					return -1;
+				break;
+			}
+			/* The headers have finished */
+			req->body = req->pos;
+			if (req->length > size || req->body > size - req->length)
+				return -1;
+			req->state = TC_HTTP_BODY;
+			break;
+		}
+		case TC_HTTP_BODY:
+			if (len - req->body < req->length)
+				return 1;
+			req->end = req->body + req->length;
+			if (req->minor)
+				req->keep = !(req->connection & TC_HTTP_CLOSE);
+			else
+				req->keep = req->connection & TC_HTTP_KEEPALIVE;
+			req->state = TC_HTTP_DONE;
+			return 0;
+		case TC_HTTP_DONE:
+			return 0;
+		default:
+			return -1;
+		}
+	}
+}
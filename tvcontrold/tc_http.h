@@ -0,0 +1,89 @@
+/**
+ *  Incremental parser of HTTP/1.x requests
+ */
+#ifndef TC_HTTP_H_INCLUDED
+#define TC_HTTP_H_INCLUDED
+
+#include <tc_types.h>
+
+/** Maximum length of the path and of the query, once decoded */
+#define TC_HTTP_PATH_MAX 256
+
+/** Maximum length of the method */
+#define TC_HTTP_METHOD_MAX 7
+
+/** Maximum length of a header line */
+#define TC_HTTP_LINE_MAX 1024
+
+/** Maximum number of headers of a request */
+#define TC_HTTP_HEADERS_MAX 64
+
+/* States of the parser */
+#define TC_HTTP_METHOD   0  /**< Reading the method               */
+#define TC_HTTP_PATH     1  /**< Reading the path and the query   */
+#define TC_HTTP_VERSION  2  /**< Reading the version              */
+#define TC_HTTP_HEADER   3  /**< Reading the header lines         */
+#define TC_HTTP_BODY     4  /**< Waiting for the body             */
+#define TC_HTTP_DONE     5  /**< Request complete                 */
+
+/* Tokens found in the Connection header */
+#define TC_HTTP_CLOSE     0x1
+#define TC_HTTP_KEEPALIVE 0x2
+#define TC_HTTP_UPGRADE   0x4
+
+/**
+ *  Request being parsed, resumed with every new data received. The
+ *  offsets refer to the buffer given to tc_http_parse, that should not
+ *  change until the request is complete.
+ */
+typedef struct tc_http_t {
+	uint8_t state;      /**< TC_HTTP_* state of the parser            */
+	uint32_t pos;       /**< Offset of the next byte to parse          */
+	uint32_t scan;      /**< Offset to look for the end of the line    */
+	char method[TC_HTTP_METHOD_MAX + 1]; /**< Method, zero terminated  */
+	uint32_t methodlen; /**< Length of the method                      */
+	bool post;          /**< POST request, GET otherwise               */
+	bool simple;        /**< Request without version, nor headers      */
+	uint8_t minor;      /**< Minor version of HTTP/1.x                 */
+	uint8_t escape;     /**< Hex digits left of a %-escape             */
+	uint8_t escaped;    /**< Character of the %-escape being decoded   */
+	bool query;         /**< Reading the query                         */
+	char path[TC_HTTP_PATH_MAX + 1];  /**< Path decoded, zero ended    */
+	uint32_t pathlen;   /**< Length of the path                        */
+	char args[TC_HTTP_PATH_MAX + 1];  /**< Query decoded, zero ended   */
+	uint32_t argslen;   /**< Length of the query                       */
+	uint32_t version;   /**< Offset of the version                     */
+	uint32_t headers;   /**< Number of headers                         */
+	uint8_t connection; /**< TC_HTTP_CLOSE... tokens of Connection     */
+	bool websocket;     /**< Upgrade to websocket requested            */
+	uint32_t key;       /**< Offset of the Sec-WebSocket-Key value     */
+	uint32_t keylen;    /**< Length of the key, 0 if not present       */
+	bool length_known;  /**< Content-Length present                    */
+	uint32_t length;    /**< Length of the body                        */
+	uint32_t body;      /**< Offset of the body                        */
+	uint32_t end;       /**< Offset after the request                  */
+	bool keep;          /**< Keep the connection after the response    */
+} tc_http_t;
+
+/**
+ *  Prepare a request to be parsed.
+ *
+ *  \param req  Request to initialize.
+ */
+void tc_http_init(tc_http_t *req);
+
+/**
+ *  Parse the data received of a request, from where it stopped.
+ *
+ *  \param req   Request being parsed.
+ *  \param data  Data received, from the beginning of the request.
+ *  \param len   Length of the data received.
+ *  \param size  Maximum length of the request with its body.
+ *  \retval -1 if the request has errors or is over the limits.
+ *  \retval 0 if the request is complete.
+ *  \retval 1 if more data is needed.
+ */
+int tc_http_parse(tc_http_t *req, const uint8_t *data, uint32_t len,
+                  uint32_t size);
+
+#endif /* TC_HTTP_H_INCLUDED */
@@ -0,0 +1,138 @@
+/**
+ *  Benchmark of the HTTP parser over canned requests, parsed whole and
+ *  fragmented as they may be received: in segments of a few bytes and
+ *  byte by byte, resuming the parser with every new segment.
+ *
+ *  Usage: tc_http_bench [iterations]
+ */
+#include <tc_http.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/** Default number of times every request is parsed whole */
+#define TC_BENCH_ITERATIONS 200000
+
+/** Length of the segments of the fragmented requests */
+#define TC_BENCH_SEGMENT 7
+
+/** Maximum length of a request with its body */
+#define TC_BENCH_SIZE 4096
+
+/**
+ *  Request of the benchmark.
+ */
+typedef struct tc_bench_req_t {
+	const char *name; /**< Name of the request  */
+	const char *text; /**< Text of the request  */
+} tc_bench_req_t;
+
+/** Canned requests, like the ones of the clients */
+static const tc_bench_req_t tc_bench_reqs[] = {
+	{ "simple", "GET /ping\r\n" },
+	{ "ping",
+	  "GET /ping HTTP/1.1\r\n"
+	  "Host: tv:1423\r\n"
+	  "\r\n" },
+	{ "command",
+	  "GET /cmd/pio%20volumeup?x=1 HTTP/1.1\r\n"
+	  "Host: tv:1423\r\n"
+	  "User-Agent: Mozilla/5.0 (Linux; Android 13) AppleWebKit/537.36\r\n"
+	  "Accept: */*\r\n"
+	  "Accept-Encoding: gzip, deflate\r\n"
+	  "Accept-Language: en-US,en;q=0.9\r\n"
+	  "Connection: keep-alive\r\n"
+	  "\r\n" },
+	{ "batch",
+	  "POST /batch?continue HTTP/1.1\r\n"
+	  "Host: tv:1423\r\n"
+	  "Content-Type: text/plain\r\n"
+	  "Content-Length: 41\r\n"
+	  "\r\n"
+	  "cec poweron all\npio volumeup\nset mode tv\n" },
+	{ "websocket",
+	  "GET /ws HTTP/1.1\r\n"
+	  "Host: tv:1423\r\n"
+	  "Upgrade: websocket\r\n"
+	  "Connection: keep-alive, Upgrade\r\n"
+	  "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+	  "Sec-WebSocket-Version: 13\r\n"
+	  "Origin: http://tv:1423\r\n"
+	  "\r\n" }
+};
+
+/** Sum of the results, so the parsing is not optimized out */
+static volatile uint32_t tc_bench_sink = 0;
+
+/**
+ *  Get the monotonic time in nanoseconds.
+ *
+ *  \return The time.
+ */
+static uint64_t tc_bench_now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+/**
+ *  Parse a request many times, given in segments.
+ *
+ *  \param data        Request.
+ *  \param len         Length of the request.
+ *  \param segment     Length of the segments, or 0 to parse it whole.
+ *  \param iterations  Number of times it is parsed.
+ *  \return The nanoseconds per request, or -1 if it is not parsed.
+ */
+static double tc_bench_parse(const uint8_t *data, uint32_t len,
+                             uint32_t segment, uint32_t iterations)
+{
+	tc_http_t req;
+	uint64_t t = tc_bench_now();
+	uint32_t i;
+	for (i = 0; i < iterations; i++) {
+		tc_http_init(&req);
+		uint32_t l = segment ? 0 : len;
+		int r;
+		do {
+			l = segment && l + segment < len ? l + segment : len;
+			r = tc_http_parse(&req, data, l, TC_BENCH_SIZE);
+		} while (r == 1 && l < len);
+		if (r)
+			return -1;
+		tc_bench_sink += req.end;
+	}
+	return (double)(tc_bench_now() - t) / iterations;
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t iterations = argc > 1 ? atoi(argv[1]) : TC_BENCH_ITERATIONS;
+	if (!iterations) {
+		fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+		return 1;
+	}
+	printf("%-10s %6s %12s %12s %12s\n", "request", "length", "whole",
+	       "segments", "bytes");
+	uint32_t i;
+	for (i = 0; i < sizeof(tc_bench_reqs) / sizeof(tc_bench_reqs[0]); i++) {
+		const uint8_t *data = (const uint8_t *)tc_bench_reqs[i].text;
+		uint32_t len = strlen(tc_bench_reqs[i].text);
+		/* Warm up and check that every request is parsed */
+		if (tc_bench_parse(data, len, 0, 1000) < 0 ||
+		    tc_bench_parse(data, len, 1, 100) < 0) {
+			printf("%s: not parsed\n", tc_bench_reqs[i].name);
+			return 1;
+		}
+		double whole = tc_bench_parse(data, len, 0, iterations);
+		double seg = tc_bench_parse(data, len, TC_BENCH_SEGMENT,
+		                            iterations / 4 + 1);
+		double bytes = tc_bench_parse(data, len, 1, iterations / 16 + 1);
+		printf("%-10s %6u %9.1f ns %9.1f ns %9.1f ns\n",
+		       tc_bench_reqs[i].name, len, whole, seg, bytes);
+	}
+	printf("(segments of %u bytes, and byte by byte, per request)\n",
+	       TC_BENCH_SEGMENT);
+	return 0;
+}
@@ -2,6 +2,7 @@
 #include <tc_tools.h>
 #include <tc_log.h>
 #include <unistd.h>
+#include <string.h>
 
 int tc_msg_queue_create(tc_msg_queue_t *queue)
 {
@@ -36,11 +37,23 @@ int tc_msg_recv(tc_msg_queue_t *queue, tc_msg_t *msg)
 	return 0;
 }
 
+uint32_t tc_msg_parse(const uint8_t *buf, uint32_t len, tc_msg_t *msg)
+{
+	if (!len || len < 1 + (uint32_t)buf[0])
+		return 0;
+	msg->len = buf[0];
+	memcpy(msg->buf, buf + 1, msg->len);
+	msg->buf[msg->len] = 0;
+	return 1 + msg->len;
+}
+
 int tc_msg_send(tc_msg_queue_t *queue, const void *buf, uint8_t len)
 {
-	if (tc_write_all(queue->fd[1], &len, 1))
-		return -1;
-	if (tc_write_all(queue->fd[1], buf, len))
+	/* A single write, atomic in the pipe for several senders */
+	uint8_t msg[256];
+	msg[0] = len;
+	memcpy(msg + 1, buf, len);
+	if (tc_write_all(queue->fd[1], msg, len + 1))
 		return -1;
 	return 0;
 }
@@ -49,6 +49,18 @@ void tc_msg_queue_close(tc_msg_queue_t *queue);
  */
 int tc_msg_recv(tc_msg_queue_t *queue, tc_msg_t *msg);
 
+/**
+ *  Get a message from the data read from a queue by other means.
+ *
+ *  \param buf  Data read from the queue.
+ *  \param len  Length of the data.
+ *  \param msg  Message to be filled.
+ *  \return The length of the message taken from the data, 0 if the
+ *          data doesn't have a complete message.
+ *  \remarks The buffer will be zero terminated.
+ */
+uint32_t tc_msg_parse(const uint8_t *buf, uint32_t len, tc_msg_t *msg);
+
 /**
  *  Send a message through a queue.
  *
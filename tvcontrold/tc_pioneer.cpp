@@ -121,6 +121,28 @@ static int tc_pioneer_parse_decn(const char *buf, uint32_t *data, uint32_t n)
 	return 0;
 }
 
+/**
+ *  Format the volume in dB from its tenths.
+ *
+ *  \param buf  Buffer to write the text into.
+ *  \param len  Length of the buffer.
+ *  \param num  Volume in tenths of dB.
+ *  \return The length of the text, as snprintf.
+ */
+static int tc_pioneer_format_volume(char *buf, uint32_t len,
+                                    const tc_cmd_env_num_t *num)
+{
+	int32_t vol_result = num->i;
+	if (vol_result == 0)
+		return snprintf(buf, len, "0.0dB");
+	else if (vol_result > 0)
+		return snprintf(buf, len, "+%u.%udB",
+		                vol_result/10, vol_result%10);
+	else
+		return snprintf(buf, len, "-%u.%udB",
+		                (-vol_result)/10, (-vol_result)%10);
+}
+
 /**
  *  Update the volume of the pioneer based on the current status
  *
@@ -128,24 +150,15 @@ static int tc_pioneer_parse_decn(const char *buf, uint32_t *data, uint32_t n)
  */
 static void tc_pioneer_update_volume(tc_pioneer_t *p)
 {
-	char vol_str[32];
-	if (p->mute_known && p->mute)
-		snprintf(vol_str, sizeof(vol_str), "mute");
-	else {
-		int32_t vol_result = p->vol;
-		vol_result -= 161;
-		vol_result *= 5;
-		if (vol_result == 0)
-			snprintf(vol_str, sizeof(vol_str), "0.0dB");
-		else if (vol_result > 0)
-			snprintf(vol_str, sizeof(vol_str), "+%u.%udB", 
-			         vol_result/10, vol_result%10);
-		else if (vol_result < 0)
-			snprintf(vol_str, sizeof(vol_str), "-%u.%udB", 
-			         (-vol_result)/10, (-vol_result)%10);
+	if (p->mute_known && p->mute) {
+		tc_cmd_env_set_handle(p->vol_env, "mute", 4);
+		return;
 	}
-	const char *name = "pioneer_volume";
-	tc_cmd_env_set(name, strlen(name), vol_str, strlen(vol_str));
+	/* The volume is kept in tenths of dB, formatted when read */
+	tc_cmd_env_num_t num;
+	num.type = TC_CMD_ENV_INT;
+	num.i = ((int32_t)p->vol - 161) * 5;
+	tc_cmd_env_set_num(p->vol_env, &num, tc_pioneer_format_volume);
 }
 
 /**
@@ -236,6 +249,27 @@ static void tc_pioneer_rx(tc_pioneer_t *p, const char *buf,
 	       strndupa(buf, len), len);
 }
 
+/**
+ *  String transmitted for a command, with its length.
+ */
+typedef struct tc_pioneer_wire_t {
+	const char *str;  /**< String transmitted, NULL if it depends on state */
+	uint32_t len;     /**< Length of the string                           */
+} tc_pioneer_wire_t;
+
+/** Declare the string of a command from a string literal */
+#define TC_PIONEER_WIRE(_str) \
+	{ sizeof(_str) > 1 ? _str : NULL, sizeof(_str) - 1 }
+
+/** Strings transmitted indexed by the TC_PIONEER_CMD_* code */
+static const tc_pioneer_wire_t tc_pioneer_wire[TC_PIONEER_CMD_COUNT] = {
+	TC_PIONEER_WIRE(""),
+	TC_PIONEER_WIRE("?P\r\n?V\r\n?M\r\n?MC\r\n"),
+#define TC_PIONEER_CMD_WIRE(_id, _words, _tx) TC_PIONEER_WIRE(_tx),
+	TC_PIONEER_CMDS(TC_PIONEER_CMD_WIRE)
+#undef TC_PIONEER_CMD_WIRE
+};
+
 /**
  *  Generate a transmission packet.
  * 
@@ -269,16 +303,12 @@ static uint32_t tc_pioneer_tx(tc_pioneer_t *p, char *buf, uint32_t len,
 	    cmd != TC_PIONEER_CMD_VOLUMEUP)
 		p->vol_accel = 0;
 
-	/* Process it */
-	const char *str = NULL;
+	/* Process the commands that depend on the state */
 	switch (cmd) {
 	case TC_PIONEER_CMD_QUERY:
-		str = "?P\r\n?V\r\n?M\r\n?MC\r\n";
 		p->mute_known = false;
 		tc_pioneer_update_volume(p);
 		break;
-	case TC_PIONEER_CMD_POWERON: str = "PO\r\n"; break;
-	case TC_PIONEER_CMD_STANDBY: str = "PF\r\n"; break;
 	case TC_PIONEER_CMD_VOLUMEUP:   
 	case TC_PIONEER_CMD_VOLUMEDOWN:  {
 		if (inctime > 0.8)
@@ -306,28 +336,16 @@ static uint32_t tc_pioneer_tx(tc_pioneer_t *p, char *buf, uint32_t len,
 		tc_pioneer_update_volume(p);
 		return snprintf(buf, len, "%03uVL\r\n", vol);
 	}
-	case TC_PIONEER_CMD_MUTEON:     str = "MO\r\n"; break;
-	case TC_PIONEER_CMD_MUTEOFF:    str = "MF\r\n"; break;
-	case TC_PIONEER_CMD_MUTE:       str = p->mute ? "MF\r\n" : "MO\r\n"; break;
-	case TC_PIONEER_CMD_MCACC1:     str = "1MC\r\n"; break;
-	case TC_PIONEER_CMD_MCACC2:     str = "2MC\r\n"; break;
-	case TC_PIONEER_CMD_MCACC3:     str = "3MC\r\n"; break;
-	case TC_PIONEER_CMD_MCACC4:     str = "4MC\r\n"; break;
-	case TC_PIONEER_CMD_MCACC5:     str = "5MC\r\n"; break;
-	case TC_PIONEER_CMD_MCACC6:     str = "6MC\r\n"; break;
-	case TC_PIONEER_CMD_LISTENMODE_STEREO:    str = "0001SR\r\n"; break;
-	case TC_PIONEER_CMD_LISTENMODE_EXTSTEREO: str = "0112SR\r\n"; break;
-	case TC_PIONEER_CMD_LISTENMODE_DIRECT:    str = "0007SR\r\n"; break;
-	case TC_PIONEER_CMD_LISTENMODE_ALC:       str = "0151SR\r\n"; break;
-	case TC_PIONEER_CMD_LISTENMODE_EXPANDED:  str = "0106SR\r\n"; break;
-	case TC_PIONEER_CMD_INPUT_TUNER:          str = "02FN\r\n"; break;
-	case TC_PIONEER_CMD_INPUT_DVD:            str = "04FN\r\n"; break;
-	case TC_PIONEER_CMD_INPUT_TV:             str = "05FN\r\n"; break;
-	case TC_PIONEER_CMD_INPUT_SAT:            str = "06FN\r\n"; break;
+	case TC_PIONEER_CMD_MUTE:
+		cmd = p->mute ? TC_PIONEER_CMD_MUTEOFF : TC_PIONEER_CMD_MUTEON;
+		break;
 	}
-	if (str) {
-		memcpy(buf, str, strlen(str));
-		return strlen(str);
+
+	/* Take the string of the command */
+	if (cmd < TC_PIONEER_CMD_COUNT && tc_pioneer_wire[cmd].str) {
+		const tc_pioneer_wire_t *w = &tc_pioneer_wire[cmd];
+		memcpy(buf, w->str, w->len);
+		return w->len;
 	}
 	return 0;
 }
@@ -473,6 +491,8 @@ int tc_pioneer_init(tc_pioneer_t *pioneer,
 	memset(pioneer, 0, sizeof(tc_pioneer_t));
 	pioneer->name = strndup(name, namelen);
 	pioneer->host = strndup(host, hostlen);
+	const char *vol_name = "pioneer_volume";
+	pioneer->vol_env = tc_cmd_env_intern(vol_name, strlen(vol_name));
 	if (pipe(pioneer->pipe)) {
 		tc_log(TC_LOG_ERR, "pioneer: Error creating the pipe");
 		return -1;
@@ -504,6 +524,8 @@ void tc_pioneer_release(tc_pioneer_t *pioneer)
 {
 	pthread_cancel(pioneer->thread);
 	pthread_join(pioneer->thread, NULL);
+	close(pioneer->pipe[0]);
+	close(pioneer->pipe[1]);
 	free((void *)pioneer->host);
 	free((void *)pioneer->name);
 }
@@ -3,6 +3,7 @@
 
 #include <pthread.h>
 #include <tc_types.h>
+#include <tc_cmd.h>
 
 /**
  *  Pioneer object to be initialized to work with the
@@ -24,6 +25,7 @@ typedef struct tc_pioneer_t {
 	bool mute;        /**< Mute status of the receiver       */
 	bool mute_known;  /**< Variable to know if mute is known */
 	uint8_t mc;       /**< Current MCACC using               */
+	tc_cmd_env_handle_t vol_env; /**< Variable with the volume */
 } tc_pioneer_t;
 
 /**
@@ -43,31 +45,44 @@ int tc_pioneer_init(tc_pioneer_t *pioneer,
                     const char *name,
                     uint32_t namelen);
 
-/* Commands to be executed through pioneer */
-#define TC_PIONEER_CMD_NONE       (0)
-#define TC_PIONEER_CMD_QUERY      (1)
-#define TC_PIONEER_CMD_POWERON    (2)
-#define TC_PIONEER_CMD_STANDBY    (3)
-#define TC_PIONEER_CMD_VOLUMEUP   (4)
-#define TC_PIONEER_CMD_VOLUMEDOWN (5)
-#define TC_PIONEER_CMD_MUTEON     (6)
-#define TC_PIONEER_CMD_MUTEOFF    (7)
-#define TC_PIONEER_CMD_MUTE       (8)
-#define TC_PIONEER_CMD_MCACC1     (9)
-#define TC_PIONEER_CMD_MCACC2     (10)
-#define TC_PIONEER_CMD_MCACC3     (11)
-#define TC_PIONEER_CMD_MCACC4     (12)
-#define TC_PIONEER_CMD_MCACC5     (13)
-#define TC_PIONEER_CMD_MCACC6     (14)
-#define TC_PIONEER_CMD_LISTENMODE_STEREO    (15)
-#define TC_PIONEER_CMD_LISTENMODE_EXTSTEREO (16)
-#define TC_PIONEER_CMD_LISTENMODE_DIRECT    (17)
-#define TC_PIONEER_CMD_LISTENMODE_ALC       (18)
-#define TC_PIONEER_CMD_LISTENMODE_EXPANDED  (19)
-#define TC_PIONEER_CMD_INPUT_TUNER      (20)
-#define TC_PIONEER_CMD_INPUT_DVD        (21)
-#define TC_PIONEER_CMD_INPUT_TV         (22)
-#define TC_PIONEER_CMD_INPUT_SAT        (23)
+/**
+ *  Commands to be executed through pioneer: identifier, words of the
+ *  command and string transmitted ("" if it depends on the state).
+ *  A new command just needs its entry here.
+ */
+#define TC_PIONEER_CMDS(X) \
+	X(POWERON,              "poweron",              "PO\r\n")     \
+	X(STANDBY,              "standby",              "PF\r\n")     \
+	X(VOLUMEUP,             "volumeup",             "")           \
+	X(VOLUMEDOWN,           "volumedown",           "")           \
+	X(MUTEON,               "muteon",               "MO\r\n")     \
+	X(MUTEOFF,              "muteoff",              "MF\r\n")     \
+	X(MUTE,                 "mute",                 "")           \
+	X(MCACC1,               "mcacc 1",              "1MC\r\n")    \
+	X(MCACC2,               "mcacc 2",              "2MC\r\n")    \
+	X(MCACC3,               "mcacc 3",              "3MC\r\n")    \
+	X(MCACC4,               "mcacc 4",              "4MC\r\n")    \
+	X(MCACC5,               "mcacc 5",              "5MC\r\n")    \
+	X(MCACC6,               "mcacc 6",              "6MC\r\n")    \
+	X(LISTENMODE_STEREO,    "listenmode stereo",    "0001SR\r\n") \
+	X(LISTENMODE_EXTSTEREO, "listenmode extstereo", "0112SR\r\n") \
+	X(LISTENMODE_DIRECT,    "listenmode direct",    "0007SR\r\n") \
+	X(LISTENMODE_ALC,       "listenmode alc",       "0151SR\r\n") \
+	X(LISTENMODE_EXPANDED,  "listenmode expanded",  "0106SR\r\n") \
+	X(INPUT_TUNER,          "input tuner",          "02FN\r\n")   \
+	X(INPUT_DVD,            "input dvd",            "04FN\r\n")   \
+	X(INPUT_TV,             "input tv",             "05FN\r\n")   \
+	X(INPUT_SAT,            "input sat",            "06FN\r\n")
+
+/** Codes of the commands to be executed through pioneer */
+enum {
+	TC_PIONEER_CMD_NONE,
+	TC_PIONEER_CMD_QUERY,
+#define TC_PIONEER_CMD_CODE(_id, _words, _tx) TC_PIONEER_CMD_##_id,
+	TC_PIONEER_CMDS(TC_PIONEER_CMD_CODE)
+#undef TC_PIONEER_CMD_CODE
+	TC_PIONEER_CMD_COUNT
+};
 
 /**
  *  Execute the commands through the pioneer.
@@ -2,139 +2,1830 @@
 #include <tc_log.h>
 #include <tc_cmd.h>
 #include <tc_msg.h>
+#include <tc_exec.h>
+#include <tc_timer.h>
+#include <tc_tools.h>
+#include <tc_http.h>
+#include <tc_uring.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
 #include <sys/poll.h>
 #include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+
+/** Maximum number of simultaneous HTTP connections */
+#define TC_SERVER_CON_MAX 256
+
+/** Size of the request buffer of every HTTP connection */
+#define TC_SERVER_CON_DATA 8192
+
+/** Milliseconds without activity before closing an HTTP connection */
+#define TC_SERVER_CON_IDLE_MS 30000
+
+/** Maximum length of the UDP messages */
+#define TC_SERVER_UDP_MAX 2048
+
+/** UDP messages received with a single call, the batches of this size
+    or more are counted together */
+#define TC_SERVER_UDP_BATCH 16
+
+/** Batches of UDP messages received in a wakeup of the poll, the rest
+    wait for the next one after the connections are served */
+#define TC_SERVER_UDP_BURST 8
+
+/** Room for the control message with the drops of the UDP socket */
+#define TC_SERVER_UDP_CTRL CMSG_SPACE(sizeof(uint32_t))
+
+/** Header line of the UDP messages to acknowledge: "#ack <client> <seq>" */
+#define TC_SERVER_ACK_HEADER "#ack "
+
+/** Clients acknowledged remembered, the least recent one is replaced */
+#define TC_SERVER_ACK_CLIENTS 32
+
+/** Sequences remembered of every client to drop the duplicates */
+#define TC_SERVER_ACK_WINDOW 32
+
+/** Descriptors polled besides the HTTP connections */
+#define TC_SERVER_FIXED_FDS 6
+
+#ifdef ENABLE_URING
+/** Entries of the submission queue of the ring */
+#define TC_SERVER_RING_ENTRIES 256
+
+/** Buffers provided to the ring for the receptions, a power of 2 */
+#define TC_SERVER_RING_BUFS 32
+
+/** Size of the buffers provided, with room for a UDP message, its
+    address and its control message */
+#define TC_SERVER_RING_BUF_SIZE 4096
+
+/** Size of the fixed buffer to read the event queue */
+#define TC_SERVER_RING_QUEUE_SIZE 4096
+
+/* Operations of the ring, in the low byte of their user data */
+#define TC_SERVER_RING_UDP    1  /**< Multishot receive of UDP messages */
+#define TC_SERVER_RING_ACCEPT 2  /**< Multishot accept of connections   */
+#define TC_SERVER_RING_QUEUE  3  /**< Read of the event queue           */
+#define TC_SERVER_RING_CONF   4  /**< Poll of the configuration changes */
+#define TC_SERVER_RING_EXEC   5  /**< Poll of the processes finished    */
+#define TC_SERVER_RING_TIMER  6  /**< Poll of the timers expired        */
+#define TC_SERVER_RING_RECV   7  /**< Receive of a connection           */
+#define TC_SERVER_RING_SEND   8  /**< Poll of a connection to send      */
+#define TC_SERVER_RING_CANCEL 9  /**< Cancel of the accept              */
+#endif /* ENABLE_URING */
+
+/** First byte of the notifications of the queue, which no event has */
+#define TC_SERVER_NOTIFY 0
+
+/* Streams of events of a connection */
+#define TC_SERVER_EVENTS_NONE 0  /**< Requests and responses         */
+#define TC_SERVER_EVENTS_SSE  1  /**< Server-Sent Events             */
+#define TC_SERVER_EVENTS_WS   2  /**< WebSocket, with commands       */
+
+/**
+ *  HTTP connection with its parse and write state.
+ */
+typedef struct tc_server_con_t {
+	int fd;                         /**< Socket of the connection         */
+	uint8_t *data;                  /**< Requests received                */
+	uint32_t len;                   /**< Length of the requests received  */
+	uint32_t used;                  /**< Length of the request answered   */
+	tc_http_t http;                 /**< Request being parsed             */
+	bool keep;                      /**< Keep the connection open         */
+	bool todo;                      /**< The response is being sent       */
+	bool queued;                    /**< Device commands still to run     */
+	uint8_t events;                 /**< TC_SERVER_EVENTS_* streamed      */
+	uint32_t version;               /**< Version of the environment sent  */
+	uint8_t *out;                   /**< Stream of the events to send     */
+	uint32_t outlen;                /**< Length of the stream             */
+	uint32_t frame;                 /**< Frame of the stream being written */
+	char head[160];                 /**< Status line and headers          */
+	const tc_cmd_env_csv_t *csv;    /**< Environment of the response      */
+	char *status;                   /**< Status of a batch, or NULL       */
+	struct iovec iov[4];            /**< Parts of the response            */
+	uint32_t iovcnt;                /**< Number of parts of the response  */
+	uint32_t index;                 /**< Part of the response being sent  */
+	uint32_t offset;                /**< Offset in the stream being sent  */
+	uint64_t active;                /**< Time of the last activity in ms  */
+	#ifdef ENABLE_URING
+	uint32_t serial;                /**< Number of the connection         */
+	bool reading;                   /**< Receive submitted to the ring    */
+	bool writing;                   /**< Poll to send submitted           */
+	#endif /* ENABLE_URING */
+} tc_server_con_t;
+
+/**
+ *  Buffers to receive a batch of UDP messages, prepared once.
+ */
+typedef struct tc_server_udp_ring_t {
+	struct mmsghdr msg[TC_SERVER_UDP_BATCH];             /**< Headers   */
+	struct iovec iov[TC_SERVER_UDP_BATCH];               /**< Buffers   */
+	struct sockaddr_in src[TC_SERVER_UDP_BATCH];         /**< Senders   */
+	uint8_t ctrl[TC_SERVER_UDP_BATCH][TC_SERVER_UDP_CTRL]; /**< Drops   */
+	char buf[TC_SERVER_UDP_BATCH][TC_SERVER_UDP_MAX + 1]; /**< Messages */
+} tc_server_udp_ring_t;
+
+/**
+ *  Counters of the UDP reception.
+ */
+typedef struct tc_server_udp_stats_t {
+	uint64_t messages;                       /**< Messages received     */
+	uint64_t batch[TC_SERVER_UDP_BATCH + 1]; /**< Batches by size       */
+	uint32_t drops;                          /**< Dropped by the socket */
+} tc_server_udp_stats_t;
+
+/**
+ *  Client of the acknowledged UDP messages, with the window of the last
+ *  sequences received.
+ */
+typedef struct tc_server_ack_t {
+	uint32_t id;                          /**< Identifier of the client  */
+	uint32_t addr;                        /**< Address of the client     */
+	uint64_t used;                        /**< Last message in ms, or 0  */
+	uint32_t top;                         /**< Highest sequence received */
+	uint32_t seen;                        /**< Bit n for top - n         */
+	const char *st[TC_SERVER_ACK_WINDOW]; /**< Status by sequence        */
+	uint32_t usec[TC_SERVER_ACK_WINDOW];  /**< Processing by sequence    */
+} tc_server_ack_t;
 
 static bool tc_server_should_exit = false;
+static bool tc_server_poll_only = false;
+static volatile bool tc_server_should_reload = false;
 static int tc_server_udp_fd = -1;
+static tc_server_udp_ring_t tc_server_udp_ring;
+static tc_server_udp_stats_t tc_server_udp_stats;
+static tc_server_ack_t tc_server_ack[TC_SERVER_ACK_CLIENTS];
 static int tc_server_tcp_fd = -1;
-static int tc_server_tcp_con = -1;
 static tc_msg_queue_t tc_server_queue = TC_MSG_QUEUE_INIT;
-static uint8_t tc_server_tcp_data[1000];
-static uint32_t tc_server_tcp_len = 0;
-static bool tc_server_tcp_response_todo = false;
-static const char *tc_server_tcp_response_data = (const char *)NULL;
-static const char *tc_server_tcp_response[3] = { NULL, NULL, NULL };
-static uint32_t tc_server_tcp_response_index = 0;
-static uint32_t tc_server_tcp_response_offset = 0;
+static tc_server_con_t tc_server_con[TC_SERVER_CON_MAX];
+static uint32_t tc_server_con_count = 0;
+static uint32_t tc_server_events_count = 0;
+static bool tc_server_events_wake = false;
+#ifdef ENABLE_URING
+static tc_uring_t tc_server_ring = TC_URING_INIT;
+static uint32_t tc_server_ring_serial = 0;
+static bool tc_server_ring_accepting = false;
+static int tc_server_ring_backlog[TC_SERVER_CON_MAX];
+static uint32_t tc_server_ring_backlog_len = 0;
+static struct msghdr tc_server_ring_msg;
+static uint32_t tc_server_ring_udp = 0;
+static uint8_t tc_server_ring_queue[TC_SERVER_RING_QUEUE_SIZE];
+static uint32_t tc_server_ring_queue_len = 0;
+#endif /* ENABLE_URING */
 
 /* Enable this to debug */
 /* #define TC_SERVER_DEBUG */
 
 /**
- *  Close the TCP connection and free the data.
+ *  Get the current time.
+ *
+ *  \return The monotonic time in milliseconds.
+ */
+static uint64_t tc_server_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ *  Add a new HTTP connection to the table.
+ *
+ *  \param fd  Socket of the connection, in non-blocking mode.
+ *  \retval -1 on error, the socket is closed.
+ *  \retval 0 on success.
  */
-static void tc_server_tcp_close(void)
+static int tc_server_con_add(int fd)
 {
-	tc_server_tcp_len = 0;
-	if (tc_server_tcp_response_data) {
-		free((void *)tc_server_tcp_response_data);
-		tc_server_tcp_response_data = NULL;
+	uint8_t *data = (uint8_t *)malloc(TC_SERVER_CON_DATA);
+	if (!data || tc_server_con_count == TC_SERVER_CON_MAX) {
+		tc_log(TC_LOG_ERR, "server: No memory for the TCP connection");
+		free(data);
+		close(fd);
+		return -1;
 	}
-	memset(tc_server_tcp_response, 0, sizeof(tc_server_tcp_response));
-	tc_server_tcp_response_index = 0;
-	tc_server_tcp_response_offset = 0;
-	tc_server_tcp_response_todo = false;
-	close(tc_server_tcp_con);
-	tc_server_tcp_con = -1;
+	/* Send the small responses and events without waiting for the ACKs */
+	int on = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	tc_server_con_t *con = &tc_server_con[tc_server_con_count++];
+	memset(con, 0, sizeof(*con));
+	con->fd = fd;
+	con->data = data;
+	tc_http_init(&con->http);
+	con->active = tc_server_now();
+	#ifdef ENABLE_URING
+	con->serial = ++tc_server_ring_serial;
+	#endif /* ENABLE_URING */
+	return 0;
 }
 
 /**
- *  Analize the HTTP header.
+ *  Close a TCP connection and free its data.
  *
- *  \param data  Data to analyze.
- *  \param len   Length of the data.
+ *  The last connection of the table is moved to its place.
+ *
+ *  \param con  Connection to close.
+ */
+static void tc_server_tcp_close(tc_server_con_t *con)
+{
+	tc_cmd_env_csv_release(con->csv);
+	free(con->status);
+	free(con->data);
+	free(con->out);
+	#ifdef ENABLE_URING
+	/* Complete the operations of the ring, that keep the socket open */
+	if (con->reading || con->writing)
+		shutdown(con->fd, SHUT_RDWR);
+	#endif /* ENABLE_URING */
+	close(con->fd);
+	if (con->events)
+		__atomic_sub_fetch(&tc_server_events_count, 1, __ATOMIC_RELEASE);
+	tc_server_con_t *last = &tc_server_con[--tc_server_con_count];
+	if (con == last)
+		return;
+	*con = *last;
+
+	/* The head of a response being sent has moved with the connection */
+	uint32_t i;
+	for (i = con->index; i < con->iovcnt; i++) {
+		char *base = (char *)con->iov[i].iov_base;
+		if (base >= last->head && base <= last->head + sizeof(last->head))
+			con->iov[i].iov_base = con->head + (base - last->head);
+	}
+}
+
+/**
+ *  Prepare the response of a TCP connection.
+ *
+ *  The body has the status of the batch, if any, and the environment,
+ *  framed with Content-Length.
+ *
+ *  \param con     Connection to answer.
+ *  \param status  Status code and reason of the response.
+ */
+static void tc_server_tcp_respond(tc_server_con_t *con, const char *status)
+{
+	uint32_t statuslen = con->status ? strlen(con->status) : 0;
+	uint32_t length = con->status ? statuslen + 1 : 0;
+	if (con->csv)
+		length += con->csv->len;
+	const char *connection = "";
+	if (!con->keep)
+		connection = "Connection: close\r\n";
+	else if (!con->http.minor)
+		connection = "Connection: keep-alive\r\n";
+	int headlen = snprintf(con->head, sizeof(con->head),
+	                       "HTTP/1.%u %s\r\nContent-Type: text/plain\r\n"
+	                       "Content-Length: %u\r\n%s\r\n",
+	                       con->http.minor, status, length, connection);
+
+	/* The environment is sent from the shared snapshot */
+	uint32_t n = 0;
+	con->todo = true;
+	con->iov[n].iov_base = con->head;
+	con->iov[n++].iov_len = headlen;
+	if (con->status) {
+		con->iov[n].iov_base = con->status;
+		con->iov[n++].iov_len = statuslen;
+		con->iov[n].iov_base = (void *)"\n";
+		con->iov[n++].iov_len = 1;
+	}
+	if (con->csv && con->csv->len) {
+		con->iov[n].iov_base = con->csv->text;
+		con->iov[n++].iov_len = con->csv->len;
+	}
+	con->iovcnt = n;
+	con->index = 0;
+}
+
+/**
+ *  Finish the response of a TCP connection, discarding its request.
+ *
+ *  \param con  Connection answered.
+ */
+static void tc_server_tcp_finish(tc_server_con_t *con)
+{
+	tc_cmd_env_csv_release(con->csv);
+	con->csv = NULL;
+	free(con->status);
+	con->status = NULL;
+	con->len -= con->used;
+	memmove(con->data, con->data + con->used, con->len);
+	con->used = 0;
+	con->todo = false;
+	con->queued = false;
+	tc_http_init(&con->http);
+}
+
+/**
+ *  Execute a batch of commands separated by new lines, in order.
+ *
+ *  The batch stops on the first command with errors, unless its first
+ *  line is "#continue". The status of every command is written as a
+ *  line with "ok", "queued" (device commands still to run), "error" or
+ *  "skipped", a tab and the command.
+ *
+ *  \param buf     Buffer with the commands.
+ *  \param len     Length of the buffer.
+ *  \param cont    Continue after a command with errors.
+ *  \param status  Status of the commands, to be freed with free.
+ *  \param queued  Set to true if any command is queued.
+ *  \retval -1 if any command has errors.
+ *  \retval 0 on success.
+ *  \retval 1 on exit command.
+ */
+static int tc_server_batch(const char *buf, uint32_t len, bool cont,
+                           char **status, bool *queued)
+{
+	uint32_t lines = 1;
+	uint32_t i;
+	for (i = 0; i < len; i++)
+		if (buf[i] == '\n')
+			lines++;
+	char *out = (char *)malloc(len + lines * 9 + 1);
+	uint32_t outlen = 0;
+	int result = 0;
+	bool first = true;
+	while (len) {
+		/* Get the next line without carriage return */
+		uint32_t l = 0;
+		while (l < len && buf[l] != '\n')
+			l++;
+		const char *line = buf;
+		uint32_t linelen = l && buf[l - 1] == '\r' ? l - 1 : l;
+		buf += l < len ? l + 1 : l;
+		len -= l < len ? l + 1 : l;
+		if (!linelen)
+			continue;
+		if (first && linelen == 9 && !memcmp(line, "#continue", 9)) {
+			cont = true;
+			continue;
+		}
+		first = false;
+
+		/* Execute it unless the batch has finished */
+		const char *st = "skipped";
+		if (!result || (result < 0 && cont)) {
+			tc_log(TC_LOG_INFO, "Command: \"%.*s\"", (int)linelen, line);
+			int r = tc_cmd(line, linelen);
+			if (r < 0) {
+				tc_log(TC_LOG_ERR, "Error in command: \"%.*s\"",
+				       (int)linelen, line);
+				result = -1;
+			} else if (r > 0)
+				result = 1;
+			st = r < 0 ? "error" : tc_cmd_queued() ? "queued" : "ok";
+			if (r >= 0 && tc_cmd_queued())
+				*queued = true;
+		}
+		outlen += sprintf(out + outlen, "%s\t", st);
+		memcpy(out + outlen, line, linelen);
+		outlen += linelen;
+		out[outlen++] = '\n';
+	}
+	out[outlen] = 0;
+	*status = out;
+	return result;
+}
+
+/**
+ *  Accept the upgrade of a request to a WebSocket, preparing the head
+ *  of the response.
+ *
+ *  \param con  Connection of the request.
+ *  \retval -1 if it isn't a valid WebSocket request.
+ *  \retval 0 on success.
+ */
+static int tc_server_ws_accept(tc_server_con_t *con)
+{
+	const tc_http_t *req = &con->http;
+	if (!req->websocket || req->keylen != 24)
+		return -1;
+
+	/* The key is answered with the hash of it and the protocol GUID */
+	char text[24 + 36];
+	memcpy(text, con->data + req->key, 24);
+	memcpy(text + 24, "258EAFA5-E914-47DA-95CA-C5AB0DC85B11", 36);
+	uint8_t digest[TC_SHA1_LEN];
+	tc_sha1(text, sizeof(text), digest);
+	char accept[(TC_SHA1_LEN + 2) / 3 * 4 + 1];
+	tc_base64(digest, TC_SHA1_LEN, accept);
+	snprintf(con->head, sizeof(con->head),
+	         "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n"
+	         "Connection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n", accept);
+	con->events = TC_SERVER_EVENTS_WS;
+	return 0;
+}
+
+/**
+ *  Analize the first HTTP request received in a connection, resuming
+ *  the parsing where the previous data ended.
+ *
+ *  The length of the request is stored in the connection as soon as it
+ *  is complete, so the next pipelined request can be analyzed after this
+ *  one has been answered.
+ *
+ *  \param con   Connection with the data to analyze.
  *  \return -1 if the data has errors.
  *  \return 0 if the data has been processed with success.
  *  \return 1 if we need more data.
  */
-static int tc_server_tcp_analyze(const uint8_t *data, uint32_t len)
+static int tc_server_tcp_analyze(tc_server_con_t *con)
 {
-	/* Check HTTP header */
-	if (len < 4)
-		return 1;
-	if (memcmp(data, "GET ", 4))
-		return -1;
-	/* Get the command */
-	char buf[257];
-	uint32_t buf_len = 0;
-	uint32_t index = 4;
-	uint32_t scape_index = 0;
-	uint8_t  scape_char = 0;
-	while (true) {
-		if (index == len)
-			return 1;
-		char c = data[index++];
-		if (c == ' ' || c == '\t' || c == '\r') {
-			if (buf_len)
-				break;
-			else
-				continue;
-		}
-		if (buf_len + 1 == sizeof(buf))
+	tc_http_t *req = &con->http;
+	int r = tc_http_parse(req, con->data, con->len, TC_SERVER_CON_DATA - 1);
+	if (r) {
+		/* The next request can't be found after errors */
+		con->keep = false;
+		return r;
+	}
+	con->keep = req->keep;
+	con->used = req->simple ? 0 : req->end;
+	const char *path = req->path;
+	/* Check if it is a batch of commands */
+	if (req->post) {
+		if (strcmp(path, "/batch") ||
+		    (req->argslen && strcmp(req->args, "continue")))
 			return -1;
-		if (scape_index) {
-			uint8_t scape_digit = 0;
-			if (c >= '0' || c <= '9')
-				scape_digit = c - '0';
-			else if (c >= 'a' || c <= 'f')
-				scape_digit = c - ('a' - 10);
-			else if (c >= 'A' || c <= 'F')
-				scape_digit = c - ('A' - 10);
-			else
-				return -1;
-			scape_char <<= 4;
-			scape_char |= scape_digit;
-			if (scape_index == 2)
-				buf[buf_len++] = scape_char;
-			continue;
-		} else if (c == '%') {
-			scape_index = 1;
-			scape_char = 0;
-			continue;
-		}
-		buf[buf_len++] = c;
+		int ret = tc_server_batch((const char *)con->data + req->body,
+		                          req->length, req->argslen, &con->status,
+		                          &con->queued);
+		if (ret > 0)
+			tc_server_exit();
+		con->csv = tc_cmd_env_csv();
+		return ret < 0 ? -1 : 0;
 	}
-	/* Execute the command */
-	buf[buf_len] = 0;
 	/* Check if it is a command */
-	if (buf_len >= 5 && !memcmp(buf, "/cmd/", 5)) {
-		char *cmd = buf + 5;
-		uint32_t cmd_len = buf_len - 5;
+	if (req->pathlen >= 5 && !memcmp(path, "/cmd/", 5)) {
+		const char *cmd = path + 5;
+		uint32_t cmd_len = req->pathlen - 5;
 		tc_log(TC_LOG_INFO, "Command: \"%s\"", cmd);
 		int ret = tc_cmd(cmd, cmd_len);
-		if (ret == 0) {
-			#ifdef TC_SERVER_DEBUG
-			tc_log(TC_LOG_DEBUG, "server: environment preparing");
-			#endif /* TC_SERVER_DEBUG */
-			tc_server_tcp_response_data = tc_cmd_env_csv();
-			#ifdef TC_SERVER_DEBUG
-			tc_log(TC_LOG_DEBUG, "server: environment prepared");
-			#endif /* TC_SERVER_DEBUG */
-			return 0;
-		}
 		if (ret < 0) {
 			tc_log(TC_LOG_ERR, "Error in command: \"%s\"", cmd);
 			return -1;
 		}
-		return 1;
-	} else if (buf_len == 5 && !memcmp(buf, "/ping", 5)) {
+		if (ret > 0)
+			tc_server_exit();
+		con->queued = tc_cmd_queued();
+		#ifdef TC_SERVER_DEBUG
+		tc_log(TC_LOG_DEBUG, "server: environment preparing");
+		#endif /* TC_SERVER_DEBUG */
+		con->csv = tc_cmd_env_csv();
+		#ifdef TC_SERVER_DEBUG
+		tc_log(TC_LOG_DEBUG, "server: environment prepared");
+		#endif /* TC_SERVER_DEBUG */
+		return 0;
+	} else if (!strcmp(path, "/ping")) {
 		#ifdef TC_SERVER_DEBUG
 		tc_log(TC_LOG_DEBUG, "server: ping");
 		#endif /* TC_SERVER_DEBUG */
-		tc_server_tcp_response_data = tc_cmd_env_csv();
+		con->csv = tc_cmd_env_csv();
+		return 0;
+	} else if (!strcmp(path, "/events") && !req->simple) {
+		snprintf(con->head, sizeof(con->head),
+		         "HTTP/1.%u 200 OK\r\nContent-Type: text/event-stream\r\n"
+		         "Cache-Control: no-cache\r\nConnection: close\r\n\r\n",
+		         req->minor);
+		con->events = TC_SERVER_EVENTS_SSE;
+		return 0;
+	} else if (!strcmp(path, "/ws") && !req->simple) {
+		return tc_server_ws_accept(con);
+	} else if (!strcmp(path, "/reload")) {
+		tc_log(TC_LOG_INFO, "Reload requested through HTTP");
+		if (tc_cmd_reload())
+			return -1;
+		con->csv = tc_cmd_env_csv();
 		return 0;
 	}
 	/* Return success */
 	return 0;
 }
 
+/**
+ *  Append a text to the stream of an events connection.
+ *
+ *  \param con   Connection streaming the events.
+ *  \param text  Text to append.
+ *  \param len   Length of the text.
+ *  \return False if the stream buffer doesn't have room.
+ */
+static bool tc_server_events_put(tc_server_con_t *con, const void *text,
+                                 uint32_t len)
+{
+	if (con->offset) {
+		con->outlen -= con->offset;
+		memmove(con->out, con->out + con->offset, con->outlen);
+		con->offset = 0;
+	}
+	if (len > TC_SERVER_CON_DATA - con->outlen)
+		return false;
+	memcpy(con->out + con->outlen, text, len);
+	con->outlen += len;
+	con->todo = true;
+	return true;
+}
+
+/**
+ *  Begin a message of the stream: an event with its type, or a text
+ *  frame beginning with the type and a tab.
+ *
+ *  \param con   Connection streaming the events.
+ *  \param type  Type of the message.
+ *  \return False if the stream buffer doesn't have room.
+ */
+static bool tc_server_events_begin(tc_server_con_t *con, const char *type)
+{
+	uint32_t len = strlen(type);
+	if (con->events == TC_SERVER_EVENTS_SSE)
+		return tc_server_events_put(con, "event: ", 7) &&
+		       tc_server_events_put(con, type, len) &&
+		       tc_server_events_put(con, "\n", 1);
+	/* The header of the frame is written at the end, with the length */
+	if (!tc_server_events_put(con, "\0\0\0\0", 4))
+		return false;
+	con->frame = con->outlen - 4;
+	return tc_server_events_put(con, type, len) &&
+	       tc_server_events_put(con, "\t", 1);
+}
+
+/**
+ *  Append a line of data to the message of the stream being written.
+ *
+ *  \param con   Connection streaming the events.
+ *  \param text  Data of the message.
+ *  \param len   Length of the data.
+ *  \return False if the stream buffer doesn't have room.
+ */
+static bool tc_server_events_data(tc_server_con_t *con, const char *text,
+                                  uint32_t len)
+{
+	if (con->events == TC_SERVER_EVENTS_WS)
+		return tc_server_events_put(con, text, len) &&
+		       tc_server_events_put(con, "\n", 1);
+	/* Server-Sent Events need a data field for every line */
+	while (true) {
+		const char *nl = (const char *)memchr(text, '\n', len);
+		uint32_t l = nl ? nl - text : len;
+		if (!tc_server_events_put(con, "data: ", 6) ||
+		    !tc_server_events_put(con, text, l) ||
+		    !tc_server_events_put(con, "\n", 1))
+			return false;
+		if (!nl)
+			return true;
+		text += l + 1;
+		len -= l + 1;
+	}
+}
+
+/**
+ *  End the message of the stream being written.
+ *
+ *  \param con  Connection streaming the events.
+ *  \return False if the stream buffer doesn't have room.
+ */
+static bool tc_server_events_end(tc_server_con_t *con)
+{
+	if (con->events == TC_SERVER_EVENTS_SSE)
+		return tc_server_events_put(con, "\n", 1);
+	/* Write the header of the text frame with the minimal length */
+	uint8_t *h = con->out + con->frame;
+	uint32_t len = con->outlen - con->frame - 4;
+	h[0] = 0x81;
+	if (len < 126) {
+		memmove(h + 2, h + 4, len);
+		con->outlen -= 2;
+		h[1] = len;
+	} else {
+		h[1] = 126;
+		h[2] = len >> 8;
+		h[3] = len;
+	}
+	return true;
+}
+
+/**
+ *  Append a line of the snapshot of the environment.
+ *
+ *  \param param  Connection streaming the events.
+ *  \param line   CSV line of the variable.
+ *  \param len    Length of the line.
+ *  \return False if the stream buffer doesn't have room.
+ */
+static bool tc_server_events_snapshot(void *param, const char *line,
+                                      uint32_t len)
+{
+	return tc_server_events_data((tc_server_con_t *)param, line, len);
+}
+
+/**
+ *  Append the message of a changed variable.
+ *
+ *  \param param  Connection streaming the events.
+ *  \param line   CSV line of the variable.
+ *  \param len    Length of the line.
+ *  \return False if the stream buffer doesn't have room.
+ */
+static bool tc_server_events_change(void *param, const char *line,
+                                    uint32_t len)
+{
+	tc_server_con_t *con = (tc_server_con_t *)param;
+	return tc_server_events_begin(con, "change") &&
+	       tc_server_events_data(con, line, len) &&
+	       tc_server_events_end(con);
+}
+
+/**
+ *  Append the variables changed since the last ones sent. While the
+ *  stream buffer doesn't have room the changes are kept, so a slow
+ *  client only receives the last value of each variable.
+ *
+ *  \param con  Connection streaming the events.
+ *  \retval -1 if the changes can't be sent, the client should be dropped.
+ *  \retval 0 on success.
+ */
+static int tc_server_events_env(tc_server_con_t *con)
+{
+	uint32_t len = con->outlen - con->offset;
+	if (!tc_cmd_env_changes(&con->version, tc_server_events_change, con))
+		return 0;
+	/* Undo the partial changes, moved to the beginning when appending */
+	con->outlen = len;
+	con->todo = len > 0;
+	return len ? 0 : -1;
+}
+
+/**
+ *  Start streaming the events through a connection, after the head of
+ *  the response and the snapshot of the environment.
+ *
+ *  \param con  Connection of the request of the events.
+ *  \retval -1 if the snapshot doesn't fit in the stream buffer.
+ *  \retval 0 on success.
+ */
+static int tc_server_events_start(tc_server_con_t *con)
+{
+	con->out = (uint8_t *)malloc(TC_SERVER_CON_DATA);
+	con->outlen = 0;
+	con->offset = 0;
+	con->version = 0;
+	con->keep = true;
+	/* Keep the frames received after the request of a WebSocket */
+	con->len -= con->used;
+	memmove(con->data, con->data + con->used, con->len);
+	con->used = 0;
+	if (con->events == TC_SERVER_EVENTS_SSE)
+		con->len = 0;
+	if (!con->out ||
+	    !tc_server_events_put(con, con->head, strlen(con->head)) ||
+	    !tc_server_events_begin(con, "snapshot") ||
+	    tc_cmd_env_changes(&con->version, tc_server_events_snapshot, con) ||
+	    !tc_server_events_end(con)) {
+		free(con->out);
+		con->out = NULL;
+		con->outlen = 0;
+		con->todo = false;
+		return -1;
+	}
+	__atomic_add_fetch(&tc_server_events_count, 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/**
+ *  Send the changes of the environment to every events connection.
+ */
+static void tc_server_events_flush(void)
+{
+	uint32_t i;
+	for (i = tc_server_con_count; i--;) {
+		tc_server_con_t *con = &tc_server_con[i];
+		if (con->events && tc_server_events_env(con)) {
+			tc_log(TC_LOG_INFO, "Events client too slow, dropped");
+			tc_server_tcp_close(con);
+		}
+	}
+}
+
+/**
+ *  Send an event of the daemon to every events connection, after the
+ *  changes of the environment. The clients without room are dropped.
+ *
+ *  \param event  Name of the event.
+ *  \param len    Length of the name.
+ */
+static void tc_server_events_send(const char *event, uint32_t len)
+{
+	uint32_t i;
+	for (i = tc_server_con_count; i--;) {
+		tc_server_con_t *con = &tc_server_con[i];
+		if (!con->events)
+			continue;
+		if (tc_server_events_env(con) ||
+		    !tc_server_events_begin(con, "event") ||
+		    !tc_server_events_data(con, event, len) ||
+		    !tc_server_events_end(con)) {
+			tc_log(TC_LOG_INFO, "Events client too slow, dropped");
+			tc_server_tcp_close(con);
+		}
+	}
+}
+
+/**
+ *  Execute the commands of a text frame as a batch, answered with the
+ *  changes of the environment and a "status" message.
+ *
+ *  \param con  Connection of the WebSocket.
+ *  \param buf  Commands, one per line.
+ *  \param len  Length of the commands.
+ *  \retval -1 if the answer doesn't fit in the stream buffer.
+ *  \retval 0 on success.
+ */
+static int tc_server_ws_command(tc_server_con_t *con, const char *buf,
+                                uint32_t len)
+{
+	char *status;
+	bool queued = false;
+	int ret = tc_server_batch(buf, len, false, &status, &queued);
+	if (ret > 0)
+		tc_server_exit();
+	uint32_t l = strlen(status);
+	int r = tc_server_events_env(con) ||
+	        !tc_server_events_begin(con, "status") ||
+	        !tc_server_events_data(con, status, l ? l - 1 : 0) ||
+	        !tc_server_events_end(con) ? -1 : 0;
+	free(status);
+	return r;
+}
+
+/**
+ *  Process the complete frames received in a WebSocket, keeping the
+ *  last one until it is complete. The messages must not be fragmented.
+ *
+ *  \param con  Connection of the WebSocket.
+ *  \retval -1 if the connection should be closed.
+ *  \retval 0 on success.
+ */
+static int tc_server_ws_frames(tc_server_con_t *con)
+{
+	uint32_t pos = 0;
+	int r = 0;
+	while (!r && con->keep) {
+		uint8_t *f = con->data + pos;
+		uint32_t avail = con->len - pos;
+		if (avail < 2)
+			break;
+		/* Get the length of the payload, masked by the client */
+		uint64_t len = f[1] & 0x7f;
+		uint32_t hlen = 2;
+		if (len == 126) {
+			if (avail < 4)
+				break;
+			len = (uint32_t)f[2] << 8 | f[3];
+			hlen = 4;
+		} else if (len == 127) {
+			if (avail < 10)
+				break;
+			len = 0;
+			uint32_t i;
+			for (i = 0; i < 8; i++)
+				len = len << 8 | f[2 + i];
+			hlen = 10;
+		}
+		hlen += 4;
+		if (!(f[1] & 0x80) || len > TC_SERVER_CON_DATA - hlen) {
+			r = -1;
+			break;
+		}
+		if (avail < hlen + len)
+			break;
+		pos += hlen + len;
+		uint8_t *mask = f + hlen - 4;
+		char *payload = (char *)f + hlen;
+		uint32_t i;
+		for (i = 0; i < len; i++)
+			payload[i] ^= mask[i & 3];
+
+		/* Process the message */
+		uint8_t opcode = f[0] & 0x0f;
+		if (!(f[0] & 0x80) || !opcode) {
+			r = -1;
+		} else if (opcode == 0x1) {
+			r = tc_server_ws_command(con, payload, len);
+		} else if (opcode == 0x9) {
+			/* Answer the ping with its payload */
+			uint8_t h[2] = { 0x8a, (uint8_t)len };
+			if (len > 125 || !tc_server_events_put(con, h, 2) ||
+			    !tc_server_events_put(con, payload, len))
+				r = -1;
+		} else if (opcode == 0x8) {
+			/* Answer the close and close when it is sent */
+			con->keep = false;
+			tc_server_events_put(con, "\x88\x02\x03\xe8", 4);
+		} else if (opcode != 0xa) {
+			r = -1;
+		}
+	}
+	con->len -= pos;
+	memmove(con->data, con->data + pos, con->len);
+	return r;
+}
+
+/**
+ *  Analyze and answer the next request received in a TCP connection.
+ *
+ *  \param con  Connection with the data received.
+ */
+static void tc_server_tcp_request(tc_server_con_t *con)
+{
+	int r = tc_server_tcp_analyze(con);
+	if (r < 0) {
+		#ifdef TC_SERVER_DEBUG
+		tc_log(TC_LOG_DEBUG, "server: tcp: parsing error");
+		#endif /* TC_SERVER_DEBUG */
+		tc_server_tcp_respond(con, "400 Bad Request");
+	} else if (r == 0 && con->events) {
+		if (tc_server_events_start(con)) {
+			tc_log(TC_LOG_ERR, "server: Environment too big for the events");
+			con->events = TC_SERVER_EVENTS_NONE;
+			con->keep = false;
+			tc_server_tcp_respond(con, "503 Service Unavailable");
+		} else if (con->len && tc_server_ws_frames(con)) {
+			con->keep = false;
+		}
+	} else if (r == 0) {
+		#ifdef TC_SERVER_DEBUG
+		tc_log(TC_LOG_DEBUG, "server: tcp: OK");
+		#endif /* TC_SERVER_DEBUG */
+		tc_server_tcp_respond(con, con->queued ? "202 Accepted" : "200 OK");
+	}
+}
+
+/**
+ *  Send the response of a TCP connection with a single system call,
+ *  continuing with the pipelined requests while the socket accepts them.
+ *
+ *  \param con  Connection with a response prepared.
+ */
+static void tc_server_tcp_send(tc_server_con_t *con)
+{
+	while (con->todo && !con->events) {
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = con->iov + con->index;
+		msg.msg_iovlen = con->iovcnt - con->index;
+		ssize_t r = sendmsg(con->fd, &msg, MSG_NOSIGNAL);
+		if (r < 0 && (errno == EAGAIN || errno == EINTR))
+			return;
+		if (r <= 0) {
+			tc_log(TC_LOG_ERR, "server: Error sending TCP");
+			tc_server_tcp_close(con);
+			return;
+		}
+		/* Skip the parts sent, waiting to send the rest */
+		while (con->index < con->iovcnt &&
+		       (size_t)r >= con->iov[con->index].iov_len)
+			r -= con->iov[con->index++].iov_len;
+		if (con->index < con->iovcnt) {
+			struct iovec *iov = &con->iov[con->index];
+			iov->iov_base = (char *)iov->iov_base + r;
+			iov->iov_len -= r;
+			return;
+		}
+		/* Continue with the pipelined requests, if kept open */
+		if (!con->keep || !con->used) {
+			tc_server_tcp_close(con);
+			return;
+		}
+		tc_server_tcp_finish(con);
+		if (con->len)
+			tc_server_tcp_request(con);
+	}
+}
+
+/**
+ *  Get where the data received in a connection should be read into.
+ *
+ *  \param con   Connection to read.
+ *  \param size  Filled with the room for the data.
+ *  \return The buffer for the data.
+ */
+static uint8_t *tc_server_con_input(tc_server_con_t *con, uint32_t *size)
+{
+	/* The data received in a SSE connection is discarded */
+	static uint8_t discard[256];
+	if (con->events == TC_SERVER_EVENTS_SSE) {
+		*size = sizeof(discard);
+		return discard;
+	}
+	/* The requests keep a byte for the zero of the batches */
+	*size = TC_SERVER_CON_DATA - con->len - (con->events ? 0 : 1);
+	return con->data + con->len;
+}
+
+/**
+ *  Process the data read into the input of a connection: the requests,
+ *  or the frames of a WebSocket.
+ *
+ *  \param con  Connection read.
+ *  \param r    Result of the read, -1 with errno on errors.
+ *  \retval false if the connection has been closed.
+ *  \retval true otherwise.
+ */
+static bool tc_server_con_received(tc_server_con_t *con, ssize_t r)
+{
+	if (con->events) {
+		bool gone = r == 0 || (r < 0 && errno != EAGAIN && errno != EINTR);
+		if (r > 0 && con->events == TC_SERVER_EVENTS_WS) {
+			con->len += r;
+			gone = tc_server_ws_frames(con) < 0;
+		}
+		if (gone) {
+			#ifdef TC_SERVER_DEBUG
+			tc_log(TC_LOG_DEBUG, "server: events: client closed");
+			#endif /* TC_SERVER_DEBUG */
+			tc_server_tcp_close(con);
+			return false;
+		}
+		return true;
+	}
+	if (r > 0) {
+		con->len += r;
+		tc_server_tcp_request(con);
+	} else if (r < 0 && (errno == EAGAIN || errno == EINTR)) {
+		return true;
+	} else if (r < 0 || con->len == TC_SERVER_CON_DATA - 1) {
+		tc_log(TC_LOG_INFO, "Error in TCP communication");
+		tc_server_tcp_close(con);
+		return false;
+	} else if (!con->len) {
+		/* Closed remotely between requests */
+		tc_server_tcp_close(con);
+		return false;
+	} else {
+		#ifdef TC_SERVER_DEBUG
+		tc_log(TC_LOG_DEBUG, "server: tcp: premature close");
+		#endif /* TC_SERVER_DEBUG */
+		/* Closed remotely */
+		con->keep = false;
+		tc_server_tcp_respond(con, "400 Bad Request");
+	}
+	return true;
+}
+
+/**
+ *  Send what remains of the stream of an events connection, with the
+ *  changes of the environment that didn't fit in it.
+ *
+ *  \param con  Connection streaming the events.
+ *  \retval false if the connection has been closed.
+ *  \retval true otherwise.
+ */
+static bool tc_server_events_write(tc_server_con_t *con)
+{
+	bool gone = false;
+	int r = send(con->fd, con->out + con->offset,
+	             con->outlen - con->offset, MSG_NOSIGNAL);
+	if (r > 0) {
+		con->offset += r;
+		if (con->offset == con->outlen) {
+			con->offset = 0;
+			con->outlen = 0;
+			con->todo = false;
+			gone = !con->keep || tc_server_events_env(con);
+		}
+	} else if (r == 0 || (errno != EAGAIN && errno != EINTR)) {
+		gone = true;
+	}
+	if (gone) {
+		#ifdef TC_SERVER_DEBUG
+		tc_log(TC_LOG_DEBUG, "server: events: client closed");
+		#endif /* TC_SERVER_DEBUG */
+		tc_server_tcp_close(con);
+		return false;
+	}
+	return true;
+}
+
+/**
+ *  Process the events polled on an events connection. A ping is sent
+ *  when idle to detect the clients gone.
+ *
+ *  \param con      Connection streaming the events.
+ *  \param revents  Events polled on its socket.
+ *  \param now      Current time in milliseconds.
+ */
+static void tc_server_events_io(tc_server_con_t *con, short revents,
+                                uint64_t now)
+{
+	bool sse = con->events == TC_SERVER_EVENTS_SSE;
+	if (!revents) {
+		if (now - con->active >= TC_SERVER_CON_IDLE_MS) {
+			con->active = now;
+			if (!tc_server_events_put(con, sse ? ":\n\n" : "\x89\x00", 3 - sse))
+				tc_server_tcp_close(con);
+		}
+		return;
+	}
+	con->active = now;
+	if (revents & (POLLIN | POLLHUP | POLLERR)) {
+		/* We have received data */
+		uint32_t size;
+		uint8_t *buf = tc_server_con_input(con, &size);
+		if (!tc_server_con_received(con, read(con->fd, buf, size)))
+			return;
+	}
+	if (con->todo && (revents & POLLOUT))
+		tc_server_events_write(con);
+}
+
+/**
+ *  Process the events polled on a TCP connection.
+ *
+ *  The connection is closed when its last response has been sent, on
+ *  errors or when it has been idle for TC_SERVER_CON_IDLE_MS.
+ *
+ *  \param con      Connection to process.
+ *  \param revents  Events polled on its socket.
+ *  \param now      Current time in milliseconds.
+ */
+static void tc_server_con_io(tc_server_con_t *con, short revents, uint64_t now)
+{
+	if (con->events) {
+		tc_server_events_io(con, revents, now);
+		return;
+	}
+	if (!revents) {
+		if (now - con->active >= TC_SERVER_CON_IDLE_MS) {
+			#ifdef TC_SERVER_DEBUG
+			tc_log(TC_LOG_DEBUG, "server: tcp: idle connection closed");
+			#endif /* TC_SERVER_DEBUG */
+			tc_server_tcp_close(con);
+		}
+		return;
+	}
+	con->active = now;
+	if (!con->todo) {
+		/* We have received TCP data */
+		uint32_t size;
+		uint8_t *buf = tc_server_con_input(con, &size);
+		if (!tc_server_con_received(con, read(con->fd, buf, size)))
+			return;
+	}
+	/* Send the response, or what remains of it */
+	tc_server_tcp_send(con);
+}
+
+/**
+ *  Get the current time with more resolution.
+ *
+ *  \return The monotonic time in microseconds.
+ */
+static uint64_t tc_server_now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ *  Parse a decimal number of 32 bits.
+ *
+ *  \param buf  Input and output parameter with the buffer.
+ *  \param end  End of the buffer.
+ *  \param v    Number to fill.
+ *  \return False if there are no digits or it overflows.
+ */
+static bool tc_server_ack_number(const char **buf, const char *end,
+                                 uint32_t *v)
+{
+	const char *b = *buf;
+	uint64_t n = 0;
+	while (b < end && *b >= '0' && *b <= '9' && n <= UINT32_MAX)
+		n = n * 10 + (*b++ - '0');
+	if (b == *buf || n > UINT32_MAX)
+		return false;
+	*buf = b;
+	*v = n;
+	return true;
+}
+
+/**
+ *  Remove the header of a UDP message to acknowledge.
+ *
+ *  \param buf  Input and output parameter with the message.
+ *  \param len  Input and output parameter with its length.
+ *  \param id   Identifier of the client to fill.
+ *  \param seq  Sequence of the message to fill.
+ *  \retval -1 if the header has errors.
+ *  \retval 0 if the message doesn't have the header.
+ *  \retval 1 if the header has been removed.
+ */
+static int tc_server_ack_parse(char **buf, uint32_t *len, uint32_t *id,
+                               uint32_t *seq)
+{
+	uint32_t hl = sizeof(TC_SERVER_ACK_HEADER) - 1;
+	if (*len < hl || memcmp(*buf, TC_SERVER_ACK_HEADER, hl))
+		return 0;
+	const char *end = (const char *)memchr(*buf, '\n', *len);
+	if (!end)
+		end = *buf + *len;
+	const char *b = *buf + hl;
+	if (!tc_server_ack_number(&b, end, id) || b == end || *b++ != ' ' ||
+	    !tc_server_ack_number(&b, end, seq))
+		return -1;
+	if (b < end && *b == '\r')
+		b++;
+	if (b != end)
+		return -1;
+	if (end < *buf + *len)
+		end++;
+	*len -= end - *buf;
+	*buf += end - *buf;
+	return 1;
+}
+
+/**
+ *  Get the client of an acknowledged message, replacing the least recent
+ *  one if it is new.
+ *
+ *  \param id   Identifier of the client.
+ *  \param src  Address of the sender.
+ *  \return The client.
+ */
+static tc_server_ack_t *tc_server_ack_client(uint32_t id,
+                                             const struct sockaddr_in *src)
+{
+	uint64_t now = tc_server_now();
+	uint32_t addr = src->sin_addr.s_addr;
+	tc_server_ack_t *lru = &tc_server_ack[0];
+	uint32_t i;
+	for (i = 0; i < TC_SERVER_ACK_CLIENTS; i++) {
+		tc_server_ack_t *c = &tc_server_ack[i];
+		if (c->used && c->id == id && c->addr == addr) {
+			c->used = now;
+			return c;
+		}
+		if (c->used < lru->used)
+			lru = c;
+	}
+	memset(lru, 0, sizeof(*lru));
+	lru->id = id;
+	lru->addr = addr;
+	lru->used = now;
+	return lru;
+}
+
+/**
+ *  Check the sequence of an acknowledged message in the window of its
+ *  client, marking it as received.
+ *
+ *  \param c    Client of the message.
+ *  \param seq  Sequence of the message.
+ *  \retval -1 if it is too old for the window.
+ *  \retval 0 if it is new.
+ *  \retval 1 if it is a duplicate.
+ */
+static int tc_server_ack_check(tc_server_ack_t *c, uint32_t seq)
+{
+	int32_t d = seq - c->top;
+	if (!c->seen || d > 0) {
+		/* Move the window up to the new sequence */
+		c->seen = c->seen && d < TC_SERVER_ACK_WINDOW ? c->seen << d : 0;
+		c->seen |= 1;
+		c->top = seq;
+		return 0;
+	}
+	uint32_t back = c->top - seq;
+	if (back >= TC_SERVER_ACK_WINDOW)
+		return -1;
+	uint32_t bit = 1u << back;
+	if (c->seen & bit)
+		return 1;
+	c->seen |= bit;
+	return 0;
+}
+
+/**
+ *  Send the answer of a UDP message: the acknowledge line, if any, and
+ *  the status of the batch with the environment, if any.
+ *
+ *  \param ack      Acknowledge line or NULL.
+ *  \param status   Status of a batch or NULL.
+ *  \param src      Address of the sender.
+ *  \param src_len  Length of the address.
+ */
+static void tc_server_udp_reply(const char *ack, const char *status,
+                                const struct sockaddr_in *src,
+                                socklen_t src_len)
+{
+	/* Sent in one datagram from the parts of the answer */
+	struct iovec iov[4];
+	uint32_t n = 0;
+	if (ack) {
+		iov[n].iov_base = (void *)ack;
+		iov[n++].iov_len = strlen(ack);
+	}
+	const tc_cmd_env_csv_t *csv = NULL;
+	if (status) {
+		csv = tc_cmd_env_csv();
+		iov[n].iov_base = (void *)status;
+		iov[n++].iov_len = strlen(status);
+		iov[n].iov_base = (void *)"\n";
+		iov[n++].iov_len = 1;
+		iov[n].iov_base = (void *)csv->text;
+		iov[n++].iov_len = csv->len;
+	}
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = (void *)src;
+	msg.msg_namelen = src_len;
+	msg.msg_iov = iov;
+	msg.msg_iovlen = n;
+	if (sendmsg(tc_server_udp_fd, &msg, 0) < 0)
+		tc_log(TC_LOG_ERR, "Error answering the UDP message");
+	if (csv)
+		tc_cmd_env_csv_release(csv);
+}
+
+/**
+ *  Execute a message received through UDP: a command, or a batch of
+ *  commands answered with the status and the environment.
+ *
+ *  The messages with the acknowledge header are answered with its line
+ *  "ack <client> <seq> <ok|queued|error> <microseconds>" before the
+ *  status of the batch. The duplicates are not executed, they are
+ *  answered again with " duplicate" at the end, and the ones older than
+ *  the window of their client with "ack <client> <seq> old".
+ *
+ *  \param buf      Message, with room for a zero after it.
+ *  \param len      Length of the message.
+ *  \param src      Address of the sender.
+ *  \param src_len  Length of the address.
+ *  \return True if the server should exit.
+ */
+static bool tc_server_udp(char *buf, uint32_t len,
+                          const struct sockaddr_in *src, socklen_t src_len)
+{
+	/* Check the acknowledge header, executing every sequence once */
+	uint64_t start = tc_server_now_us();
+	char ack[64];
+	uint32_t id = 0, seq = 0;
+	tc_server_ack_t *client = NULL;
+	int h = tc_server_ack_parse(&buf, &len, &id, &seq);
+	if (h < 0) {
+		tc_log(TC_LOG_ERR, "Invalid acknowledge header in UDP message");
+		return false;
+	} else if (h) {
+		client = tc_server_ack_client(id, src);
+		int c = tc_server_ack_check(client, seq);
+		uint32_t i = seq % TC_SERVER_ACK_WINDOW;
+		if (c < 0)
+			snprintf(ack, sizeof(ack), "ack %u %u old\n", id, seq);
+		else if (c > 0)
+			snprintf(ack, sizeof(ack), "ack %u %u %s %u duplicate\n", id,
+			         seq, client->st[i], client->usec[i]);
+		if (c) {
+			tc_server_udp_reply(ack, NULL, src, src_len);
+			return false;
+		}
+	}
+
+	char *status = NULL;
+	bool queued = false;
+	int ret;
+	if (memchr(buf, '\n', len)) {
+		/* Batch of commands, answered with the status */
+		ret = tc_server_batch(buf, len, false, &status, &queued);
+	} else {
+		buf[len] = 0;
+		tc_log(TC_LOG_INFO, "Command: \"%s\"", buf);
+		ret = tc_cmd(buf, len);
+		if (ret < 0)
+			tc_log(TC_LOG_ERR, "Error in command: \"%s\"", buf);
+		queued = tc_cmd_queued();
+	}
+	if (client) {
+		uint32_t i = seq % TC_SERVER_ACK_WINDOW;
+		client->st[i] = ret < 0 ? "error" : queued ? "queued" : "ok";
+		client->usec[i] = tc_server_now_us() - start;
+		snprintf(ack, sizeof(ack), "ack %u %u %s %u\n", id, seq,
+		         client->st[i], client->usec[i]);
+	}
+	if (client || status)
+		tc_server_udp_reply(client ? ack : NULL, status, src, src_len);
+	free(status);
+	return ret > 0;
+}
+
+/**
+ *  Count the messages dropped by the UDP socket, reported with
+ *  SO_RXQ_OVFL in the control message of every message received.
+ *
+ *  \param msg  Header of a message received, with its control message.
+ */
+static void tc_server_udp_overflow(struct msghdr *msg)
+{
+	struct cmsghdr *c;
+	for (c = CMSG_FIRSTHDR(msg); c; c = CMSG_NXTHDR(msg, c)) {
+		if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SO_RXQ_OVFL)
+			continue;
+		uint32_t drops;
+		memcpy(&drops, CMSG_DATA(c), sizeof(drops));
+		if (drops != tc_server_udp_stats.drops)
+			tc_log(TC_LOG_WARN, "UDP: %u messages dropped by the socket",
+			       drops - tc_server_udp_stats.drops);
+		tc_server_udp_stats.drops = drops;
+	}
+}
+
+/**
+ *  Count a batch of UDP messages received at once.
+ *
+ *  \param n  Number of messages of the batch.
+ */
+static void tc_server_udp_count(uint32_t n)
+{
+	tc_server_udp_stats.messages += n;
+	tc_server_udp_stats.batch[n < TC_SERVER_UDP_BATCH ? n :
+	                          TC_SERVER_UDP_BATCH]++;
+	#ifdef TC_SERVER_DEBUG
+	tc_log(TC_LOG_DEBUG, "UDP: batch of %u messages", n);
+	#endif /* TC_SERVER_DEBUG */
+}
+
+/**
+ *  Prepare the buffers of the batches of UDP messages and ask the socket
+ *  for its drops.
+ */
+static void tc_server_udp_init(void)
+{
+	tc_server_udp_ring_t *u = &tc_server_udp_ring;
+	memset(u, 0, sizeof(*u));
+	uint32_t i;
+	for (i = 0; i < TC_SERVER_UDP_BATCH; i++) {
+		u->iov[i].iov_base = u->buf[i];
+		u->iov[i].iov_len = TC_SERVER_UDP_MAX;
+		u->msg[i].msg_hdr.msg_name = &u->src[i];
+		u->msg[i].msg_hdr.msg_iov = &u->iov[i];
+		u->msg[i].msg_hdr.msg_iovlen = 1;
+		u->msg[i].msg_hdr.msg_control = u->ctrl[i];
+	}
+	memset(&tc_server_udp_stats, 0, sizeof(tc_server_udp_stats));
+	int on = 1;
+	if (setsockopt(tc_server_udp_fd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)))
+		tc_log(TC_LOG_WARN, "UDP drops are not counted");
+}
+
+/**
+ *  Receive and execute the UDP messages waiting in the socket, in
+ *  batches received with a single call.
+ *
+ *  \return True if the server should exit.
+ */
+static bool tc_server_udp_drain(void)
+{
+	tc_server_udp_ring_t *u = &tc_server_udp_ring;
+	uint32_t b;
+	for (b = 0; b < TC_SERVER_UDP_BURST; b++) {
+		uint32_t i;
+		for (i = 0; i < TC_SERVER_UDP_BATCH; i++) {
+			u->msg[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+			u->msg[i].msg_hdr.msg_controllen = TC_SERVER_UDP_CTRL;
+		}
+		int n = recvmmsg(tc_server_udp_fd, u->msg, TC_SERVER_UDP_BATCH,
+		                 MSG_DONTWAIT, NULL);
+		if (n <= 0)
+			return false;
+		tc_server_udp_count(n);
+		tc_server_udp_overflow(&u->msg[n - 1].msg_hdr);
+		for (i = 0; i < (uint32_t)n; i++) {
+			struct msghdr *h = &u->msg[i].msg_hdr;
+			if (u->msg[i].msg_len &&
+			    tc_server_udp(u->buf[i], u->msg[i].msg_len, &u->src[i],
+			                  h->msg_namelen))
+				return true;
+		}
+		if (n < TC_SERVER_UDP_BATCH)
+			return false;
+	}
+	return false;
+}
+
+/**
+ *  Log the counters of the UDP reception.
+ */
+static void tc_server_udp_stats_log(void)
+{
+	tc_server_udp_stats_t *st = &tc_server_udp_stats;
+	char text[512];
+	int l = snprintf(text, sizeof(text), "UDP: %llu messages, %u dropped",
+	                 (unsigned long long)st->messages, st->drops);
+	uint32_t i;
+	for (i = 1; i <= TC_SERVER_UDP_BATCH && l < (int)sizeof(text); i++) {
+		if (st->batch[i])
+			l += snprintf(text + l, sizeof(text) - l, ", %u%s: %llu", i,
+			              i == TC_SERVER_UDP_BATCH ? "+" : "",
+			              (unsigned long long)st->batch[i]);
+	}
+	tc_log(TC_LOG_INFO, "%s", text);
+}
+
+/**
+ *  Process an event received through the queue.
+ *
+ *  \param msg  Event received, an empty one to send the changes of the
+ *              environment or a notification of a variable changed.
+ *  \return True if the server should exit.
+ */
+static bool tc_server_queue_event(const tc_msg_t *msg)
+{
+	/* Wake up to send the changes of the environment */
+	if (!msg->len) {
+		__atomic_store_n(&tc_server_events_wake, false, __ATOMIC_RELEASE);
+		tc_server_events_flush();
+		return false;
+	}
+	/* Execute the script subscribed to a variable changed */
+	if (msg->buf[0] == TC_SERVER_NOTIFY) {
+		uint32_t handle;
+		if (msg->len != 1 + sizeof(handle))
+			return false;
+		memcpy(&handle, msg->buf + 1, sizeof(handle));
+		return tc_cmd_env_notified(handle) > 0;
+	}
+	/* Stream the daemon events */
+	if (tc_server_events_count)
+		tc_server_events_send((const char *)msg->buf, msg->len);
+	/* Execute the event */
+	tc_log(TC_LOG_INFO, "Event: \"%s\"", msg->buf);
+	int ret = tc_cmd((const char *)msg->buf, msg->len);
+	if (ret < 0)
+		tc_log(TC_LOG_ERR, "Error in event: \"%s\"", msg->buf);
+	return ret > 0;
+}
+
+#ifdef ENABLE_URING
+/**
+ *  Submit an operation of the ring not bound to a connection.
+ *
+ *  \param op  TC_SERVER_RING_* operation.
+ */
+static void tc_server_ring_arm(uint8_t op)
+{
+	tc_uring_t *ring = &tc_server_ring;
+	struct io_uring_sqe *sqe;
+	switch (op) {
+	case TC_SERVER_RING_UDP:
+		/* The messages are received with their address into a buffer
+		   selected by the kernel */
+		sqe = tc_uring_sqe(ring, IORING_OP_RECVMSG, tc_server_udp_fd, op);
+		sqe->addr = (uintptr_t)&tc_server_ring_msg;
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = TC_URING_BUF_GROUP;
+		break;
+	case TC_SERVER_RING_ACCEPT:
+		sqe = tc_uring_sqe(ring, IORING_OP_ACCEPT, tc_server_tcp_fd, op);
+		sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+		sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+		tc_server_ring_accepting = true;
+		break;
+	case TC_SERVER_RING_QUEUE:
+		sqe = tc_uring_sqe(ring, IORING_OP_READ_FIXED,
+		                   TC_MSG_QUEUE_POLLFD(&tc_server_queue), op);
+		sqe->addr = (uintptr_t)(tc_server_ring_queue + tc_server_ring_queue_len);
+		sqe->len = TC_SERVER_RING_QUEUE_SIZE - tc_server_ring_queue_len;
+		sqe->off = (uint64_t)-1;
+		sqe->buf_index = 0;
+		break;
+	case TC_SERVER_RING_CONF:
+	case TC_SERVER_RING_EXEC:
+	case TC_SERVER_RING_TIMER:
+		sqe = tc_uring_sqe(ring, IORING_OP_POLL_ADD,
+		                   op == TC_SERVER_RING_CONF ? tc_cmd_watch_fd() :
+		                   op == TC_SERVER_RING_EXEC ? tc_exec_fd() :
+		                   tc_timer_fd(), op);
+		sqe->poll32_events = POLLIN;
+		sqe->len = IORING_POLL_ADD_MULTI;
+		break;
+	case TC_SERVER_RING_CANCEL:
+		sqe = tc_uring_sqe(ring, IORING_OP_ASYNC_CANCEL, -1, op);
+		sqe->addr = TC_SERVER_RING_ACCEPT;
+		break;
+	}
+}
+
+/**
+ *  Submit the receive or the poll to send of a connection.
+ *
+ *  \param con  Connection of the operation.
+ *  \param op   TC_SERVER_RING_RECV or TC_SERVER_RING_SEND.
+ */
+static void tc_server_ring_con_arm(tc_server_con_t *con, uint8_t op)
+{
+	uint64_t user_data = op | (uint64_t)(con - tc_server_con) << 8 |
+	                     (uint64_t)con->serial << 32;
+	struct io_uring_sqe *sqe;
+	if (op == TC_SERVER_RING_RECV) {
+		/* Received into a buffer of the kernel, as the connection can
+		   be closed while waiting, with the room it has */
+		uint32_t size;
+		tc_server_con_input(con, &size);
+		sqe = tc_uring_sqe(&tc_server_ring, IORING_OP_RECV, con->fd,
+		                   user_data);
+		sqe->len = size;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = TC_URING_BUF_GROUP;
+		con->reading = true;
+	} else {
+		sqe = tc_uring_sqe(&tc_server_ring, IORING_OP_POLL_ADD, con->fd,
+		                   user_data);
+		sqe->poll32_events = POLLOUT;
+		con->writing = true;
+	}
+}
+
+/**
+ *  Get the connection of an operation of the ring.
+ *
+ *  \param user_data  User data of the operation.
+ *  \retval NULL if the connection has been closed.
+ *  \retval The connection.
+ */
+static tc_server_con_t *tc_server_ring_con(uint64_t user_data)
+{
+	uint32_t serial = user_data >> 32;
+	uint32_t i = (user_data >> 8) & 0xffffff;
+	if (i < tc_server_con_count && tc_server_con[i].serial == serial)
+		return &tc_server_con[i];
+	/* It may have been moved by the close of another one */
+	for (i = 0; i < tc_server_con_count; i++)
+		if (tc_server_con[i].serial == serial)
+			return &tc_server_con[i];
+	return NULL;
+}
+
+/**
+ *  Process a completion of the ring.
+ *
+ *  \param cqe  Completion to process.
+ *  \param now  Current time in milliseconds.
+ */
+static void tc_server_ring_complete(const struct io_uring_cqe *cqe,
+                                    uint64_t now)
+{
+	tc_uring_t *ring = &tc_server_ring;
+	uint8_t op = cqe->user_data & 0xff;
+	bool more = cqe->flags & IORING_CQE_F_MORE;
+	switch (op) {
+	case TC_SERVER_RING_UDP:
+		if (cqe->flags & IORING_CQE_F_BUFFER) {
+			/* The buffer has the header, the address, the control
+			   message and the message */
+			uint8_t *buf = tc_uring_buffer(ring, cqe);
+			const struct io_uring_recvmsg_out *out =
+				(const struct io_uring_recvmsg_out *)buf;
+			uint32_t name = sizeof(*out);
+			uint32_t ctrl = name + sizeof(struct sockaddr_in);
+			uint32_t head = ctrl + TC_SERVER_UDP_CTRL;
+			struct sockaddr_in src;
+			memcpy(&src, buf + name, sizeof(src));
+			struct msghdr h;
+			memset(&h, 0, sizeof(h));
+			h.msg_control = buf + ctrl;
+			h.msg_controllen = out->controllen;
+			tc_server_udp_overflow(&h);
+			tc_server_ring_udp++;
+			uint32_t len = cqe->res > (int)head ? cqe->res - head : 0;
+			if (len > TC_SERVER_UDP_MAX)
+				len = TC_SERVER_UDP_MAX;
+			if (len && tc_server_udp((char *)buf + head, len, &src,
+			                         out->namelen))
+				tc_server_exit();
+			tc_uring_buffer_put(ring, cqe);
+		}
+		if (!more)
+			tc_server_ring_arm(op);
+		break;
+	case TC_SERVER_RING_ACCEPT:
+		/* Several connections are accepted at once, the ones without
+		   room wait as they would in the backlog of the socket */
+		if (cqe->res >= 0 && (tc_server_ring_backlog_len ||
+		                      tc_server_con_count == TC_SERVER_CON_MAX)) {
+			if (tc_server_ring_backlog_len < TC_SERVER_CON_MAX) {
+				tc_server_ring_backlog[tc_server_ring_backlog_len++] = cqe->res;
+			} else {
+				tc_log(TC_LOG_ERR, "server: Too many TCP connections");
+				close(cqe->res);
+			}
+		} else if (cqe->res >= 0 && !tc_server_con_add(cqe->res)) {
+			#ifdef TC_SERVER_DEBUG
+			tc_log(TC_LOG_DEBUG, "TCP connection established");
+			#endif /* TC_SERVER_DEBUG */
+		}
+		/* Accept again when there is room for the connections */
+		if (!more)
+			tc_server_ring_accepting = false;
+		else if (tc_server_con_count == TC_SERVER_CON_MAX)
+			tc_server_ring_arm(TC_SERVER_RING_CANCEL);
+		break;
+	case TC_SERVER_RING_QUEUE: {
+		if (cqe->res <= 0) {
+			tc_log(TC_LOG_ERR, "server: Error reading from event pipe");
+			tc_server_exit();
+			break;
+		}
+		/* Process the complete events, keeping the last one if not */
+		tc_server_ring_queue_len += cqe->res;
+		uint32_t pos = 0;
+		uint32_t n;
+		tc_msg_t msg;
+		while (!tc_server_should_exit &&
+		       (n = tc_msg_parse(tc_server_ring_queue + pos,
+		                         tc_server_ring_queue_len - pos, &msg))) {
+			pos += n;
+			if (tc_server_queue_event(&msg))
+				tc_server_exit();
+		}
+		tc_server_ring_queue_len -= pos;
+		memmove(tc_server_ring_queue, tc_server_ring_queue + pos,
+		        tc_server_ring_queue_len);
+		tc_server_ring_arm(op);
+		break;
+	}
+	case TC_SERVER_RING_CONF:
+		/* The configuration files have changed */
+		if (tc_cmd_watch_changed())
+			tc_cmd_reload();
+		if (!more)
+			tc_server_ring_arm(op);
+		break;
+	case TC_SERVER_RING_EXEC:
+		/* Some process has finished */
+		tc_exec_reap();
+		if (!more)
+			tc_server_ring_arm(op);
+		break;
+	case TC_SERVER_RING_TIMER:
+		/* Some timer has expired */
+		if (tc_timer_expire())
+			tc_server_exit();
+		if (!more)
+			tc_server_ring_arm(op);
+		break;
+	case TC_SERVER_RING_RECV: {
+		tc_server_con_t *con = tc_server_ring_con(cqe->user_data);
+		ssize_t r = cqe->res;
+		if (con && r > 0) {
+			/* The room of the connection is kept while receiving */
+			uint32_t size;
+			uint8_t *buf = tc_server_con_input(con, &size);
+			memcpy(buf, tc_uring_buffer(ring, cqe), r);
+		}
+		if (cqe->flags & IORING_CQE_F_BUFFER)
+			tc_uring_buffer_put(ring, cqe);
+		if (!con)
+			break;
+		con->reading = false;
+		if (r == -ENOBUFS) {
+			/* Received again when the buffers are given back */
+			break;
+		}
+		if (r < 0) {
+			errno = -r;
+			r = -1;
+		}
+		con->active = now;
+		if (!tc_server_con_received(con, r))
+			break;
+		/* Send the response, or the answer of the WebSocket */
+		if (!con->events)
+			tc_server_tcp_send(con);
+		else if (con->todo)
+			tc_server_events_write(con);
+		break;
+	}
+	case TC_SERVER_RING_SEND: {
+		tc_server_con_t *con = tc_server_ring_con(cqe->user_data);
+		if (!con)
+			break;
+		con->writing = false;
+		con->active = now;
+		if (!con->events)
+			tc_server_tcp_send(con);
+		else if (con->todo)
+			tc_server_events_write(con);
+		break;
+	}
+	}
+}
+
+/**
+ *  Execute the server with io_uring: the sockets and the event queue
+ *  are received through the ring, without polling every descriptor in
+ *  every iteration.
+ *
+ *  \retval -1 if the ring is not available, the server hasn't started.
+ *  \retval 0 when the server has finished.
+ */
+static int tc_server_ring_exec(void)
+{
+	tc_uring_t *ring = &tc_server_ring;
+	if (tc_uring_init(ring, TC_SERVER_RING_ENTRIES))
+		return -1;
+	if (tc_uring_buffers(ring, TC_SERVER_RING_BUFS, TC_SERVER_RING_BUF_SIZE) ||
+	    tc_uring_fixed(ring, tc_server_ring_queue, sizeof(tc_server_ring_queue))) {
+		tc_uring_release(ring);
+		return -1;
+	}
+	tc_log(TC_LOG_INFO, "Serving through io_uring");
+	memset(&tc_server_ring_msg, 0, sizeof(tc_server_ring_msg));
+	tc_server_ring_msg.msg_namelen = sizeof(struct sockaddr_in);
+	tc_server_ring_msg.msg_controllen = TC_SERVER_UDP_CTRL;
+	tc_server_ring_arm(TC_SERVER_RING_UDP);
+	tc_server_ring_arm(TC_SERVER_RING_QUEUE);
+	if (tc_cmd_watch_fd() >= 0)
+		tc_server_ring_arm(TC_SERVER_RING_CONF);
+	if (tc_exec_fd() >= 0)
+		tc_server_ring_arm(TC_SERVER_RING_EXEC);
+	if (tc_timer_fd() >= 0)
+		tc_server_ring_arm(TC_SERVER_RING_TIMER);
+
+	while (!tc_server_should_exit) {
+		/* Receive and send through the connections until the first
+		   one becomes idle */
+		uint32_t i;
+		for (i = 0; i < tc_server_ring_backlog_len &&
+		            tc_server_con_count < TC_SERVER_CON_MAX; i++)
+			tc_server_con_add(tc_server_ring_backlog[i]);
+		tc_server_ring_backlog_len -= i;
+		memmove(tc_server_ring_backlog, tc_server_ring_backlog + i,
+		        tc_server_ring_backlog_len * sizeof(int));
+		if (!tc_server_ring_accepting && !tc_server_ring_backlog_len &&
+		    tc_server_con_count < TC_SERVER_CON_MAX)
+			tc_server_ring_arm(TC_SERVER_RING_ACCEPT);
+		uint64_t now = tc_server_now();
+		int timeout = -1;
+		for (i = tc_server_con_count; i--;) {
+			tc_server_con_t *con = &tc_server_con[i];
+			if (!con->reading && (con->events || !con->todo)) {
+				/* A full request can't be received */
+				uint32_t size;
+				tc_server_con_input(con, &size);
+				if (!size) {
+					tc_server_con_received(con, 0);
+					continue;
+				}
+				tc_server_ring_con_arm(con, TC_SERVER_RING_RECV);
+			}
+			if (!con->writing && con->todo)
+				tc_server_ring_con_arm(con, TC_SERVER_RING_SEND);
+			uint64_t idle = now - con->active;
+			int left = idle < TC_SERVER_CON_IDLE_MS ?
+			           TC_SERVER_CON_IDLE_MS - idle : 0;
+			if (timeout < 0 || left < timeout)
+				timeout = left;
+		}
+		tc_uring_wait(ring, timeout);
+		if (tc_server_should_reload) {
+			/* Reload requested by a signal */
+			tc_server_should_reload = false;
+			tc_cmd_reload();
+		}
+
+		/* Process the completions, and then the idle connections */
+		now = tc_server_now();
+		struct io_uring_cqe *cqe;
+		while (!tc_server_should_exit && (cqe = tc_uring_cqe(ring))) {
+			tc_server_ring_complete(cqe, now);
+			tc_uring_cqe_seen(ring);
+		}
+		if (tc_server_ring_udp) {
+			tc_server_udp_count(tc_server_ring_udp);
+			tc_server_ring_udp = 0;
+		}
+		now = tc_server_now();
+		for (i = tc_server_con_count; i--;)
+			if (now - tc_server_con[i].active >= TC_SERVER_CON_IDLE_MS)
+				tc_server_con_io(&tc_server_con[i], 0, now);
+	}
+	tc_uring_release(ring);
+	while (tc_server_ring_backlog_len)
+		close(tc_server_ring_backlog[--tc_server_ring_backlog_len]);
+	return 0;
+}
+#endif /* ENABLE_URING */
+
 void tc_server_release(void)
 {
 	if (tc_server_udp_fd != -1) {
+		tc_server_udp_stats_log();
 		close(tc_server_udp_fd);
 		tc_server_udp_fd = -1;
 	}
@@ -142,8 +1833,8 @@ void tc_server_release(void)
 		close(tc_server_tcp_fd);
 		tc_server_tcp_fd = -1;
 	}
-	if (tc_server_tcp_con != -1)
-		tc_server_tcp_close();
+	while (tc_server_con_count)
+		tc_server_tcp_close(&tc_server_con[0]);
 	tc_msg_queue_close(&tc_server_queue);
 }
 
@@ -155,8 +1846,10 @@ int tc_server_init(void)
 		tc_log(TC_LOG_ERR, "Error creating UDP server socket");
 		return -1;
 	}
-	tc_server_tcp_fd = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
-	if (tc_server_udp_fd == -1) {
+	tc_server_udp_init();
+	tc_server_tcp_fd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK |
+	                          SOCK_CLOEXEC, IPPROTO_TCP);
+	if (tc_server_tcp_fd == -1) {
 		tc_log(TC_LOG_ERR, "Error creating TCP server socket");
 		return -1;
 	}
@@ -166,6 +1859,8 @@ int tc_server_init(void)
 	addr.sin_family = AF_INET;
 	addr.sin_port = htons(1423);
 	addr.sin_addr.s_addr = INADDR_ANY;
+	int on = 1;
+	setsockopt(tc_server_tcp_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
 	int r = bind(tc_server_udp_fd, (struct sockaddr *)&addr, sizeof(addr));
 	if (r) {
 		tc_log(TC_LOG_ERR, "Error binding UDP server socket");
@@ -178,7 +1873,7 @@ int tc_server_init(void)
 		tc_server_release();
 		return -1;
 	}
-	r = listen(tc_server_tcp_fd, 10);
+	r = listen(tc_server_tcp_fd, SOMAXCONN);
 	if (r) {
 		tc_log(TC_LOG_ERR, "Error listening TCP server socket");
 		tc_server_release();
@@ -197,21 +1892,28 @@ int tc_server_init(void)
 
 void tc_server_exec(void)
 {
+	#ifdef ENABLE_URING
+	if (!tc_server_poll_only && !tc_server_ring_exec())
+		return;
+	tc_log(TC_LOG_INFO, "Serving through poll");
+	#endif /* ENABLE_URING */
+
 	/* Wait for anything to be received */
 	while (!tc_server_should_exit) {
 		/* Check if there is any reception event */
-		struct pollfd fds[4];
-		memset(fds, 0, sizeof(fds));
+		struct pollfd fds[TC_SERVER_FIXED_FDS + TC_SERVER_CON_MAX];
 		uint32_t fdn = 0;
 		struct pollfd *fd_udp = NULL;
 		struct pollfd *fd_tcp = NULL;
 		struct pollfd *fd_queue = NULL;
-		struct pollfd *fd_tcp_con = NULL;
+		struct pollfd *fd_conf = NULL;
+		struct pollfd *fd_exec = NULL;
+		struct pollfd *fd_timer = NULL;
 		fds[fdn].fd = tc_server_udp_fd;
 		fds[fdn].events = POLLIN;
 		fd_udp = &fds[fdn];
 		fdn++;
-		if (tc_server_tcp_con == -1) {
+		if (tc_server_con_count < TC_SERVER_CON_MAX) {
 			fds[fdn].fd = tc_server_tcp_fd;
 			fds[fdn].events = POLLIN;
 			fd_tcp = &fds[fdn];
@@ -221,107 +1923,89 @@ void tc_server_exec(void)
 		fds[fdn].events = POLLIN;
 		fd_queue = &fds[fdn];
 		fdn++;
-		if (tc_server_tcp_con >= 0) {
-			fds[fdn].fd = tc_server_tcp_con;
-			fds[fdn].events = tc_server_tcp_response_todo ? POLLOUT : POLLIN;
-			fd_tcp_con = &fds[fdn];
+		if (tc_cmd_watch_fd() >= 0) {
+			fds[fdn].fd = tc_cmd_watch_fd();
+			fds[fdn].events = POLLIN;
+			fd_conf = &fds[fdn];
+			fdn++;
+		}
+		if (tc_exec_fd() >= 0) {
+			fds[fdn].fd = tc_exec_fd();
+			fds[fdn].events = POLLIN;
+			fd_exec = &fds[fdn];
 			fdn++;
 		}
-		int r = poll(fds, fdn, -1);
+		if (tc_timer_fd() >= 0) {
+			fds[fdn].fd = tc_timer_fd();
+			fds[fdn].events = POLLIN;
+			fd_timer = &fds[fdn];
+			fdn++;
+		}
+		/* Poll the connections until the first one becomes idle */
+		struct pollfd *fd_con = &fds[fdn];
+		uint32_t con_count = tc_server_con_count;
+		uint64_t now = tc_server_now();
+		int timeout = -1;
+		uint32_t i;
+		for (i = 0; i < con_count; i++) {
+			tc_server_con_t *con = &tc_server_con[i];
+			fds[fdn].fd = con->fd;
+			if (con->events)
+				fds[fdn].events = POLLIN | (con->todo ? POLLOUT : 0);
+			else
+				fds[fdn].events = con->todo ? POLLOUT : POLLIN;
+			fdn++;
+			uint64_t idle = now - con->active;
+			int left = idle < TC_SERVER_CON_IDLE_MS ?
+			           TC_SERVER_CON_IDLE_MS - idle : 0;
+			if (timeout < 0 || left < timeout)
+				timeout = left;
+		}
+		for (i = 0; i < fdn; i++)
+			fds[i].revents = 0;
+		int r = poll(fds, fdn, timeout);
+		if (tc_server_should_reload) {
+			/* Reload requested by a signal */
+			tc_server_should_reload = false;
+			tc_cmd_reload();
+			continue;
+		}
 		if (fd_udp && fd_udp->revents & POLLIN) {
-			/* We have received a message from UDP */
-			struct sockaddr_in src;
-			socklen_t src_len = sizeof(src);
-			char buf[257];
-			ssize_t r = recvfrom(tc_server_udp_fd, buf, sizeof(buf)-1,
-			                     0, (struct sockaddr *)&src, &src_len);
-			if (r > 0) {
-				buf[r] = 0;
-				tc_log(TC_LOG_INFO, "Command: \"%s\"", buf);
-				int ret = tc_cmd(buf, r);
-				if (ret > 0)
-					break;
-				if (ret < 0)
-					tc_log(TC_LOG_ERR, "Error in command: \"%s\"", buf);
-			}
+			/* We have received messages from UDP, maybe a burst */
+			if (tc_server_udp_drain())
+				break;
 		}
+		/* Process the connections, the closed ones are replaced by the
+		   last ones, already processed */
+		now = tc_server_now();
+		for (i = con_count; i--;)
+			tc_server_con_io(&tc_server_con[i], r > 0 ? fd_con[i].revents : 0,
+			                 now);
 		if (fd_tcp && fd_tcp->revents & POLLIN) {
-			/* We have received a TCP connection */
-			struct sockaddr_in src;
-			socklen_t src_len = sizeof(src);
-			int r = accept(tc_server_tcp_fd, (struct sockaddr *)&src, &src_len);
-			if (r >= 0) {
-				tc_server_tcp_con = r;
-				tc_server_tcp_response_todo = false;
+			/* We have received TCP connections */
+			while (tc_server_con_count < TC_SERVER_CON_MAX) {
+				int r = accept4(tc_server_tcp_fd, NULL, NULL,
+				                SOCK_NONBLOCK | SOCK_CLOEXEC);
+				if (r < 0 || tc_server_con_add(r))
+					break;
 				#ifdef TC_SERVER_DEBUG
 				tc_log(TC_LOG_DEBUG, "TCP connection established");
 				#endif /* TC_SERVER_DEBUG */
 			}
 		}
-		if (fd_tcp_con && !tc_server_tcp_response_todo &&
-		    (fd_tcp_con->revents & POLLIN)) {
-			/* We have received TCP data */
-			int r = read(tc_server_tcp_con, 
-			             tc_server_tcp_data + tc_server_tcp_len,
-			             sizeof(tc_server_tcp_data) - tc_server_tcp_len - 1);
-			if (r > 0) {
-				tc_server_tcp_len += r;
-				int r = tc_server_tcp_analyze(tc_server_tcp_data, tc_server_tcp_len);
-				if (r < 0) {
-					#ifdef TC_SERVER_DEBUG
-					tc_log(TC_LOG_DEBUG, "server: tcp: parsing error");
-					#endif /* TC_SERVER_DEBUG */
-					tc_server_tcp_response_todo = true;
-					tc_server_tcp_response[0] = "HTTP/1.0 400 Bad Request\r\n\r\n";
-					tc_server_tcp_response[1] = tc_server_tcp_response_data;
-					tc_server_tcp_response[2] = NULL;
-					tc_server_tcp_response_index = 0;
-					tc_server_tcp_response_offset = 0;
-				} else if (r == 0) {
-					#ifdef TC_SERVER_DEBUG
-					tc_log(TC_LOG_DEBUG, "server: tcp: OK");
-					#endif /* TC_SERVER_DEBUG */
-					tc_server_tcp_response_todo = true;
-					tc_server_tcp_response[0] = "HTTP/1.0 200 OK\r\n\r\n";
-					tc_server_tcp_response[1] = tc_server_tcp_response_data;
-					tc_server_tcp_response[2] = NULL;
-					tc_server_tcp_response_index = 0;
-					tc_server_tcp_response_offset = 0;
-				}
-			} else if (r < 0 || tc_server_tcp_len == sizeof(tc_server_tcp_data)-1) {
-				tc_log(TC_LOG_INFO, "Error in TCP communication");
-				tc_server_tcp_close();
-			} else if (r == 0) {
-				#ifdef TC_SERVER_DEBUG
-				tc_log(TC_LOG_DEBUG, "server: tcp: premature close");
-				#endif /* TC_SERVER_DEBUG */
-				/* Closed remotely */
-				tc_server_tcp_response_todo = true;
-				tc_server_tcp_response[0] = "HTTP/1.0 400 Bad Request\r\n\r\n";
-				tc_server_tcp_response[1] = NULL;
-				tc_server_tcp_response_index = 0;
-				tc_server_tcp_response_offset = 0;
-			}
+		if (fd_conf && fd_conf->revents & POLLIN) {
+			/* The configuration files have changed */
+			if (tc_cmd_watch_changed())
+				tc_cmd_reload();
 		}
-		if (fd_tcp_con && tc_server_tcp_response_todo &&
-		    (fd_tcp_con->revents & POLLOUT)) {
-			/* We have to send TCP data */
-			const char *ptr = 
-			             tc_server_tcp_response[tc_server_tcp_response_index]
-			                + tc_server_tcp_response_offset;
-			int r = write(tc_server_tcp_con, ptr, strlen(ptr));
-			if (r > 0) {
-				if (!ptr[r]) {
-					tc_server_tcp_response_index++;
-					tc_server_tcp_response_offset = 0;
-					if (!tc_server_tcp_response[tc_server_tcp_response_index])
-						tc_server_tcp_close();
-				} else
-					tc_server_tcp_response_offset += r;
-			} else {
-				tc_log(TC_LOG_ERR, "server: Error sending TCP");
-				tc_server_tcp_close();
-			}
+		if (fd_exec && fd_exec->revents & POLLIN) {
+			/* Some process has finished */
+			tc_exec_reap();
+		}
+		if (fd_timer && fd_timer->revents & POLLIN) {
+			/* Some timer has expired */
+			if (tc_timer_expire())
+				break;
 		}
 		if (fd_queue && fd_queue->revents & POLLIN) {
 			/* We have received an event */
@@ -330,17 +2014,33 @@ void tc_server_exec(void)
 				tc_log(TC_LOG_ERR, "server: Error reading from event pipe");
 				break;
 			}
-			/* Execute the event */
-			tc_log(TC_LOG_INFO, "Event: \"%s\"", msg.buf);
-			int ret = tc_cmd((const char *)msg.buf, msg.len);
-			if (ret > 0)
+			if (tc_server_queue_event(&msg))
 				break;
-			if (ret < 0)
-				tc_log(TC_LOG_ERR, "Error in event: \"%s\"", msg.buf);
 		}
 	}
 }
 
+void tc_server_changed(void)
+{
+	if (!__atomic_load_n(&tc_server_events_count, __ATOMIC_ACQUIRE) ||
+	    __atomic_exchange_n(&tc_server_events_wake, true, __ATOMIC_ACQ_REL))
+		return;
+	if (tc_msg_send(&tc_server_queue, "", 0))
+		__atomic_store_n(&tc_server_events_wake, false, __ATOMIC_RELEASE);
+}
+
+int tc_server_notify(uint32_t handle)
+{
+	char msg[1 + sizeof(handle)];
+	msg[0] = TC_SERVER_NOTIFY;
+	memcpy(msg + 1, &handle, sizeof(handle));
+	if (tc_msg_send(&tc_server_queue, msg, sizeof(msg))) {
+		tc_log(TC_LOG_ERR, "Error enqueuing notification");
+		return -1;
+	}
+	return 0;
+}
+
 int tc_server_event(const char *buffer, uint8_t len)
 {
 	if (tc_msg_send(&tc_server_queue, buffer, len)) {
@@ -350,7 +2050,17 @@ int tc_server_event(const char *buffer, uint8_t len)
 	return 0;
 }
 
+void tc_server_use_poll(void)
+{
+	tc_server_poll_only = true;
+}
+
 void tc_server_exit(void)
 {
 	tc_server_should_exit = true;
 }
+
+void tc_server_reload(void)
+{
+	tc_server_should_reload = true;
+}
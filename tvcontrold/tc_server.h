@@ -21,11 +21,22 @@ void tc_server_release(void);
  */
 void tc_server_exit(void);
 
+/**
+ *  Make the TC server reload the configuration between commands.
+ */
+void tc_server_reload(void);
+
 /**
  *  Execute the TV control server process.
  */
 void tc_server_exec(void);
 
+/**
+ *  Make the TC server use poll even if io_uring is available, to compare
+ *  them. It should be called before tc_server_exec.
+ */
+void tc_server_use_poll(void);
+
 /**
  *  Enqueue a new event.
  *
@@ -36,4 +47,22 @@ void tc_server_exec(void);
  */
 int tc_server_event(const char *buffer, uint8_t len);
 
+/**
+ *  Enqueue the notification of the change of a variable with a script
+ *  subscribed, executed by the server with tc_cmd_env_notified. It can be
+ *  called from any thread, and no command sent to the server can
+ *  enqueue it.
+ *
+ *  \param handle  Handle of the variable changed.
+ *  \retval -1 on error (with a log entry).
+ *  \retval 0 on success.
+ */
+int tc_server_notify(uint32_t handle);
+
+/**
+ *  Notify the change of an environment variable to the clients of the
+ *  events. It can be called from any thread.
+ */
+void tc_server_changed(void);
+
 #endif /* TC_SERVER_H_INCLUDED */
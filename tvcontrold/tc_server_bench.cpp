@@ -0,0 +1,308 @@
+/**
+ *  Benchmark of the server loop, comparing io_uring with poll.
+ *
+ *  The server runs in a thread of a child process for each backend, and
+ *  the main thread sends requests one after another, waiting for every
+ *  answer: acknowledged UDP commands and HTTP pings through a kept-alive
+ *  connection. It reports the latency of the requests and the system
+ *  calls made by the thread of the server for each one, counted with the
+ *  raw_syscalls:sys_enter tracepoint (it needs tracefs and permission to
+ *  open perf events, or they are not reported).
+ *
+ *  Usage: tc_server_bench [requests]
+ */
+#include <tc_server.h>
+#include <tc_cmd.h>
+#include <tc_log.h>
+#include <linux/perf_event.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/** Port of the server */
+#define TC_BENCH_PORT 1423
+
+/** Requests sent before measuring */
+#define TC_BENCH_WARMUP 200
+
+/** Default number of requests measured of each kind */
+#define TC_BENCH_REQUESTS 5000
+
+/** Tracepoint of the entry to the system calls */
+#define TC_BENCH_TRACEPOINT \
+	"/sys/kernel/tracing/events/raw_syscalls/sys_enter/id"
+
+/** Counter of the system calls of the server thread, or -1 */
+static int tc_bench_counter = -1;
+
+/** Lock and condition to wait for the server thread */
+static pthread_mutex_t tc_bench_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tc_bench_cond = PTHREAD_COND_INITIALIZER;
+static bool tc_bench_started = false;
+
+/**
+ *  Open a counter of the system calls made by the calling thread.
+ *
+ *  \return The descriptor of the counter, or -1 if not available.
+ */
+static int tc_bench_counter_open(void)
+{
+	FILE *f = fopen(TC_BENCH_TRACEPOINT, "r");
+	if (!f)
+		return -1;
+	unsigned long long id;
+	int r = fscanf(f, "%llu", &id);
+	fclose(f);
+	if (r != 1)
+		return -1;
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_TRACEPOINT;
+	attr.size = sizeof(attr);
+	attr.config = id;
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/**
+ *  Read the system calls counted.
+ *
+ *  \return The number of system calls, or 0 without counter.
+ */
+static uint64_t tc_bench_counter_read(void)
+{
+	uint64_t count = 0;
+	if (tc_bench_counter < 0 ||
+	    read(tc_bench_counter, &count, sizeof(count)) != sizeof(count))
+		return 0;
+	return count;
+}
+
+/**
+ *  Thread of the server, counting its own system calls.
+ *
+ *  \param arg  Not used.
+ *  \return NULL.
+ */
+static void *tc_bench_server(void *arg)
+{
+	tc_bench_counter = tc_bench_counter_open();
+	pthread_mutex_lock(&tc_bench_lock);
+	tc_bench_started = true;
+	pthread_cond_signal(&tc_bench_cond);
+	pthread_mutex_unlock(&tc_bench_lock);
+	tc_server_exec();
+	return NULL;
+}
+
+/**
+ *  Get the monotonic time in nanoseconds.
+ *
+ *  \return The time.
+ */
+static uint64_t tc_bench_now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+/**
+ *  Compare two latencies for qsort.
+ */
+static int tc_bench_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+/**
+ *  Send an acknowledged UDP command and wait for its answer.
+ *
+ *  \param fd   UDP socket connected to the server.
+ *  \param seq  Sequence of the message.
+ *  \retval -1 on error.
+ *  \retval 0 on success.
+ */
+static int tc_bench_udp(int fd, uint32_t seq)
+{
+	char buf[128];
+	int len = snprintf(buf, sizeof(buf), "#ack 1 %u\nset bench %u", seq, seq);
+	if (send(fd, buf, len, 0) != len)
+		return -1;
+	return recv(fd, buf, sizeof(buf), 0) > 0 ? 0 : -1;
+}
+
+/**
+ *  Send an HTTP ping through a kept-alive connection and read all its
+ *  answer.
+ *
+ *  \param fd  TCP socket connected to the server.
+ *  \retval -1 on error.
+ *  \retval 0 on success.
+ */
+static int tc_bench_http(int fd)
+{
+	static const char req[] = "GET /ping HTTP/1.1\r\nHost: bench\r\n\r\n";
+	if (send(fd, req, sizeof(req) - 1, 0) != sizeof(req) - 1)
+		return -1;
+	char buf[4096];
+	uint32_t len = 0;
+	int length = -1;
+	char *body = NULL;
+	while (!body || len < (uint32_t)(body - buf) + length) {
+		ssize_t r = recv(fd, buf + len, sizeof(buf) - 1 - len, 0);
+		if (r <= 0)
+			return -1;
+		len += r;
+		buf[len] = 0;
+		if (!body && (body = strstr(buf, "\r\n\r\n"))) {
+			const char *l = strstr(buf, "Content-Length: ");
+			if (!l)
+				return -1;
+			length = atoi(l + 16);
+			body += 4;
+		}
+	}
+	return 0;
+}
+
+/**
+ *  Measure a kind of requests, printing the results.
+ *
+ *  \param name      Name of the requests.
+ *  \param fd        Socket connected to the server.
+ *  \param udp       True for UDP commands, false for HTTP pings.
+ *  \param requests  Number of requests measured.
+ *  \retval -1 on error.
+ *  \retval 0 on success.
+ */
+static int tc_bench_run(const char *name, int fd, bool udp, uint32_t requests)
+{
+	static uint32_t seq = 0;
+	uint64_t *lat = (uint64_t *)malloc(requests * sizeof(uint64_t));
+	uint32_t i;
+	for (i = 0; i < TC_BENCH_WARMUP; i++)
+		if (udp ? tc_bench_udp(fd, ++seq) : tc_bench_http(fd))
+			return -1;
+	uint64_t calls = tc_bench_counter_read();
+	uint64_t total = tc_bench_now();
+	for (i = 0; i < requests; i++) {
+		uint64_t t = tc_bench_now();
+		if (udp ? tc_bench_udp(fd, ++seq) : tc_bench_http(fd)) {
+			free(lat);
+			return -1;
+		}
+		lat[i] = tc_bench_now() - t;
+	}
+	total = tc_bench_now() - total;
+	calls = tc_bench_counter_read() - calls;
+	qsort(lat, requests, sizeof(uint64_t), tc_bench_cmp);
+	printf("  %-5s %8.1f us mean %8.1f us p50 %8.1f us p99",
+	       name, total / 1000.0 / requests, lat[requests / 2] / 1000.0,
+	       lat[requests * 99 / 100] / 1000.0);
+	if (tc_bench_counter >= 0)
+		printf(" %6.2f syscalls/request", (double)calls / requests);
+	printf("\n");
+	free(lat);
+	return 0;
+}
+
+/**
+ *  Connect a socket to the server.
+ *
+ *  \param type  SOCK_DGRAM or SOCK_STREAM.
+ *  \return The socket, or -1 on error.
+ */
+static int tc_bench_connect(int type)
+{
+	int fd = socket(AF_INET, type, 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(TC_BENCH_PORT);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/**
+ *  Benchmark a backend of the server, in a child process.
+ *
+ *  \param poll      True to use poll, false for io_uring.
+ *  \param requests  Number of requests measured of each kind.
+ *  \return The exit status of the process.
+ */
+static int tc_bench_backend(bool poll, uint32_t requests)
+{
+	/* The log of every request is discarded, but still written */
+	if (!freopen("/dev/null", "w", stderr))
+		return 1;
+	tc_log_init();
+	if (tc_cmd_init(false) || tc_server_init())
+		return 1;
+	if (poll)
+		tc_server_use_poll();
+	pthread_t thread;
+	pthread_create(&thread, NULL, tc_bench_server, NULL);
+	pthread_mutex_lock(&tc_bench_lock);
+	while (!tc_bench_started)
+		pthread_cond_wait(&tc_bench_cond, &tc_bench_lock);
+	pthread_mutex_unlock(&tc_bench_lock);
+
+	int udp = tc_bench_connect(SOCK_DGRAM);
+	int tcp = tc_bench_connect(SOCK_STREAM);
+	printf("%s:\n", poll ? "poll" : "io_uring");
+	int r = udp < 0 || tcp < 0 ||
+	        tc_bench_run("udp", udp, true, requests) ||
+	        tc_bench_run("http", tcp, false, requests);
+	if (r)
+		printf("  error in the requests\n");
+	fflush(stdout);
+
+	if (udp >= 0)
+		send(udp, "exit", 4, 0);
+	pthread_join(thread, NULL);
+	if (udp >= 0)
+		close(udp);
+	if (tcp >= 0)
+		close(tcp);
+	tc_server_release();
+	tc_cmd_release();
+	return r;
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t requests = argc > 1 ? atoi(argv[1]) : TC_BENCH_REQUESTS;
+	if (!requests) {
+		fprintf(stderr, "Usage: %s [requests]\n", argv[0]);
+		return 1;
+	}
+	printf("%u requests of each kind, one at a time\n", requests);
+	fflush(stdout);
+
+	/* Every backend runs in its own process */
+	int r = 0;
+	int i;
+	for (i = 0; i < 2; i++) {
+		pid_t pid = fork();
+		if (!pid)
+			return tc_bench_backend(i == 1, requests);
+		int status;
+		if (pid < 0 || waitpid(pid, &status, 0) < 0 ||
+		    !WIFEXITED(status) || WEXITSTATUS(status))
+			r = 1;
+	}
+	return r;
+}
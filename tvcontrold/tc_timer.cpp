@@ -0,0 +1,430 @@
+#include <tc_timer.h>
+#include <tc_cmd.h>
+#include <tc_log.h>
+#include <tc_tools.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/timerfd.h>
+
+/* Define the following macro to debug */
+/* #define TC_TIMER_DEBUG */
+
+/** Bits of the slot index of every level of the wheel */
+#define TC_TIMER_BITS 6
+
+/** Number of slots of every level of the wheel */
+#define TC_TIMER_SLOTS (1 << TC_TIMER_BITS)
+
+/** Number of levels of the wheel. The delays of 32 bits milliseconds
+ *  are below 2^30 ticks, so the expiration and the current tick only
+ *  differ in the lower 31 bits. */
+#define TC_TIMER_LEVELS 6
+
+/** Level of the timers being executed, out of the wheel */
+#define TC_TIMER_DETACHED TC_TIMER_LEVELS
+
+/** Number of buckets of the table of names (power of two) */
+#define TC_TIMER_NAMES 256
+
+/** Nanoseconds of a tick */
+#define TC_TIMER_TICK_NS ((uint64_t)TC_TIMER_TICK_MS * 1000000)
+
+/**
+ *  Timer pending to be executed.
+ */
+typedef struct tc_timer_t {
+	struct tc_timer_t *next;      /**< Next timer of the slot           */
+	struct tc_timer_t **pprev;    /**< Link pointing to this timer      */
+	struct tc_timer_t *name_next; /**< Next timer of the name bucket    */
+	uint64_t expires;             /**< Tick to execute the command      */
+	uint32_t period;              /**< Period in ticks, 0 if only once  */
+	uint8_t level;                /**< Level of the wheel               */
+	uint8_t slot;                 /**< Slot of the level                */
+	uint32_t hash;                /**< Hash of the name                 */
+	char *name;                   /**< Name or NULL                     */
+	char *cmd;                    /**< Command to execute               */
+	uint32_t cmdlen;              /**< Length of the command            */
+	tc_timer_call_t call;         /**< Function to call instead or NULL */
+	void *arg;                    /**< Argument of the function         */
+} tc_timer_t;
+
+/** Descriptor armed for the next tick with timers, or -1 */
+static int tc_timer_tfd = -1;
+
+/** Monotonic time of the tick 0 in nanoseconds */
+static uint64_t tc_timer_base = 0;
+
+/** Tick of the wheel, never after the current time */
+static uint64_t tc_timer_tick = 0;
+
+/** Tick the descriptor is armed for, 0 if not armed */
+static uint64_t tc_timer_armed = 0;
+
+/** Number of timers pending */
+static uint32_t tc_timer_count = 0;
+
+/** Timers of every slot of every level, and bit per slot not empty.
+ *  A timer is in the level of the highest bit that differs between its
+ *  expiration and the tick of the wheel, so the slots of a level are
+ *  moved to the lower ones when the tick reaches them. */
+static tc_timer_t *tc_timer_wheel[TC_TIMER_LEVELS][TC_TIMER_SLOTS];
+static uint64_t tc_timer_used[TC_TIMER_LEVELS];
+
+/** Timers with name by the hash of the name */
+static tc_timer_t *tc_timer_names[TC_TIMER_NAMES];
+
+/**
+ *  Get the current tick.
+ *
+ *  \return The current tick.
+ */
+static uint64_t tc_timer_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	uint64_t ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	return (ns - tc_timer_base) / TC_TIMER_TICK_NS;
+}
+
+/**
+ *  Add a timer to the wheel.
+ *
+ *  \param t  Timer expiring after the tick of the wheel.
+ */
+static void tc_timer_link(tc_timer_t *t)
+{
+	uint64_t diff = t->expires ^ tc_timer_tick;
+	uint32_t level = 0;
+	while (diff >> (TC_TIMER_BITS * (level + 1)))
+		level++;
+	uint32_t slot = (t->expires >> (TC_TIMER_BITS * level)) &
+	                (TC_TIMER_SLOTS - 1);
+	tc_timer_t **head = &tc_timer_wheel[level][slot];
+	t->level = level;
+	t->slot = slot;
+	t->next = *head;
+	if (t->next)
+		t->next->pprev = &t->next;
+	t->pprev = head;
+	*head = t;
+	tc_timer_used[level] |= 1ull << slot;
+}
+
+/**
+ *  Remove a timer from the wheel or from the list being executed.
+ *
+ *  \param t  Timer to remove.
+ */
+static void tc_timer_unlink(tc_timer_t *t)
+{
+	*t->pprev = t->next;
+	if (t->next)
+		t->next->pprev = t->pprev;
+	if (t->level != TC_TIMER_DETACHED &&
+	    !tc_timer_wheel[t->level][t->slot])
+		tc_timer_used[t->level] &= ~(1ull << t->slot);
+}
+
+/**
+ *  Find a timer by name.
+ *
+ *  \param name  Name of the timer.
+ *  \param len   Length of the name.
+ *  \param hash  Hash of the name.
+ *  \return The link to the timer in its bucket, pointing to NULL if
+ *          not found.
+ */
+static tc_timer_t **tc_timer_find(const char *name, uint32_t len,
+                                  uint32_t hash)
+{
+	tc_timer_t **t = &tc_timer_names[hash & (TC_TIMER_NAMES - 1)];
+	while (*t && ((*t)->hash != hash || strlen((*t)->name) != len ||
+	              memcmp((*t)->name, name, len)))
+		t = &(*t)->name_next;
+	return t;
+}
+
+/**
+ *  Remove a timer from the wheel and from the names and free it.
+ *
+ *  \param t  Timer to free.
+ */
+static void tc_timer_free(tc_timer_t *t)
+{
+	tc_timer_unlink(t);
+	if (t->name)
+		*tc_timer_find(t->name, strlen(t->name), t->hash) = t->name_next;
+	tc_timer_count--;
+	free(t);
+}
+
+/**
+ *  Get the next tick where the wheel has something to do.
+ *
+ *  \param tick  Tick to fill.
+ *  \return false if there are no timers.
+ */
+static bool tc_timer_next(uint64_t *tick)
+{
+	uint32_t level;
+	for (level = 0; level < TC_TIMER_LEVELS; level++) {
+		uint32_t shift = TC_TIMER_BITS * level;
+		uint32_t index = (tc_timer_tick >> shift) & (TC_TIMER_SLOTS - 1);
+		uint64_t used = tc_timer_used[level] >> index << index;
+		if (level)
+			used &= ~(1ull << index);
+		if (!used)
+			continue;
+		uint64_t slot = __builtin_ctzll(used);
+		*tick = (tc_timer_tick >> (shift + TC_TIMER_BITS)
+		                       << (shift + TC_TIMER_BITS)) | (slot << shift);
+		return true;
+	}
+	return false;
+}
+
+/**
+ *  Arm the descriptor for the next tick with something to do.
+ */
+static void tc_timer_arm(void)
+{
+	uint64_t tick;
+	if (!tc_timer_next(&tick))
+		tick = 0;
+	if (tick == tc_timer_armed)
+		return;
+	struct itimerspec its;
+	memset(&its, 0, sizeof(its));
+	if (tick) {
+		uint64_t ns = tc_timer_base + tick * TC_TIMER_TICK_NS;
+		its.it_value.tv_sec = ns / 1000000000;
+		its.it_value.tv_nsec = ns % 1000000000;
+	}
+	if (timerfd_settime(tc_timer_tfd, TFD_TIMER_ABSTIME, &its, NULL))
+		tc_log(TC_LOG_ERR, "Error arming the timers");
+	tc_timer_armed = tick;
+}
+
+/**
+ *  Move the wheel to a tick, executing the timers expiring on it.
+ *
+ *  \param tick  Tick with something to do.
+ *  \retval 0 on success.
+ *  \retval 1 on exit command.
+ */
+static int tc_timer_run(uint64_t tick)
+{
+	/* Move the slots reached to the lower levels, from the highest */
+	tc_timer_tick = tick;
+	uint32_t level;
+	for (level = TC_TIMER_LEVELS - 1; level > 0; level--) {
+		uint32_t shift = TC_TIMER_BITS * level;
+		if (tick & ((1ull << shift) - 1))
+			continue;
+		uint32_t slot = (tick >> shift) & (TC_TIMER_SLOTS - 1);
+		tc_timer_t *t = tc_timer_wheel[level][slot];
+		tc_timer_wheel[level][slot] = NULL;
+		tc_timer_used[level] &= ~(1ull << slot);
+		while (t) {
+			tc_timer_t *next = t->next;
+			tc_timer_link(t);
+			t = next;
+		}
+	}
+
+	/* Take the timers expired, the commands can cancel them */
+	uint32_t slot = tick & (TC_TIMER_SLOTS - 1);
+	tc_timer_t *list = tc_timer_wheel[0][slot];
+	if (!list)
+		return 0;
+	tc_timer_wheel[0][slot] = NULL;
+	tc_timer_used[0] &= ~(1ull << slot);
+	list->pprev = &list;
+	tc_timer_t *t;
+	for (t = list; t; t = t->next)
+		t->level = TC_TIMER_DETACHED;
+
+	/* Execute them, adding again the periodic ones */
+	int r = 0;
+	while (list && r <= 0) {
+		t = list;
+		tc_timer_unlink(t);
+		if (t->call) {
+			tc_timer_call_t call = t->call;
+			void *arg = t->arg;
+			tc_timer_free(t);
+			r = call(arg);
+			continue;
+		}
+		uint32_t len = t->cmdlen;
+		char *cmd = strndup(t->cmd, len);
+		if (t->period) {
+			/* The periods missed are not executed */
+			uint64_t now = tc_timer_now();
+			t->expires += t->period;
+			if (t->expires <= now)
+				t->expires = now + t->period;
+			tc_timer_link(t);
+		} else
+			tc_timer_free(t);
+		tc_log(TC_LOG_INFO, "Timer: \"%s\"", cmd);
+		r = tc_cmd(cmd, len);
+		if (r < 0)
+			tc_log(TC_LOG_ERR, "Error in timer: \"%s\"", cmd);
+		free(cmd);
+	}
+
+	/* Keep the rest if exiting */
+	while (list) {
+		t = list;
+		tc_timer_unlink(t);
+		tc_timer_link(t);
+	}
+	return r > 0 ? 1 : 0;
+}
+
+/**
+ *  Add a new timer to the wheel.
+ *
+ *  \param t         Timer created.
+ *  \param ms        Delay or period in milliseconds.
+ *  \param periodic  True to execute the timer every period.
+ */
+static void tc_timer_start(tc_timer_t *t, uint32_t ms, bool periodic)
+{
+	/* An empty wheel just follows the clock */
+	uint64_t now = tc_timer_now();
+	if (!tc_timer_count)
+		tc_timer_tick = now;
+	uint64_t ticks = (ms + TC_TIMER_TICK_MS - 1) / TC_TIMER_TICK_MS;
+	if (!ticks)
+		ticks = 1;
+	t->period = periodic ? ticks : 0;
+	t->expires = now + ticks;
+	tc_timer_link(t);
+	tc_timer_count++;
+	tc_timer_arm();
+}
+
+int tc_timer_init(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	tc_timer_base = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	tc_timer_tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (tc_timer_tfd < 0) {
+		tc_log(TC_LOG_ERR, "Error creating the timer descriptor");
+		return -1;
+	}
+	return 0;
+}
+
+int tc_timer_add(const char *name, uint32_t namelen, uint32_t ms,
+                 bool periodic, const char *cmd, uint32_t cmdlen)
+{
+	if (tc_timer_tfd < 0) {
+		tc_log(TC_LOG_ERR, "Timers are not available");
+		return -1;
+	}
+
+	/* Replace the timer with the same name */
+	uint32_t hash = name ? tc_hash(name, namelen) : 0;
+	if (name) {
+		tc_timer_t *prev = *tc_timer_find(name, namelen, hash);
+		if (prev)
+			tc_timer_free(prev);
+	}
+
+	/* Create the timer with the strings */
+	tc_timer_t *t = (tc_timer_t *)malloc(sizeof(tc_timer_t) + cmdlen + 1 +
+	                                     (name ? namelen + 1 : 0));
+	memset(t, 0, sizeof(tc_timer_t));
+	t->cmd = (char *)(t + 1);
+	memcpy(t->cmd, cmd, cmdlen);
+	t->cmd[cmdlen] = 0;
+	t->cmdlen = cmdlen;
+	if (name) {
+		t->name = t->cmd + cmdlen + 1;
+		memcpy(t->name, name, namelen);
+		t->name[namelen] = 0;
+		t->hash = hash;
+		tc_timer_t **bucket = &tc_timer_names[hash & (TC_TIMER_NAMES - 1)];
+		t->name_next = *bucket;
+		*bucket = t;
+	}
+
+	tc_timer_start(t, ms, periodic);
+	#ifdef TC_TIMER_DEBUG
+	tc_log(TC_LOG_DEBUG, "timer: add: \"%s\" at %llu (level %u)", t->cmd,
+	       (unsigned long long)t->expires, t->level);
+	#endif /* TC_TIMER_DEBUG */
+	return 0;
+}
+
+int tc_timer_call(uint32_t ms, tc_timer_call_t call, void *arg)
+{
+	if (tc_timer_tfd < 0) {
+		tc_log(TC_LOG_ERR, "Timers are not available");
+		return -1;
+	}
+	tc_timer_t *t = (tc_timer_t *)malloc(sizeof(tc_timer_t));
+	memset(t, 0, sizeof(tc_timer_t));
+	t->call = call;
+	t->arg = arg;
+	tc_timer_start(t, ms, false);
+	return 0;
+}
+
+int tc_timer_cancel(const char *name, uint32_t namelen)
+{
+	tc_timer_t *t = *tc_timer_find(name, namelen, tc_hash(name, namelen));
+	if (!t) {
+		tc_log(TC_LOG_ERR, "Timer \"%.*s\" not found", (int)namelen, name);
+		return -1;
+	}
+	tc_timer_free(t);
+	if (tc_timer_tfd >= 0)
+		tc_timer_arm();
+	return 0;
+}
+
+int tc_timer_fd(void)
+{
+	return tc_timer_tfd;
+}
+
+int tc_timer_expire(void)
+{
+	uint64_t n;
+	if (read(tc_timer_tfd, &n, sizeof(n)) < 0)
+		return 0;
+	tc_timer_armed = 0;
+
+	/* Jump to the ticks with something to do until the current one */
+	uint64_t now = tc_timer_now();
+	uint64_t tick;
+	int r = 0;
+	while (!r && tc_timer_next(&tick) && tick <= now)
+		r = tc_timer_run(tick);
+	if (!r)
+		tc_timer_tick = now;
+	tc_timer_arm();
+	return r;
+}
+
+void tc_timer_release(void)
+{
+	uint32_t level, slot;
+	for (level = 0; level < TC_TIMER_LEVELS; level++) {
+		for (slot = 0; slot < TC_TIMER_SLOTS; slot++) {
+			while (tc_timer_wheel[level][slot])
+				tc_timer_free(tc_timer_wheel[level][slot]);
+		}
+	}
+	if (tc_timer_tfd >= 0) {
+		close(tc_timer_tfd);
+		tc_timer_tfd = -1;
+	}
+	tc_timer_armed = 0;
+}
@@ -0,0 +1,91 @@
+/**
+ *  Commands executed after a delay or periodically, and functions of the
+ *  daemon called after a delay
+ */
+#ifndef TC_TIMER_H_INCLUDED
+#define TC_TIMER_H_INCLUDED
+
+#include <tc_types.h>
+
+/** Resolution of the timers in milliseconds */
+#define TC_TIMER_TICK_MS 10
+
+/**
+ *  Initialize the timers.
+ *
+ *  \retval -1 on error (with a log entry).
+ *  \retval 0 on success.
+ */
+int tc_timer_init(void);
+
+/**
+ *  Add a timer to execute a command.
+ *
+ *  A periodic timer replaces any other with the same name.
+ *
+ *  \param name     Name of the timer to cancel it, or NULL.
+ *  \param namelen  Length of the name.
+ *  \param ms       Delay or period in milliseconds.
+ *  \param periodic True to execute the command every period.
+ *  \param cmd      Command to execute.
+ *  \param cmdlen   Length of the command.
+ *  \retval -1 on error (with a log entry).
+ *  \retval 0 on success.
+ */
+int tc_timer_add(const char *name, uint32_t namelen, uint32_t ms,
+                 bool periodic, const char *cmd, uint32_t cmdlen);
+
+/**
+ *  Function of the daemon called by a timer.
+ *
+ *  \param arg  Argument given to tc_timer_call.
+ *  \retval 0 on success.
+ *  \retval 1 on exit command.
+ *  \retval -1 on error (with a log entry).
+ */
+typedef int (*tc_timer_call_t)(void *arg);
+
+/**
+ *  Add a timer to call a function once, which no command can execute.
+ *
+ *  \param ms    Delay in milliseconds.
+ *  \param call  Function to call.
+ *  \param arg   Argument of the function.
+ *  \retval -1 on error (with a log entry).
+ *  \retval 0 on success.
+ */
+int tc_timer_call(uint32_t ms, tc_timer_call_t call, void *arg);
+
+/**
+ *  Cancel a timer.
+ *
+ *  \param name     Name of the timer.
+ *  \param namelen  Length of the name.
+ *  \retval -1 if there is no timer with the name (with a log entry).
+ *  \retval 0 on success.
+ */
+int tc_timer_cancel(const char *name, uint32_t namelen);
+
+/**
+ *  Get the descriptor to poll for expired timers.
+ *
+ *  \retval -1 if not initialized.
+ *  \retval The descriptor to poll for reading.
+ */
+int tc_timer_fd(void);
+
+/**
+ *  Execute the commands of the expired timers, notified through the
+ *  descriptor.
+ *
+ *  \retval 0 on success.
+ *  \retval 1 on exit command.
+ */
+int tc_timer_expire(void);
+
+/**
+ *  Release the timers, without executing them.
+ */
+void tc_timer_release(void);
+
+#endif /* TC_TIMER_H_INCLUDED */
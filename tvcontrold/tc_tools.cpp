@@ -1,5 +1,6 @@
 #include <tc_tools.h>
 #include <unistd.h>
+#include <string.h>
 
 int tc_read_all(int fd, void *buf, int len)
 {
@@ -24,3 +25,120 @@ int tc_write_all(int fd, const void *buf, int len)
 	}
 	return 0;
 }
+
+uint32_t tc_hash(const void *buf, uint32_t len)
+{
+	uint32_t h = TC_HASH_INIT;
+	const uint8_t *b = (const uint8_t *)buf;
+	while (len--)
+		h = TC_HASH_STEP(h, *b++);
+	return h;
+}
+
+/**
+ *  Process a block of 64 bytes of SHA-1.
+ *
+ *  \param h      State of the digest.
+ *  \param block  Block to process.
+ */
+static void tc_sha1_block(uint32_t h[5], const uint8_t *block)
+{
+	uint32_t w[80];
+	uint32_t i;
+	for (i = 0; i < 16; i++)
+		w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 |
+		       (uint32_t)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+	for (i = 16; i < 80; i++) {
+		uint32_t x = w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16];
+		w[i] = x << 1 | x >> 31;
+	}
+	uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+	for (i = 0; i < 80; i++) {
+		uint32_t f, k;
+		if (i < 20) {
+			f = (b & c) | (~b & d);
+			k = 0x5a827999;
+		} else if (i < 40) {
+			f = b ^ c ^ d;
+			k = 0x6ed9eba1;
+		} else if (i < 60) {
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8f1bbcdc;
+		} else {
+			f = b ^ c ^ d;
+			k = 0xca62c1d6;
+		}
+		uint32_t t = (a << 5 | a >> 27) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = b << 30 | b >> 2;
+		b = a;
+		a = t;
+	}
+	h[0] += a;
+	h[1] += b;
+	h[2] += c;
+	h[3] += d;
+	h[4] += e;
+}
+
+void tc_sha1(const void *buf, uint32_t len, uint8_t digest[TC_SHA1_LEN])
+{
+	const uint8_t *data = (const uint8_t *)buf;
+	uint32_t h[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476,
+	                  0xc3d2e1f0 };
+	uint32_t i;
+	for (i = 0; i + 64 <= len; i += 64)
+		tc_sha1_block(h, data + i);
+
+	/* Pad the last blocks with the length in bits */
+	uint8_t block[128];
+	uint32_t rest = len - i;
+	memcpy(block, data + i, rest);
+	block[rest] = 0x80;
+	uint32_t total = rest + 9 <= 64 ? 64 : 128;
+	memset(block + rest + 1, 0, total - rest - 1);
+	uint64_t bits = (uint64_t)len * 8;
+	for (i = 0; i < 8; i++)
+		block[total - 1 - i] = bits >> (i * 8);
+	for (i = 0; i < total; i += 64)
+		tc_sha1_block(h, block + i);
+	for (i = 0; i < TC_SHA1_LEN; i++)
+		digest[i] = h[i / 4] >> (24 - (i % 4) * 8);
+}
+
+uint32_t tc_base64(const void *buf, uint32_t len, char *out)
+{
+	static const char chars[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	const uint8_t *data = (const uint8_t *)buf;
+	uint32_t o = 0;
+	uint32_t i;
+	for (i = 0; i < len; i += 3) {
+		uint32_t v = (uint32_t)data[i] << 16;
+		if (i + 1 < len)
+			v |= (uint32_t)data[i + 1] << 8;
+		if (i + 2 < len)
+			v |= data[i + 2];
+		out[o++] = chars[v >> 18];
+		out[o++] = chars[(v >> 12) & 63];
+		out[o++] = i + 1 < len ? chars[(v >> 6) & 63] : '=';
+		out[o++] = i + 2 < len ? chars[v & 63] : '=';
+	}
+	out[o] = 0;
+	return o;
+}
+
+int tc_vocab_lookup(const tc_vocab_word_t *words, uint32_t seed,
+                    const uint16_t *slot, uint32_t mask,
+                    const char *buf, uint32_t len)
+{
+	uint32_t h = tc_vocab_hash(buf, len, seed);
+	uint16_t i = slot[h & mask];
+	if (!i)
+		return -1;
+	const tc_vocab_word_t *w = &words[i - 1];
+	if (w->len != len || memcmp(w->word, buf, len))
+		return -1;
+	return w->code;
+}
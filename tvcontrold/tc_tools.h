@@ -1,6 +1,8 @@
 #ifndef TC_TOOLS_H_INCLUDED
 #define TC_TOOLS_H_INCLUDED
 
+#include <tc_types.h>
+
 /**
  *  Read all the data from a buffer to a descriptor.
  *
@@ -21,4 +23,163 @@ int tc_read_all(int fd, void *buf, int len);
  */
 int tc_write_all(int fd, const void *buf, int len);
 
+/** Initial value of an incremental hash */
+#define TC_HASH_INIT (2166136261u)
+
+/** Add a new byte to an incremental hash (FNV-1a) */
+#define TC_HASH_STEP(_h, _c) (((_h) ^ (uint8_t)(_c)) * 16777619u)
+
+/**
+ *  Calculate the hash of a buffer.
+ *
+ *  \param buf  Buffer to calculate the hash of.
+ *  \param len  Length of the buffer.
+ *  \return The hash of the buffer.
+ */
+uint32_t tc_hash(const void *buf, uint32_t len);
+
+/** Length of a SHA-1 digest */
+#define TC_SHA1_LEN 20
+
+/**
+ *  Calculate the SHA-1 digest of a buffer.
+ *
+ *  \param buf     Buffer to calculate the digest of.
+ *  \param len     Length of the buffer.
+ *  \param digest  Digest calculated.
+ */
+void tc_sha1(const void *buf, uint32_t len, uint8_t digest[TC_SHA1_LEN]);
+
+/**
+ *  Encode a buffer in base64.
+ *
+ *  \param buf  Buffer to encode.
+ *  \param len  Length of the buffer.
+ *  \param out  Output with room for (len + 2) / 3 * 4 + 1 characters.
+ *  \return The length of the text written, zero terminated.
+ */
+uint32_t tc_base64(const void *buf, uint32_t len, char *out);
+
+/**
+ *  Word (or words separated by one space) of a vocabulary and its code.
+ */
+typedef struct tc_vocab_word_t {
+	const char *word; /**< Text of the word                 */
+	uint32_t len;     /**< Length of the text               */
+	int code;         /**< Code returned when it is found   */
+} tc_vocab_word_t;
+
+/** Declare a word of a vocabulary from a string literal */
+#define TC_VOCAB_WORD(_word, _code) { _word, sizeof(_word) - 1, _code }
+
+/**
+ *  Get the number of slots of a vocabulary: the power of two from twice
+ *  its number of words, so a seed without collisions is easily found.
+ *
+ *  \param count  Number of words.
+ *  \return The number of slots.
+ */
+constexpr uint32_t tc_vocab_slots(uint32_t count)
+{
+	uint32_t n = 2;
+	while (n < count * 2)
+		n <<= 1;
+	return n;
+}
+
+/**
+ *  Vocabulary of N words with a perfect hash, built at compile time with
+ *  tc_vocab_build.
+ */
+template <uint32_t N>
+struct tc_vocab_t {
+	const tc_vocab_word_t *words;       /**< Words of the vocabulary     */
+	uint32_t seed;                      /**< Seed without collisions, 0
+	                                         if none                     */
+	uint16_t slot[tc_vocab_slots(N)];   /**< Index + 1 of the word of
+	                                         each slot                   */
+};
+
+/**
+ *  Calculate the seeded hash of a word of a vocabulary.
+ *
+ *  \param buf   Text of the word.
+ *  \param len   Length of the text.
+ *  \param seed  Seed of the vocabulary.
+ *  \return The hash of the word.
+ */
+constexpr uint32_t tc_vocab_hash(const char *buf, uint32_t len, uint32_t seed)
+{
+	uint32_t h = TC_HASH_INIT ^ seed;
+	for (uint32_t i = 0; i < len; i++)
+		h = TC_HASH_STEP(h, buf[i]);
+	return h ^ (h >> 16);
+}
+
+/**
+ *  Build a vocabulary from an array of words, looking for a seed that
+ *  gives every word its own slot. Should be used to initialize a
+ *  constexpr object, checking its seed with static_assert.
+ *
+ *  \param words  Words of the vocabulary.
+ *  \return The vocabulary.
+ */
+template <uint32_t N>
+constexpr tc_vocab_t<N> tc_vocab_build(const tc_vocab_word_t (&words)[N])
+{
+	static_assert(N < 0xffff, "Too many words for a vocabulary");
+	constexpr uint32_t slots = tc_vocab_slots(N);
+	tc_vocab_t<N> v = {};
+	v.words = words;
+	for (uint32_t seed = 1; seed < 0x10000; seed++) {
+		for (uint32_t s = 0; s < slots; s++)
+			v.slot[s] = 0;
+		uint32_t i = 0;
+		for (; i < N; i++) {
+			uint32_t h = tc_vocab_hash(words[i].word, words[i].len, seed);
+			uint16_t *slot = &v.slot[h & (slots - 1)];
+			if (*slot)
+				break;
+			*slot = i + 1;
+		}
+		if (i == N) {
+			v.seed = seed;
+			return v;
+		}
+	}
+	return v;
+}
+
+/**
+ *  Find a word in the slots of a vocabulary, see tc_vocab_find.
+ *
+ *  \param words  Words of the vocabulary.
+ *  \param seed   Seed of the vocabulary.
+ *  \param slot   Slots of the vocabulary.
+ *  \param mask   Number of slots minus one.
+ *  \param buf    Text to find.
+ *  \param len    Length of the text.
+ *  \retval -1 if it is not a word of the vocabulary.
+ *  \retval The code of the word.
+ */
+int tc_vocab_lookup(const tc_vocab_word_t *words, uint32_t seed,
+                    const uint16_t *slot, uint32_t mask,
+                    const char *buf, uint32_t len);
+
+/**
+ *  Find a word in a vocabulary.
+ *
+ *  \param v    Vocabulary built with tc_vocab_build.
+ *  \param buf  Text to find.
+ *  \param len  Length of the text.
+ *  \retval -1 if it is not a word of the vocabulary.
+ *  \retval The code of the word.
+ */
+template <uint32_t N>
+inline int tc_vocab_find(const tc_vocab_t<N> *v, const char *buf, uint32_t len)
+{
+	return tc_vocab_lookup(v->words, v->seed, v->slot, tc_vocab_slots(N) - 1,
+	                       buf, len);
+}
+
 #endif /* TC_TOOLS_H_INCLUDED */
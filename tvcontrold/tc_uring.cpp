@@ -0,0 +1,243 @@
+#include <config.h>
+
+#ifdef ENABLE_URING
+
+#include <tc_uring.h>
+#include <tc_log.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+/* The tail of the ring of provided buffers is in the reserved field of
+   the first one, struct io_uring_buf_ring can't be used from C++ */
+#define TC_URING_BUF_TAIL(_ring) ((_ring)->bufs[0].resv)
+
+/* Features needed: a single mapping, completions not dropped on
+   overflow and the timeout of the waits */
+#define TC_URING_FEATURES (IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | \
+                           IORING_FEAT_EXT_ARG)
+
+int tc_uring_init(tc_uring_t *ring, uint32_t entries)
+{
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = -1;
+
+	/* Only this thread submits, and its work is run when it waits */
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+	int fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (fd < 0) {
+		tc_log(TC_LOG_WARN, "io_uring not available: %s", strerror(errno));
+		return -1;
+	}
+	ring->fd = fd;
+	if ((p.features & TC_URING_FEATURES) != TC_URING_FEATURES) {
+		tc_log(TC_LOG_WARN, "io_uring without the features needed");
+		tc_uring_release(ring);
+		return -1;
+	}
+
+	/* Map both queues and the submission entries */
+	size_t sqsize = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+	size_t cqsize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	ring->rings_size = sqsize > cqsize ? sqsize : cqsize;
+	void *rings = mmap(NULL, ring->rings_size, PROT_READ | PROT_WRITE,
+	                   MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (rings == MAP_FAILED) {
+		tc_log(TC_LOG_ERR, "Error mapping the io_uring queues");
+		tc_uring_release(ring);
+		return -1;
+	}
+	ring->rings = rings;
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	void *sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+	                  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED) {
+		tc_log(TC_LOG_ERR, "Error mapping the io_uring entries");
+		tc_uring_release(ring);
+		return -1;
+	}
+	ring->sqes = (struct io_uring_sqe *)sqes;
+	uint8_t *base = (uint8_t *)rings;
+	ring->sq_head = (uint32_t *)(base + p.sq_off.head);
+	ring->sq_tail = (uint32_t *)(base + p.sq_off.tail);
+	ring->sq_array = (uint32_t *)(base + p.sq_off.array);
+	ring->sq_mask = *(uint32_t *)(base + p.sq_off.ring_mask);
+	ring->sq_entries = p.sq_entries;
+	ring->cq_head = (uint32_t *)(base + p.cq_off.head);
+	ring->cq_tail = (uint32_t *)(base + p.cq_off.tail);
+	ring->cq_mask = *(uint32_t *)(base + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(base + p.cq_off.cqes);
+
+	/* Every slot of the queue submits its own entry */
+	uint32_t i;
+	for (i = 0; i < ring->sq_entries; i++)
+		ring->sq_array[i] = i;
+	return 0;
+}
+
+void tc_uring_release(tc_uring_t *ring)
+{
+	if (ring->fd != -1) {
+		close(ring->fd);
+		ring->fd = -1;
+	}
+	if (ring->sqes) {
+		munmap(ring->sqes, ring->sqes_size);
+		ring->sqes = NULL;
+	}
+	if (ring->rings) {
+		munmap(ring->rings, ring->rings_size);
+		ring->rings = NULL;
+	}
+	free(ring->bufs);
+	ring->bufs = NULL;
+	free(ring->buf_data);
+	ring->buf_data = NULL;
+}
+
+int tc_uring_buffers(tc_uring_t *ring, uint32_t count, uint32_t size)
+{
+	/* The ring of buffers must be aligned to a page */
+	void *bufs = NULL;
+	if (posix_memalign(&bufs, sysconf(_SC_PAGESIZE),
+	                   count * sizeof(struct io_uring_buf))) {
+		tc_log(TC_LOG_ERR, "No memory for the io_uring buffers");
+		return -1;
+	}
+	memset(bufs, 0, count * sizeof(struct io_uring_buf));
+	ring->bufs = (struct io_uring_buf *)bufs;
+	ring->buf_data = (uint8_t *)malloc(count * size);
+	if (!ring->buf_data) {
+		tc_log(TC_LOG_ERR, "No memory for the io_uring buffers");
+		return -1;
+	}
+	ring->buf_count = count;
+	ring->buf_size = size;
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uintptr_t)bufs;
+	reg.ring_entries = count;
+	reg.bgid = TC_URING_BUF_GROUP;
+	if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING,
+	            &reg, 1) < 0) {
+		tc_log(TC_LOG_ERR, "Error registering the io_uring buffers");
+		return -1;
+	}
+
+	/* Give every buffer to the kernel */
+	uint32_t i;
+	for (i = 0; i < count; i++) {
+		struct io_uring_buf *buf = &ring->bufs[i];
+		buf->addr = (uintptr_t)(ring->buf_data + i * size);
+		buf->len = size;
+		buf->bid = i;
+	}
+	__atomic_store_n(&TC_URING_BUF_TAIL(ring), count, __ATOMIC_RELEASE);
+	return 0;
+}
+
+uint8_t *tc_uring_buffer(tc_uring_t *ring, const struct io_uring_cqe *cqe)
+{
+	uint32_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+	return ring->buf_data + bid * ring->buf_size;
+}
+
+void tc_uring_buffer_put(tc_uring_t *ring, const struct io_uring_cqe *cqe)
+{
+	uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+	uint16_t tail = TC_URING_BUF_TAIL(ring);
+	struct io_uring_buf *buf = &ring->bufs[tail & (ring->buf_count - 1)];
+	buf->addr = (uintptr_t)(ring->buf_data + bid * ring->buf_size);
+	buf->len = ring->buf_size;
+	buf->bid = bid;
+	__atomic_store_n(&TC_URING_BUF_TAIL(ring), tail + 1, __ATOMIC_RELEASE);
+}
+
+int tc_uring_fixed(tc_uring_t *ring, void *buf, uint32_t len)
+{
+	struct iovec iov;
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS,
+	            &iov, 1) < 0) {
+		tc_log(TC_LOG_ERR, "Error registering the io_uring fixed buffer");
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ *  Publish the entries prepared and submit every entry not consumed.
+ *
+ *  \param ring   Ring with the entries.
+ *  \param wait   Completions to wait for.
+ *  \param flags  IORING_ENTER_* flags.
+ *  \param arg    Argument of the flags.
+ *  \retval -1 on error, with errno.
+ *  \retval 0 on success.
+ */
+static int tc_uring_enter(tc_uring_t *ring, uint32_t wait, uint32_t flags,
+                          struct io_uring_getevents_arg *arg)
+{
+	uint32_t tail = *ring->sq_tail + ring->sq_pending;
+	ring->sq_pending = 0;
+	__atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+	uint32_t submit = tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	int r = syscall(__NR_io_uring_enter, ring->fd, submit, wait, flags, arg,
+	                arg ? sizeof(*arg) : 0);
+	return r < 0 ? -1 : 0;
+}
+
+struct io_uring_sqe *tc_uring_sqe(tc_uring_t *ring, uint8_t opcode, int fd,
+                                  uint64_t user_data)
+{
+	/* Submit the entries prepared when the queue is full */
+	uint32_t tail = *ring->sq_tail + ring->sq_pending;
+	while (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) ==
+	       ring->sq_entries) {
+		if (tc_uring_enter(ring, 0, 0, NULL) && errno != EINTR)
+			tc_log(TC_LOG_ERR, "Error submitting to io_uring");
+		tail = *ring->sq_tail;
+	}
+	struct io_uring_sqe *sqe = &ring->sqes[tail & ring->sq_mask];
+	ring->sq_pending++;
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->user_data = user_data;
+	return sqe;
+}
+
+int tc_uring_wait(tc_uring_t *ring, int timeout)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	memset(&arg, 0, sizeof(arg));
+	if (timeout >= 0) {
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (long long)(timeout % 1000) * 1000000;
+		arg.ts = (uintptr_t)&ts;
+	}
+	return tc_uring_enter(ring, 1, IORING_ENTER_GETEVENTS |
+	                      IORING_ENTER_EXT_ARG, &arg);
+}
+
+struct io_uring_cqe *tc_uring_cqe(tc_uring_t *ring)
+{
+	uint32_t head = *ring->cq_head;
+	if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+		return NULL;
+	return &ring->cqes[head & ring->cq_mask];
+}
+
+void tc_uring_cqe_seen(tc_uring_t *ring)
+{
+	__atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+#endif /* ENABLE_URING */
@@ -0,0 +1,147 @@
+/**
+ *  Minimal io_uring ring, driven through the system calls
+ */
+#ifndef TC_URING_H_INCLUDED
+#define TC_URING_H_INCLUDED
+
+#include <config.h>
+
+#ifdef ENABLE_URING
+
+#include <tc_types.h>
+#include <linux/io_uring.h>
+
+/**
+ *  Submission and completion queues of a ring, with its group of
+ *  provided buffers.
+ */
+typedef struct tc_uring_t {
+	int fd;                         /**< Descriptor of the ring           */
+	void *rings;                    /**< Mapping of both queues           */
+	size_t rings_size;              /**< Size of the mapping of queues    */
+	struct io_uring_sqe *sqes;      /**< Submission entries               */
+	size_t sqes_size;               /**< Size of the submission entries   */
+	uint32_t *sq_head;              /**< Head of the submission queue     */
+	uint32_t *sq_tail;              /**< Tail of the submission queue     */
+	uint32_t *sq_array;             /**< Indexes of the entries submitted */
+	uint32_t sq_mask;               /**< Mask of the submission indexes   */
+	uint32_t sq_entries;            /**< Entries of the submission queue  */
+	uint32_t sq_pending;            /**< Entries not submitted yet        */
+	uint32_t *cq_head;              /**< Head of the completion queue     */
+	uint32_t *cq_tail;              /**< Tail of the completion queue     */
+	uint32_t cq_mask;               /**< Mask of the completion indexes   */
+	struct io_uring_cqe *cqes;      /**< Completion entries               */
+	struct io_uring_buf *bufs;      /**< Ring of the provided buffers     */
+	uint8_t *buf_data;              /**< Memory of the provided buffers   */
+	uint32_t buf_count;             /**< Number of provided buffers       */
+	uint32_t buf_size;              /**< Size of every provided buffer    */
+} tc_uring_t;
+
+/** Constant to initialize a ring variable */
+#define TC_URING_INIT { -1 }
+
+/** Group of the provided buffers of a ring */
+#define TC_URING_BUF_GROUP 0
+
+/**
+ *  Create a ring for this thread. It needs Linux 6.0, where every
+ *  operation used by the server is available.
+ *
+ *  \param ring     Ring to create.
+ *  \param entries  Entries of the submission queue, a power of 2.
+ *  \retval -1 if io_uring is not available (with a log entry).
+ *  \retval 0 on success.
+ */
+int tc_uring_init(tc_uring_t *ring, uint32_t entries);
+
+/**
+ *  Release a ring, cancelling the operations in progress.
+ *
+ *  \param ring  Ring to release.
+ */
+void tc_uring_release(tc_uring_t *ring);
+
+/**
+ *  Register the provided buffers of the ring, selected by the kernel
+ *  for the operations with IOSQE_BUFFER_SELECT in TC_URING_BUF_GROUP.
+ *
+ *  \param ring   Ring to register the buffers in.
+ *  \param count  Number of buffers, a power of 2.
+ *  \param size   Size of every buffer.
+ *  \retval -1 on error (with a log entry).
+ *  \retval 0 on success.
+ */
+int tc_uring_buffers(tc_uring_t *ring, uint32_t count, uint32_t size);
+
+/**
+ *  Get a provided buffer selected for a completion.
+ *
+ *  \param ring  Ring of the buffer.
+ *  \param cqe   Completion with IORING_CQE_F_BUFFER.
+ *  \return The memory of the buffer.
+ */
+uint8_t *tc_uring_buffer(tc_uring_t *ring, const struct io_uring_cqe *cqe);
+
+/**
+ *  Give back a provided buffer to the kernel, once it has been used.
+ *
+ *  \param ring  Ring of the buffer.
+ *  \param cqe   Completion with IORING_CQE_F_BUFFER.
+ */
+void tc_uring_buffer_put(tc_uring_t *ring, const struct io_uring_cqe *cqe);
+
+/**
+ *  Register a buffer to be read with IORING_OP_READ_FIXED as the
+ *  index 0, without mapping its pages for every read.
+ *
+ *  \param ring  Ring to register the buffer in.
+ *  \param buf   Buffer to register.
+ *  \param len   Length of the buffer.
+ *  \retval -1 on error (with a log entry).
+ *  \retval 0 on success.
+ */
+int tc_uring_fixed(tc_uring_t *ring, void *buf, uint32_t len);
+
+/**
+ *  Get a submission entry to prepare, submitted with the next wait.
+ *
+ *  \param ring       Ring of the operation.
+ *  \param opcode     IORING_OP_* operation.
+ *  \param fd         Descriptor of the operation.
+ *  \param user_data  Value returned with its completions.
+ *  \return The entry, cleared but for the given fields.
+ */
+struct io_uring_sqe *tc_uring_sqe(tc_uring_t *ring, uint8_t opcode, int fd,
+                                  uint64_t user_data);
+
+/**
+ *  Submit the entries prepared and wait for a completion, with a single
+ *  system call.
+ *
+ *  \param ring     Ring to wait for.
+ *  \param timeout  Milliseconds to wait, -1 without limit.
+ *  \retval -1 on timeout (ETIME), signal (EINTR) or error, with errno.
+ *  \retval 0 otherwise.
+ *  \remarks It can return without completions, after submitting.
+ */
+int tc_uring_wait(tc_uring_t *ring, int timeout);
+
+/**
+ *  Get the next completion of the ring.
+ *
+ *  \param ring  Ring with the completions.
+ *  \retval NULL if there are no more completions.
+ *  \retval The completion, valid until tc_uring_cqe_seen.
+ */
+struct io_uring_cqe *tc_uring_cqe(tc_uring_t *ring);
+
+/**
+ *  Mark the completion returned by tc_uring_cqe as processed.
+ *
+ *  \param ring  Ring with the completions.
+ */
+void tc_uring_cqe_seen(tc_uring_t *ring);
+
+#endif /* ENABLE_URING */
+
+#endif /* TC_URING_H_INCLUDED */
@@ -0,0 +1,215 @@
+#include <tc_work.h>
+#include <tc_log.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Define the following macro to debug */
+/* #define TC_WORK_DEBUG */
+
+/** Lock of the lanes, the sequences and the state of the pool */
+static pthread_mutex_t tc_work_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Signaled when a job is posted or finished */
+static pthread_cond_t tc_work_cond = PTHREAD_COND_INITIALIZER;
+
+/** Lanes with jobs */
+static tc_work_lane_t *tc_work_lanes = NULL;
+
+/** Threads of the pool */
+static pthread_t *tc_work_thread = NULL;
+static uint32_t tc_work_count = 0;
+
+/** True when the threads should finish */
+static bool tc_work_stop = false;
+
+/**
+ *  Find a lane whose first job can run, with the lock taken.
+ *
+ *  \return The lane or NULL.
+ */
+static tc_work_lane_t *tc_work_next(void)
+{
+	tc_work_lane_t *lane;
+	for (lane = tc_work_lanes; lane; lane = lane->next) {
+		if (lane->busy)
+			continue;
+		tc_work_seq_t *seq = lane->first->seq;
+		if (!seq || seq->done >= lane->first->after)
+			return lane;
+	}
+	return NULL;
+}
+
+/**
+ *  Thread of the pool, running the jobs of the lanes.
+ *
+ *  \param arg  Not used.
+ *  \return NULL.
+ */
+static void *tc_work_exec(void *arg)
+{
+	#ifdef TC_WORK_DEBUG
+	tc_log(TC_LOG_DEBUG, "work: thread pid:%u", (unsigned)syscall(SYS_gettid));
+	#endif /* TC_WORK_DEBUG */
+	pthread_mutex_lock(&tc_work_lock);
+	while (true) {
+		tc_work_lane_t *lane = tc_work_next();
+		if (!lane) {
+			if (tc_work_stop)
+				break;
+			pthread_cond_wait(&tc_work_cond, &tc_work_lock);
+			continue;
+		}
+
+		/* Run the job without the lock, the lane keeps it while busy */
+		tc_work_job_t *job = lane->first;
+		tc_work_seq_t *seq = job->seq;
+		bool skip = seq && seq->failed;
+		lane->busy = true;
+		pthread_mutex_unlock(&tc_work_lock);
+		int r = skip ? 0 : job->run(job);
+		pthread_mutex_lock(&tc_work_lock);
+
+		/* Remove it, and the lane from the list once empty */
+		lane->busy = false;
+		lane->first = job->next;
+		if (!lane->first) {
+			lane->last = NULL;
+			tc_work_lane_t **l = &tc_work_lanes;
+			while (*l != lane)
+				l = &(*l)->next;
+			*l = lane->next;
+			lane->next = NULL;
+		}
+		if (seq) {
+			seq->done++;
+			if (r)
+				seq->failed = true;
+		}
+		if (seq)
+			seq->refs--;
+		pthread_mutex_unlock(&tc_work_lock);
+		if (job->free)
+			job->free(job);
+		pthread_mutex_lock(&tc_work_lock);
+		lane->pending--;
+		pthread_cond_broadcast(&tc_work_cond);
+	}
+	pthread_mutex_unlock(&tc_work_lock);
+	return NULL;
+}
+
+int tc_work_init(uint32_t threads)
+{
+	tc_work_thread = (pthread_t *)malloc(threads * sizeof(pthread_t));
+	if (!tc_work_thread) {
+		tc_log(TC_LOG_ERR, "No memory for the threads of the pool");
+		return -1;
+	}
+	tc_work_stop = false;
+	for (tc_work_count = 0; tc_work_count < threads; tc_work_count++) {
+		if (pthread_create(&tc_work_thread[tc_work_count], NULL,
+		                   tc_work_exec, NULL)) {
+			tc_log(TC_LOG_ERR, "Error creating the threads of the pool");
+			tc_work_release();
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void tc_work_release(void)
+{
+	pthread_mutex_lock(&tc_work_lock);
+	while (tc_work_lanes && tc_work_count)
+		pthread_cond_wait(&tc_work_cond, &tc_work_lock);
+	tc_work_stop = true;
+	pthread_cond_broadcast(&tc_work_cond);
+	pthread_mutex_unlock(&tc_work_lock);
+	uint32_t i;
+	for (i = 0; i < tc_work_count; i++)
+		pthread_join(tc_work_thread[i], NULL);
+	free(tc_work_thread);
+	tc_work_thread = NULL;
+	tc_work_count = 0;
+}
+
+int tc_work_post(tc_work_lane_t *lane, tc_work_job_t *job, tc_work_seq_t *seq)
+{
+	/* Without pool it is run now, already in order */
+	if (!tc_work_count) {
+		int r = job->run(job);
+		if (job->free)
+			job->free(job);
+		return r;
+	}
+
+	pthread_mutex_lock(&tc_work_lock);
+	job->seq = seq;
+	job->next = NULL;
+	if (seq) {
+		job->after = seq->parallel ? seq->barrier : seq->queued;
+		seq->queued++;
+		seq->refs++;
+	}
+	if (lane->last)
+		lane->last->next = job;
+	else {
+		lane->first = job;
+		lane->next = tc_work_lanes;
+		tc_work_lanes = lane;
+	}
+	lane->last = job;
+	lane->pending++;
+	pthread_cond_broadcast(&tc_work_cond);
+	pthread_mutex_unlock(&tc_work_lock);
+	return 1;
+}
+
+bool tc_work_reserve(tc_work_lane_t *lane, uint32_t max)
+{
+	pthread_mutex_lock(&tc_work_lock);
+	bool free = lane->pending < max;
+	pthread_mutex_unlock(&tc_work_lock);
+	return free;
+}
+
+void tc_work_drain(tc_work_lane_t *lane)
+{
+	pthread_mutex_lock(&tc_work_lock);
+	while (lane->pending)
+		pthread_cond_wait(&tc_work_cond, &tc_work_lock);
+	pthread_mutex_unlock(&tc_work_lock);
+}
+
+bool tc_work_seq_start(tc_work_seq_t *seq)
+{
+	pthread_mutex_lock(&tc_work_lock);
+	bool idle = !seq->refs;
+	if (idle) {
+		memset(seq, 0, sizeof(tc_work_seq_t));
+		seq->refs = 1;
+	}
+	pthread_mutex_unlock(&tc_work_lock);
+	return idle;
+}
+
+void tc_work_seq_put(tc_work_seq_t *seq)
+{
+	pthread_mutex_lock(&tc_work_lock);
+	seq->refs--;
+	pthread_mutex_unlock(&tc_work_lock);
+}
+
+bool tc_work_seq_parallel(tc_work_seq_t *seq, bool parallel)
+{
+	pthread_mutex_lock(&tc_work_lock);
+	bool prev = seq->parallel;
+	if (parallel && !prev)
+		seq->barrier = seq->queued;
+	seq->parallel = parallel;
+	pthread_mutex_unlock(&tc_work_lock);
+	return prev;
+}
@@ -0,0 +1,125 @@
+/**
+ *  Pool of threads running the jobs of the devices, in order per device
+ */
+#ifndef TC_WORK_H_INCLUDED
+#define TC_WORK_H_INCLUDED
+
+#include <tc_types.h>
+
+/** Default number of threads of the pool */
+#define TC_WORK_THREADS 4
+
+/**
+ *  Sequence of jobs of several lanes, run in the order they are posted.
+ *  It is owned by the poster and reused once its jobs have finished.
+ */
+typedef struct tc_work_seq_t {
+	uint32_t refs;    /**< Poster and jobs not finished            */
+	uint32_t queued;  /**< Jobs posted                             */
+	uint32_t done;    /**< Jobs finished or skipped                */
+	uint32_t barrier; /**< Jobs posted before the parallel block   */
+	bool parallel;    /**< True inside a parallel block            */
+	bool failed;      /**< True once a job has failed              */
+} tc_work_seq_t;
+
+/**
+ *  Job to run in a lane, embedded in the object of the caller.
+ */
+typedef struct tc_work_job_t {
+	int (*run)(struct tc_work_job_t *job);   /**< Run it, 0 on success     */
+	void (*free)(struct tc_work_job_t *job); /**< Free it, run or skipped,
+	                                              or NULL                  */
+	tc_work_seq_t *seq;                      /**< Sequence or NULL         */
+	uint32_t after;                          /**< Jobs of the sequence
+	                                              finished before it       */
+	struct tc_work_job_t *next;              /**< Next job of the lane     */
+} tc_work_job_t;
+
+/**
+ *  Lane of jobs run in order, one at a time. The jobs of different lanes
+ *  run at the same time.
+ */
+typedef struct tc_work_lane_t {
+	tc_work_job_t *first;        /**< Job running or next to run     */
+	tc_work_job_t *last;         /**< Last job posted                */
+	uint32_t pending;            /**< Jobs posted and not freed      */
+	bool busy;                   /**< True while the first one runs  */
+	struct tc_work_lane_t *next; /**< Next lane with jobs            */
+} tc_work_lane_t;
+
+/** Constant to initialize a lane variable */
+#define TC_WORK_LANE_INIT { NULL, NULL, 0, false, NULL }
+
+/**
+ *  Start the threads of the pool. Until it is called the jobs are run
+ *  when posted.
+ *
+ *  \param threads  Number of threads.
+ *  \retval -1 on error (with a log entry).
+ *  \retval 0 on success.
+ */
+int tc_work_init(uint32_t threads);
+
+/**
+ *  Wait for every job posted and stop the threads of the pool.
+ */
+void tc_work_release(void);
+
+/**
+ *  Post a job to the end of a lane.
+ *
+ *  \param lane  Lane to run the job in.
+ *  \param job   Job with the run and free functions set.
+ *  \param seq   Sequence of the job, or NULL.
+ *  \retval 1 if it has been posted.
+ *  \retval The result of the job if it has been run without pool.
+ */
+int tc_work_post(tc_work_lane_t *lane, tc_work_job_t *job, tc_work_seq_t *seq);
+
+/**
+ *  Check if a lane has less than a number of jobs posted and not freed,
+ *  to reuse the slot of the oldest one, without waiting. The jobs of a
+ *  lane are freed in the order they are posted.
+ *
+ *  \param lane  Lane of the jobs.
+ *  \param max   Maximum number of jobs.
+ *  \return True if there is a slot, false if the lane is full.
+ */
+bool tc_work_reserve(tc_work_lane_t *lane, uint32_t max);
+
+/**
+ *  Wait for every job of a lane, to release the object of the lane.
+ *
+ *  \param lane  Lane to wait for.
+ */
+void tc_work_drain(tc_work_lane_t *lane);
+
+/**
+ *  Start a sequence if the jobs of its previous use have finished,
+ *  without waiting. Every job posted with it waits for the ones posted
+ *  before, but the ones posted in a parallel block, and the jobs after
+ *  one that fails are skipped.
+ *
+ *  \param seq  Sequence to start, released with tc_work_seq_put.
+ *  \return True if started, false if it is still in use.
+ */
+bool tc_work_seq_start(tc_work_seq_t *seq);
+
+/**
+ *  Release a sequence, reusable once its jobs have finished.
+ *
+ *  \param seq  Sequence to release.
+ */
+void tc_work_seq_put(tc_work_seq_t *seq);
+
+/**
+ *  Open or close a parallel block of a sequence. The jobs posted in a
+ *  block only wait for the ones posted before the block.
+ *
+ *  \param seq       Sequence of the block.
+ *  \param parallel  True to open the block, false to close it.
+ *  \return True if a block was already open.
+ */
+bool tc_work_seq_parallel(tc_work_seq_t *seq, bool parallel);
+
+#endif /* TC_WORK_H_INCLUDED */
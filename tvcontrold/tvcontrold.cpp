@@ -4,7 +4,12 @@
 #include <tc_cmd.h>
 #include <tc_osd.h>
 #include <tc_mouse.h>
+#include <tc_exec.h>
+#include <tc_timer.h>
+#include <tc_work.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <config.h>
 #include <sys/types.h>
@@ -19,11 +24,23 @@ void sig_handler(int signo)
 	} else if (signo == SIGTERM) {
 		tc_log(TC_LOG_INFO, "Received SIGTERM");
 		tc_server_exit();
+	} else if (signo == SIGHUP) {
+		tc_log(TC_LOG_INFO, "Received SIGHUP");
+		tc_server_reload();
 	}
 }
 
-int main(void)
+int main(int argc, char **argv)
 {
+	/* Check the arguments */
+	bool compile = false;
+	if (argc == 2 && !strcmp(argv[1], "--compile"))
+		compile = true;
+	else if (argc > 1) {
+		fprintf(stderr, "Usage: %s [--compile]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
 	/* Initialize the log */
 	tc_log_init();
 	tc_log(TC_LOG_INFO, "Starting tvcontrold");
@@ -34,6 +51,8 @@ int main(void)
 		tc_log(TC_LOG_WARN, "Cannot capture SIGINT");
 	if (signal(SIGTERM, sig_handler) == SIG_ERR)
 		tc_log(TC_LOG_WARN, "Cannot capture SIGTERM");
+	if (signal(SIGHUP, sig_handler) == SIG_ERR)
+		tc_log(TC_LOG_WARN, "Cannot capture SIGHUP");
 
 	/* Go to the home path for loading data */
 	const char *home = getenv("HOME");
@@ -45,7 +64,17 @@ int main(void)
 	if (!readhome)
 		tc_log(TC_LOG_WARN, "Error detecting home path");
 
-	/* Initialize every submodule */
+	/* Only compile the configuration if requested */
+	if (compile)
+		return tc_cmd_compile(readhome) ? EXIT_FAILURE : EXIT_SUCCESS;
+
+	/* Initialize every submodule, processes before any thread */
+	if (tc_exec_init())
+		return EXIT_FAILURE;
+	if (tc_timer_init())
+		return EXIT_FAILURE;
+	if (tc_work_init(TC_WORK_THREADS))
+		return EXIT_FAILURE;
 	if (tc_cmd_init(readhome))
 		return EXIT_FAILURE;
 	#ifdef ENABLE_CEC
@@ -71,8 +100,9 @@ int main(void)
 	/* Serve commands */
 	tc_server_exec();
 
-	/* Release everything */
+	/* Release everything, once the devices have finished */
 	tc_log(TC_LOG_INFO, "Closing tvcontrold");
+	tc_work_release();
 	#ifdef ENABLE_CEC
 	tc_cec_release();
 	#endif /* ENABLE_CEC */
@@ -81,7 +111,9 @@ int main(void)
 	tc_osd_release();
 	#endif /* ENABLE_OSD */
 	tc_mouse_release();
+	tc_timer_release();
 	tc_cmd_release();
+	tc_exec_release();
 	tc_log(TC_LOG_INFO, "Closed tvcontrold");
 	return EXIT_SUCCESS;
 }